@@ -0,0 +1,139 @@
+/*
+ * OpenToken - FIDO2 credential lookup benchmark (host)
+ * Copyright (c) 2025 OpenToken Project
+ *
+ * Time to find every credential of one RP by rp_id_hash, as done on each
+ * GetAssertion: linear memcmp scan over all slots (the old lookup) against
+ * the RAM hash index from storage_index.c, for growing credential counts.
+ * Credentials are spread over N/4 RPs; half of the queries are for RPs with
+ * no credential, which is the worst case for the scan.
+ */
+#include "storage.h"
+#include "storage_index.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define QUERIES 20000
+#define MAX_RESULTS 64
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Stand-in for SHA-256(rp_id): deterministic, uniformly spread bytes
+static void fake_rp_hash(uint32_t rp, uint8_t out[32]) {
+  uint32_t x = rp * 2654435761u + 0x9E3779B9u;
+  for (int i = 0; i < 32; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    out[i] = (uint8_t)x;
+  }
+}
+
+static uint32_t linear_find(const storage_fido2_entry_t *entries, uint32_t n,
+                            const uint8_t *rp_id_hash, uint16_t *out) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < n && count < MAX_RESULTS; i++) {
+    if (entries[i].active == 1 &&
+        memcmp(entries[i].rp_id_hash, rp_id_hash, 32) == 0)
+      out[count++] = (uint16_t)i;
+  }
+  return count;
+}
+
+static uint32_t index_find(const storage_fido2_entry_t *entries,
+                           const storage_index_t *index,
+                           const uint8_t *rp_id_hash, uint16_t *out) {
+  uint16_t candidates[MAX_RESULTS];
+  uint32_t n = storage_index_find(index, storage_index_digest_key(rp_id_hash),
+                                  candidates, MAX_RESULTS);
+  if (n > MAX_RESULTS)
+    n = MAX_RESULTS;
+  uint32_t count = 0;
+  for (uint32_t c = 0; c < n; c++) {
+    const storage_fido2_entry_t *e = &entries[candidates[c]];
+    if (e->active == 1 && memcmp(e->rp_id_hash, rp_id_hash, 32) == 0)
+      out[count++] = candidates[c];
+  }
+  return count;
+}
+
+static uint32_t bucket_count_for(uint32_t creds) {
+  uint32_t buckets = 1;
+  while (buckets < 2 * creds)
+    buckets <<= 1;
+  return buckets;
+}
+
+int main(void) {
+  const uint32_t counts[] = {50, 500, 5000};
+  static uint8_t queries[QUERIES][32];
+
+  printf("%8s %8s %14s %14s %10s\n", "creds", "buckets", "linear ns/op",
+         "index ns/op", "speedup");
+
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    uint32_t n = counts[c];
+    uint32_t rps = n / 4;
+    uint32_t buckets = bucket_count_for(n);
+
+    storage_fido2_entry_t *entries = calloc(n, sizeof(*entries));
+    storage_index_bucket_t *table = calloc(buckets, sizeof(*table));
+    if (!entries || !table) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+
+    storage_index_t index;
+    storage_index_init(&index, table, buckets);
+    srand(1234);
+    for (uint32_t i = 0; i < n; i++) {
+      fake_rp_hash((uint32_t)rand() % rps, entries[i].rp_id_hash);
+      entries[i].active = 1;
+      storage_index_insert(&index,
+                           storage_index_digest_key(entries[i].rp_id_hash),
+                           (uint16_t)i);
+    }
+    for (uint32_t q = 0; q < QUERIES; q++) {
+      // Odd queries ask for RPs that were never registered
+      uint32_t rp = (q & 1) ? rps + q : (uint32_t)rand() % rps;
+      fake_rp_hash(rp, queries[q]);
+    }
+
+    uint16_t out_linear[MAX_RESULTS], out_index[MAX_RESULTS];
+    volatile uint32_t sink = 0;
+
+    double t0 = now_us();
+    for (uint32_t q = 0; q < QUERIES; q++)
+      sink += linear_find(entries, n, queries[q], out_linear);
+    double linear_ns = (now_us() - t0) * 1000.0 / QUERIES;
+
+    t0 = now_us();
+    for (uint32_t q = 0; q < QUERIES; q++)
+      sink += index_find(entries, &index, queries[q], out_index);
+    double index_ns = (now_us() - t0) * 1000.0 / QUERIES;
+
+    // Both lookups must agree (ascending slot order)
+    for (uint32_t q = 0; q < QUERIES; q++) {
+      uint32_t a = linear_find(entries, n, queries[q], out_linear);
+      uint32_t b = index_find(entries, &index, queries[q], out_index);
+      if (a != b || memcmp(out_linear, out_index, a * sizeof(uint16_t))) {
+        fprintf(stderr, "mismatch at %u credentials, query %u\n", n, q);
+        return 1;
+      }
+    }
+
+    printf("%8u %8u %14.1f %14.1f %9.1fx\n", n, buckets, linear_ns, index_ns,
+           linear_ns / index_ns);
+    (void)sink;
+    free(entries);
+    free(table);
+  }
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * OpenToken - P-256 backend check and benchmark (host)
+ * Copyright (c) 2025 OpenToken Project
+ *
+ * Differential check of src/secure/p256.c against mbedtls_ecp, then timing
+ * of both:
+ * - public keys: p256_public_key() == mbedtls_ecp_mul(d, G) for random d
+ *   and the edge scalars 1, 2, 2^32, 2^128 and n-1; 0 and n are rejected
+ * - keygen: the returned point is d*G per mbedtls
+ * - ECDSA: every signature verifies with mbedtls_ecdsa_verify(), for
+ *   20/32/48 byte hashes and hashes at or above n
+ *
+ * Host builds run p256.c's portable C path; on the device the UMAAL path
+ * is timed by the "Bench: hsm_sign_ecc_slot" line of OPENTOKEN_CYCLE_BENCH
+ * builds (with and without OPENTOKEN_P256_FAST).
+ *
+ * Usage: bench_p256 [iterations]   (exit status 1 on any mismatch)
+ */
+#include "p256.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/ecp.h"
+
+static uint64_t g_rng_state = 0x9E3779B97F4A7C15ULL;
+static unsigned g_failures = 0;
+
+// Deterministic test RNG (xorshift64*)
+static int test_rng(void *ctx, unsigned char *out, size_t len) {
+  (void)ctx;
+  for (size_t i = 0; i < len; i++) {
+    g_rng_state ^= g_rng_state >> 12;
+    g_rng_state ^= g_rng_state << 25;
+    g_rng_state ^= g_rng_state >> 27;
+    out[i] = (uint8_t)((g_rng_state * 0x2545F4914F6CDD1DULL) >> 56);
+  }
+  return 0;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void fail(const char *what, unsigned i) {
+  printf("MISMATCH: %s (case %u)\n", what, i);
+  g_failures++;
+}
+
+// d*G by mbedtls, big-endian coordinates
+static bool reference_public(mbedtls_ecp_group *grp, const uint8_t d[32],
+                             uint8_t x[32], uint8_t y[32]) {
+  mbedtls_mpi m;
+  mbedtls_ecp_point q;
+  mbedtls_mpi_init(&m);
+  mbedtls_ecp_point_init(&q);
+  bool ok = mbedtls_mpi_read_binary(&m, d, 32) == 0 &&
+            mbedtls_ecp_mul(grp, &q, &m, &grp->G, test_rng, NULL) == 0 &&
+            mbedtls_mpi_write_binary(&q.X, x, 32) == 0 &&
+            mbedtls_mpi_write_binary(&q.Y, y, 32) == 0;
+  mbedtls_mpi_free(&m);
+  mbedtls_ecp_point_free(&q);
+  return ok;
+}
+
+static bool reference_verify(mbedtls_ecp_group *grp, const uint8_t x[32],
+                             const uint8_t y[32], const uint8_t *hash,
+                             size_t hash_len, const uint8_t sig[64]) {
+  mbedtls_ecp_point q;
+  mbedtls_mpi r, s;
+  mbedtls_ecp_point_init(&q);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+  bool ok = mbedtls_mpi_read_binary(&q.X, x, 32) == 0 &&
+            mbedtls_mpi_read_binary(&q.Y, y, 32) == 0 &&
+            mbedtls_mpi_lset(&q.Z, 1) == 0 &&
+            mbedtls_mpi_read_binary(&r, sig, 32) == 0 &&
+            mbedtls_mpi_read_binary(&s, sig + 32, 32) == 0 &&
+            mbedtls_ecdsa_verify(grp, hash, hash_len, &q, &r, &s) == 0;
+  mbedtls_ecp_point_free(&q);
+  mbedtls_mpi_free(&r);
+  mbedtls_mpi_free(&s);
+  return ok;
+}
+
+static void check_scalar(mbedtls_ecp_group *grp, const uint8_t d[32],
+                         unsigned i) {
+  uint8_t x[32], y[32], rx[32], ry[32];
+  if (!p256_public_key(d, x, y) || !reference_public(grp, d, rx, ry) ||
+      memcmp(x, rx, 32) != 0 || memcmp(y, ry, 32) != 0)
+    fail("public key", i);
+}
+
+static void check_edges(mbedtls_ecp_group *grp) {
+  static const uint8_t k_n_minus_1[32] = {
+      0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF,
+      0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xBC, 0xE6, 0xFA, 0xAD, 0xA7, 0x17,
+      0x9E, 0x84, 0xF3, 0xB9, 0xCA, 0xC2, 0xFC, 0x63, 0x25, 0x50};
+  uint8_t d[32], x[32], y[32];
+
+  static const int k_bits[] = {0, 1, 32, 128};
+  for (unsigned i = 0; i < sizeof(k_bits) / sizeof(k_bits[0]); i++) {
+    memset(d, 0, sizeof(d));
+    d[31 - k_bits[i] / 8] = (uint8_t)(1u << (k_bits[i] % 8));
+    check_scalar(grp, d, i);
+  }
+  check_scalar(grp, k_n_minus_1, 4);
+
+  memset(d, 0, sizeof(d));
+  if (p256_public_key(d, x, y))
+    fail("scalar 0 accepted", 5);
+  memcpy(d, k_n_minus_1, sizeof(d));
+  d[31]++;
+  if (p256_public_key(d, x, y))
+    fail("scalar n accepted", 6);
+}
+
+int main(int argc, char **argv) {
+  unsigned iterations = argc > 1 ? (unsigned)atoi(argv[1]) : 200;
+  mbedtls_ecp_group grp;
+  mbedtls_ecp_group_init(&grp);
+  if (mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1) != 0) {
+    printf("mbedtls group load failed\n");
+    return 1;
+  }
+
+  check_edges(&grp);
+
+  static const size_t k_hash_lens[] = {20, 32, 48};
+  for (unsigned i = 0; i < iterations; i++) {
+    uint8_t d[32], x[32], y[32], rx[32], ry[32], hash[48], sig[64];
+    if (!p256_keygen(d, x, y, test_rng, NULL)) {
+      fail("keygen", i);
+      continue;
+    }
+    if (!reference_public(&grp, d, rx, ry) || memcmp(x, rx, 32) != 0 ||
+        memcmp(y, ry, 32) != 0)
+      fail("keygen public key", i);
+
+    size_t hash_len = k_hash_lens[i % 3];
+    test_rng(NULL, hash, sizeof(hash));
+    if (i % 7 == 0)
+      memset(hash, 0xFF, sizeof(hash)); // e >= n
+    if (!p256_ecdsa_sign(d, hash, hash_len, sig, test_rng, NULL) ||
+        !reference_verify(&grp, x, y, hash, hash_len, sig))
+      fail("signature", i);
+  }
+  printf("%u keypairs and signatures checked against mbedtls: %u "
+         "mismatches\n",
+         iterations, g_failures);
+
+  // Timing: ECDSA sign and keygen, p256.c vs mbedtls_ecp
+  uint8_t d[32], x[32], y[32], hash[32] = {1}, sig[64];
+  p256_keygen(d, x, y, test_rng, NULL);
+  mbedtls_mpi md, r, s;
+  mbedtls_ecp_point q;
+  mbedtls_mpi_init(&md);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+  mbedtls_ecp_point_init(&q);
+  mbedtls_mpi_read_binary(&md, d, 32);
+
+  double t0 = now_ns();
+  for (unsigned i = 0; i < iterations; i++)
+    p256_ecdsa_sign(d, hash, sizeof(hash), sig, test_rng, NULL);
+  double sign_fast = (now_ns() - t0) / iterations;
+
+  t0 = now_ns();
+  for (unsigned i = 0; i < iterations; i++)
+    mbedtls_ecdsa_sign(&grp, &r, &s, &md, hash, sizeof(hash), test_rng, NULL);
+  double sign_ref = (now_ns() - t0) / iterations;
+
+  t0 = now_ns();
+  for (unsigned i = 0; i < iterations; i++)
+    p256_keygen(d, x, y, test_rng, NULL);
+  double gen_fast = (now_ns() - t0) / iterations;
+
+  t0 = now_ns();
+  for (unsigned i = 0; i < iterations; i++)
+    mbedtls_ecp_gen_keypair(&grp, &md, &q, test_rng, NULL);
+  double gen_ref = (now_ns() - t0) / iterations;
+
+  printf("\n%-12s %12s %12s %8s\n", "operation", "mbedtls us", "p256.c us",
+         "speedup");
+  printf("%-12s %12.1f %12.1f %7.2fx\n", "ECDSA sign", sign_ref / 1000,
+         sign_fast / 1000, sign_ref / sign_fast);
+  printf("%-12s %12.1f %12.1f %7.2fx\n", "keygen", gen_ref / 1000,
+         gen_fast / 1000, gen_ref / gen_fast);
+
+  mbedtls_mpi_free(&md);
+  mbedtls_mpi_free(&r);
+  mbedtls_mpi_free(&s);
+  mbedtls_ecp_point_free(&q);
+  mbedtls_ecp_group_free(&grp);
+  return g_failures ? 1 : 0;
+}
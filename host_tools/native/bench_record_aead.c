@@ -0,0 +1,153 @@
+/*
+ * OpenToken - Storage commit benchmark (host)
+ * Copyright (c) 2025 OpenToken Project
+ *
+ * Compares the cost of persisting one changed entry with the v2 layout
+ * (whole 32KB payload sealed as one AES-GCM message, region erased and
+ * reprogrammed) against the per-record layout (only the changed entry is
+ * sealed and appended as one flash page).
+ *
+ * Crypto time is measured on the host. Flash time uses typical W25Q128JV
+ * datasheet figures so the numbers can be compared with the device.
+ */
+#include "storage.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/gcm.h"
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+
+// W25Q128JV typical timings
+#define FLASH_SECTOR_ERASE_US 45000.0
+#define FLASH_PAGE_PROGRAM_US 400.0
+
+// v2 layout: [NONCE (12)] [TAG (16)] [ENCRYPTED 32KB - 28]
+#define LEGACY_SIZE_BYTES (32 * 1024)
+#define LEGACY_PAYLOAD_SIZE (LEGACY_SIZE_BYTES - 28)
+
+// Per-record layout: 40 byte header (12 cleartext bytes + nonce + tag). The
+// cleartext part plus the 4 byte segment generation is the AAD.
+#define RECORD_HEADER_SIZE 40
+#define RECORD_AAD_SIZE 16
+
+#define ITERATIONS 200
+
+typedef struct {
+  const char *name;
+  size_t plain_len; // Bytes run through AES-GCM
+  size_t aad_len;
+  uint32_t sectors_erased;
+  uint32_t pages_programmed;
+} bench_case_t;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Median wall time of one seal (key schedule included; see bench_key_cache)
+static double time_seal(const bench_case_t *c, uint8_t *plain, uint8_t *out) {
+  static double samples[ITERATIONS];
+  uint8_t key[32] = {0x42};
+  uint8_t nonce[12] = {0};
+  uint8_t aad[RECORD_AAD_SIZE] = {0};
+  uint8_t tag[16];
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    nonce[0] = (uint8_t)i;
+    double t0 = now_us();
+    mbedtls_gcm_context ctx;
+    mbedtls_gcm_init(&ctx);
+    mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
+    mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, c->plain_len, nonce,
+                              sizeof(nonce), c->aad_len ? aad : NULL,
+                              c->aad_len, plain, out, sizeof(tag), tag);
+    mbedtls_gcm_free(&ctx);
+    samples[i] = now_us() - t0;
+  }
+
+  qsort(samples, ITERATIONS, sizeof(double), cmp_double);
+  return samples[ITERATIONS / 2];
+}
+
+int main(void) {
+  const bench_case_t cases[] = {
+      {"v2 blob (any update)", LEGACY_PAYLOAD_SIZE, 0,
+       LEGACY_SIZE_BYTES / FLASH_SECTOR_SIZE,
+       LEGACY_SIZE_BYTES / FLASH_PAGE_SIZE},
+      {"record: OATH entry", sizeof(storage_oath_entry_t), RECORD_AAD_SIZE, 0,
+       1},
+      {"record: FIDO2 entry", sizeof(storage_fido2_entry_t), RECORD_AAD_SIZE,
+       0, 1},
+      {"record: HSM key", sizeof(storage_hsm_key_t), RECORD_AAD_SIZE, 0, 1},
+      {"record: system/PIN", sizeof(storage_system_t), RECORD_AAD_SIZE, 0, 1},
+  };
+
+  uint8_t *plain = calloc(1, LEGACY_PAYLOAD_SIZE);
+  uint8_t *out = malloc(LEGACY_PAYLOAD_SIZE);
+  if (!plain || !out) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("%-22s %10s %12s %10s %10s %14s\n", "layout", "enc bytes",
+         "seal us(host)", "erases", "pages", "flash ms(est)");
+
+  double legacy_flash_ms = 0;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    const bench_case_t *c = &cases[i];
+    double seal_us = time_seal(c, plain, out);
+    double flash_ms = (c->sectors_erased * FLASH_SECTOR_ERASE_US +
+                       c->pages_programmed * FLASH_PAGE_PROGRAM_US) /
+                      1000.0;
+    if (i == 0)
+      legacy_flash_ms = flash_ms;
+
+    printf("%-22s %10zu %12.1f %10u %10u %14.2f", c->name, c->plain_len,
+           seal_us, c->sectors_erased, c->pages_programmed, flash_ms);
+    if (i > 0)
+      printf("  (%.0fx less flash time, %.0fx fewer bytes sealed)",
+             legacy_flash_ms / flash_ms,
+             (double)LEGACY_PAYLOAD_SIZE / c->plain_len);
+    printf("\n");
+  }
+
+  // A full segment is checkpointed into the next one of the ring: erase it,
+  // reseal the group holding the changed entry into its spare sector and
+  // program the new segment header.
+  uint32_t group_pages = FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE;
+  uint32_t checkpoint_pages = group_pages + 1;
+  uint32_t appends = STORAGE_SEGMENT_SIZE_BYTES / FLASH_PAGE_SIZE - 1;
+  double checkpoint_ms =
+      ((STORAGE_SEGMENT_SIZE_BYTES / FLASH_SECTOR_SIZE + 1) *
+           FLASH_SECTOR_ERASE_US +
+       checkpoint_pages * FLASH_PAGE_PROGRAM_US) /
+      1000.0;
+
+  printf("\nRecord overhead on flash: %d byte header, 1 page per update.\n",
+         RECORD_HEADER_SIZE);
+  printf("Checkpoint (%u KB segments, one group resealed): %u pages every %u "
+         "updates, %.1f ms,\n",
+         STORAGE_SEGMENT_SIZE_BYTES / 1024, checkpoint_pages, appends,
+         checkpoint_ms);
+  printf("amortized %.2f ms of flash time per update (%.0fx less than "
+         "v2).\n",
+         checkpoint_ms / appends + FLASH_PAGE_PROGRAM_US / 1000.0,
+         legacy_flash_ms /
+             (checkpoint_ms / appends + FLASH_PAGE_PROGRAM_US / 1000.0));
+
+  free(plain);
+  free(out);
+  return 0;
+}
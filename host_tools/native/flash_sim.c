@@ -0,0 +1,147 @@
+/*
+ * OpenToken - NOR flash model for host builds of the storage layer
+ * Copyright (c) 2025 OpenToken Project
+ *
+ * Stands in for storage_flash.c: the storage area lives in a RAM array and
+ * every erase/program is checked against NOR rules and timed (see
+ * flash_sim.h).
+ */
+#include "flash_sim.h"
+#include "storage_flash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#define SIM_BASE STORAGE_COUNTER_OFFSET
+#define SIM_SIZE (PICO_FLASH_SIZE_BYTES - SIM_BASE)
+#define SIM_SECTORS (SIM_SIZE / FLASH_SECTOR_SIZE)
+
+static uint8_t g_flash[SIM_SIZE];
+static uint32_t g_sector_erases[SIM_SECTORS];
+static flash_sim_timing_t g_timing = FLASH_SIM_TIMING_TYPICAL;
+static flash_sim_stats_t g_stats;
+static uint64_t g_now_us = 0;
+
+// What storage_flash.c reports: erase counts (storage.c adds those restored
+// from the manifests), bytes and one sample per erase/program
+static uint32_t g_reported_erases[SIM_SECTORS];
+static uint64_t g_reported_programmed = 0;
+static storage_histogram_t g_irq_off_us;
+
+static void check_range(const char *what, uint32_t offset, uint32_t len,
+                        uint32_t align) {
+  if (offset < SIM_BASE || len > PICO_FLASH_SIZE_BYTES - offset ||
+      offset % align != 0 || len % align != 0) {
+    fprintf(stderr,
+            "flash_sim: %s of %lu bytes at 0x%08lx outside the storage area "
+            "or not %lu-byte aligned\n",
+            what, (unsigned long)len, (unsigned long)offset,
+            (unsigned long)align);
+    abort();
+  }
+}
+
+void flash_sim_init(const flash_sim_timing_t *timing) {
+  if (timing)
+    g_timing = *timing;
+  memset(g_flash, 0xFF, sizeof(g_flash));
+  memset(g_sector_erases, 0, sizeof(g_sector_erases));
+  memset(&g_stats, 0, sizeof(g_stats));
+  memset(g_reported_erases, 0, sizeof(g_reported_erases));
+  memset(&g_irq_off_us, 0, sizeof(g_irq_off_us));
+  g_reported_programmed = 0;
+  g_now_us = 0;
+}
+
+void flash_sim_advance_us(uint64_t us) { g_now_us += us; }
+
+uint64_t flash_sim_now_us(void) { return g_now_us; }
+
+void flash_sim_get_stats(flash_sim_stats_t *out) { *out = g_stats; }
+
+void flash_sim_reset_stats(void) { memset(&g_stats, 0, sizeof(g_stats)); }
+
+uint32_t flash_sim_sector_count(uint32_t *base_out) {
+  if (base_out)
+    *base_out = SIM_BASE;
+  return SIM_SECTORS;
+}
+
+uint32_t flash_sim_sector_erases(uint32_t sector) {
+  return sector < SIM_SECTORS ? g_sector_erases[sector] : 0;
+}
+
+absolute_time_t get_absolute_time(void) { return g_now_us; }
+
+// storage_flash.h
+
+const uint8_t *storage_flash_ptr(uint32_t offset) {
+  check_range("read", offset, 0, 1);
+  return g_flash + (offset - SIM_BASE);
+}
+
+void storage_flash_erase(uint32_t offset, uint32_t len) {
+  check_range("erase", offset, len, FLASH_SECTOR_SIZE);
+  for (uint32_t done = 0; done < len; done += FLASH_SECTOR_SIZE) {
+    uint32_t at = offset - SIM_BASE + done;
+    memset(g_flash + at, 0xFF, FLASH_SECTOR_SIZE);
+    g_sector_erases[at / FLASH_SECTOR_SIZE]++;
+    g_reported_erases[at / FLASH_SECTOR_SIZE]++;
+    storage_histogram_add(&g_irq_off_us, g_timing.sector_erase_us);
+    g_stats.erases++;
+    g_stats.busy_us += g_timing.sector_erase_us;
+    g_now_us += g_timing.sector_erase_us;
+  }
+}
+
+void storage_flash_program(uint32_t offset, const uint8_t *data,
+                           uint32_t len) {
+  check_range("program", offset, len, FLASH_PAGE_SIZE);
+  for (uint32_t i = 0; i < len; i++) {
+    uint8_t *cell = &g_flash[offset - SIM_BASE + i];
+    if (data[i] == 0xFF)
+      continue;
+    if ((*cell & data[i]) != data[i]) {
+      fprintf(stderr,
+              "flash_sim: program of 0x%02X over 0x%02X at 0x%08lx needs an "
+              "erase first\n",
+              data[i], *cell, (unsigned long)(offset + i));
+      abort();
+    }
+    *cell = data[i];
+    g_stats.bytes_programmed++;
+  }
+  uint32_t pages = len / FLASH_PAGE_SIZE;
+  for (uint32_t p = 0; p < pages; p++)
+    storage_histogram_add(&g_irq_off_us, g_timing.page_program_us);
+  g_reported_programmed += len;
+  g_stats.page_programs += pages;
+  g_stats.busy_us += (uint64_t)pages * g_timing.page_program_us;
+  g_now_us += (uint64_t)pages * g_timing.page_program_us;
+}
+
+bool storage_flash_is_erased(uint32_t offset, uint32_t len) {
+  const uint8_t *p = storage_flash_ptr(offset);
+  for (uint32_t i = 0; i < len; i++) {
+    if (p[i] != 0xFF)
+      return false;
+  }
+  return true;
+}
+
+uint32_t storage_flash_erase_count(uint32_t sector) {
+  return sector < SIM_SECTORS ? g_reported_erases[sector] : 0;
+}
+
+void storage_flash_add_erase_count(uint32_t sector, uint32_t erases) {
+  if (sector < SIM_SECTORS)
+    g_reported_erases[sector] += erases;
+}
+
+uint64_t storage_flash_bytes_programmed(void) { return g_reported_programmed; }
+
+const storage_histogram_t *storage_flash_irq_off_us(void) {
+  return &g_irq_off_us;
+}
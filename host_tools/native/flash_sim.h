@@ -0,0 +1,51 @@
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// RAM-backed NOR flash model for host builds of the storage layer. It
+// implements storage_flash.h over the storage area (counter area up to the
+// end of flash) and behaves like the QSPI part on the board:
+// - erases are whole sectors, programs whole pages (misaligned calls abort)
+// - programming only clears bits: storing a byte that needs a 0 -> 1
+//   transition aborts (erase-before-write). 0xFF bytes in a program buffer
+//   leave flash as it is, like on the device.
+// - every erase/program advances the simulated clock (get_absolute_time())
+//   by its busy time
+// - erases are counted per sector
+
+typedef struct {
+  uint32_t sector_erase_us;
+  uint32_t page_program_us;
+} flash_sim_timing_t;
+
+// W25Q128JV datasheet: 45 ms / 0.4 ms typical, 400 ms / 3 ms maximum
+#define FLASH_SIM_TIMING_TYPICAL {45000, 400}
+#define FLASH_SIM_TIMING_WORST {400000, 3000}
+#define FLASH_SIM_ENDURANCE_CYCLES 100000 // Erases per sector (datasheet)
+
+typedef struct {
+  uint64_t erases;
+  uint64_t page_programs;
+  uint64_t bytes_programmed; // Bytes a program changed (non-0xFF)
+  uint64_t busy_us;          // Time spent erasing/programming
+} flash_sim_stats_t;
+
+// Erased device, clock at 0
+void flash_sim_init(const flash_sim_timing_t *timing);
+
+// Simulated time passing outside flash operations
+void flash_sim_advance_us(uint64_t us);
+uint64_t flash_sim_now_us(void);
+
+// Counters since init or the last reset. Sector erase counts are kept
+// separately and only cleared by flash_sim_init().
+void flash_sim_get_stats(flash_sim_stats_t *out);
+void flash_sim_reset_stats(void);
+
+// Sectors of the modelled area, starting at flash offset `base`
+uint32_t flash_sim_sector_count(uint32_t *base_out);
+uint32_t flash_sim_sector_erases(uint32_t sector);
+
+#endif // FLASH_SIM_H
@@ -0,0 +1,9 @@
+#ifndef OPENTOKEN_SHIM_HARDWARE_FLASH_H
+#define OPENTOKEN_SHIM_HARDWARE_FLASH_H
+
+// Host build: flash geometry of the Pico SDK. The flash itself is the RAM
+// model in flash_sim.c, reached through storage_flash.h.
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#endif // OPENTOKEN_SHIM_HARDWARE_FLASH_H
@@ -0,0 +1,6 @@
+#ifndef OPENTOKEN_SHIM_HARDWARE_STRUCTS_OTP_H
+#define OPENTOKEN_SHIM_HARDWARE_STRUCTS_OTP_H
+
+// Host build: no OTP block
+
+#endif // OPENTOKEN_SHIM_HARDWARE_STRUCTS_OTP_H
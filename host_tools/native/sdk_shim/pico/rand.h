@@ -0,0 +1,9 @@
+#ifndef OPENTOKEN_SHIM_PICO_RAND_H
+#define OPENTOKEN_SHIM_PICO_RAND_H
+
+#include <stdint.h>
+
+// Host build: supplied by the tool (e.g. from getrandom())
+uint64_t get_rand_64(void);
+
+#endif // OPENTOKEN_SHIM_PICO_RAND_H
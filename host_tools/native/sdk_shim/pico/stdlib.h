@@ -0,0 +1,18 @@
+#ifndef OPENTOKEN_SHIM_PICO_STDLIB_H
+#define OPENTOKEN_SHIM_PICO_STDLIB_H
+
+#include <stdint.h>
+
+// Host build: time since boot is the simulated clock of flash_sim.c, which
+// flash operations advance by their busy time
+typedef uint64_t absolute_time_t; // Microseconds
+
+absolute_time_t get_absolute_time(void);
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+  return (uint32_t)(t / 1000);
+}
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+
+#endif // OPENTOKEN_SHIM_PICO_STDLIB_H
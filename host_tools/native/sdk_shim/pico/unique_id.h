@@ -0,0 +1,15 @@
+#ifndef OPENTOKEN_SHIM_PICO_UNIQUE_ID_H
+#define OPENTOKEN_SHIM_PICO_UNIQUE_ID_H
+
+#include <stdint.h>
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+typedef struct {
+  uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES];
+} pico_unique_board_id_t;
+
+// Provided by the host program
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out);
+
+#endif // OPENTOKEN_SHIM_PICO_UNIQUE_ID_H
@@ -0,0 +1,564 @@
+/*
+ * OpenToken - Storage endurance and latency simulator (host)
+ * Copyright (c) 2025 OpenToken Project
+ *
+ * Runs the real storage layer (storage.c and friends) on the NOR flash
+ * model of flash_sim.c and replays typical daily use:
+ * - WebAuthn assertions: PIN verification (retry counter charged and
+ *   flushed, then reset write-back), sign counter increment and the flush
+ *   CTAP2 does before answering
+ * - HOTP codes: OATH counter increment
+ * - OATH list / TOTP: iterate the accounts and read their keys
+ * - now and then a new credential or OATH account (in a transaction) and
+ *   an account deletion (flushed, as the OATH applet does)
+ * - a couple of reboots a week, half of them a power cut that loses the
+ *   pending write-back
+ * Between commands the main loop is idle and calls storage_task(), which
+ * does the write-back and the background erases/compaction.
+ *
+ * A model of what each command acknowledged (entries, their counters, the
+ * PIN retry counter) is checked against storage after every reboot.
+ *
+ * Reported: flash busy time of each command's storage calls (what the host
+ * waits for) and of each storage_task() call (what USB servicing waits
+ * for) as percentiles, and per-sector erase rates projected to the flash
+ * endurance. Crypto time is not modelled, only flash time.
+ *
+ * Usage: sim_storage [days] [seed] [--worst]   (exit status 1 on any storage
+ * error or model mismatch)
+ */
+#include "flash_sim.h"
+#include "storage.h"
+#include "storage_flash.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_handling.h"
+#include "hsm_layer.h"
+#include "pico/unique_id.h"
+
+// Daily profile
+#define ASSERTIONS_PER_DAY 30
+#define PIN_FAILURES_PER_DAY 1
+#define HOTP_PER_DAY 5
+#define OATH_LISTS_PER_DAY 10
+#define REGISTRATIONS_PER_WEEK 1
+#define OATH_ADDS_PER_MONTH 2
+#define OATH_DELETES_PER_MONTH 1
+#define REBOOTS_PER_WEEK 2
+#define ACTIVE_HOURS 10 // Commands are spread over this part of the day
+
+// Starting population
+#define INITIAL_OATH 20
+#define INITIAL_FIDO2 10
+
+// Main loop while idle: quiet time before maintenance, then storage_task()
+// calls this far apart, as many as fit before the next command
+#define IDLE_QUIET_MS 250
+#define IDLE_TICK_MS 5
+#define IDLE_TICKS_MAX 400
+
+typedef enum {
+  EV_ASSERTION,
+  EV_PIN_FAILURE,
+  EV_HOTP,
+  EV_OATH_LIST,
+  EV_REGISTRATION,
+  EV_OATH_ADD,
+  EV_OATH_DELETE,
+  EV_REBOOT,
+  EV_KIND_COUNT
+} event_kind_t;
+
+static const char *const k_event_names[EV_KIND_COUNT] = {
+    "assertion", "PIN failure", "HOTP", "OATH list", "registration",
+    "OATH add", "OATH delete", "reboot"};
+
+typedef struct {
+  uint64_t at_ms;
+  event_kind_t kind;
+} event_t;
+
+typedef struct {
+  uint32_t *us;
+  size_t count, cap;
+} samples_t;
+
+static samples_t g_command_us[EV_KIND_COUNT];
+static samples_t g_task_us;
+static uint32_t g_rng = 1;
+static uint32_t g_errors = 0;
+static uint32_t g_mismatches = 0;
+static uint32_t g_power_cuts = 0;
+
+// Model: what storage acknowledged as durable
+typedef struct {
+  bool present;
+  uint8_t id_len;
+  uint8_t id[64];   // OATH name / FIDO2 credential ID
+  uint32_t counter; // HOTP counter / sign count
+} model_entry_t;
+
+static model_entry_t g_model_oath[STORAGE_OATH_MAX_ACCOUNTS];
+static model_entry_t g_model_fido2[STORAGE_FIDO2_MAX_CREDS];
+static uint8_t g_model_retries = HSM_PIN_MAX_RETRIES;
+
+// Host stand-ins for the HSM layer and error reporting
+
+static uint32_t rng_next(void) {
+  g_rng ^= g_rng << 13;
+  g_rng ^= g_rng >> 17;
+  g_rng ^= g_rng << 5;
+  return g_rng;
+}
+
+bool hsm_get_random(uint8_t *out, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    out[i] = (uint8_t)rng_next();
+  return true;
+}
+
+void hsm_drop_key_contexts(void) {}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out) {
+  static const uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES] = {
+      0xE6, 0x61, 0x38, 0x97, 0x23, 0x5A, 0x4B, 0x2C};
+  memcpy(id_out->id, id, sizeof(id));
+}
+
+void error_report(error_code_t code, error_severity_t severity,
+                  const char *file, uint16_t line, const char *function,
+                  const char *format, ...) {
+  va_list args;
+  (void)severity;
+  fprintf(stderr, "error 0x%04X in %s (%s:%u): ", (unsigned)code, function,
+          file, (unsigned)line);
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+  g_errors++;
+}
+
+// Samples
+
+static void sample_add(samples_t *s, uint64_t us) {
+  if (s->count == s->cap) {
+    s->cap = s->cap ? 2 * s->cap : 1024;
+    s->us = realloc(s->us, s->cap * sizeof(*s->us));
+    if (!s->us) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  s->us[s->count++] = (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_percentiles(const char *name, samples_t *s) {
+  if (s->count == 0)
+    return;
+  qsort(s->us, s->count, sizeof(*s->us), cmp_u32);
+  static const double k_pct[] = {50, 90, 99, 99.9};
+  printf("  %-14s %8zu", name, s->count);
+  for (size_t i = 0; i < sizeof(k_pct) / sizeof(k_pct[0]); i++) {
+    size_t idx = (size_t)(k_pct[i] / 100.0 * (double)(s->count - 1));
+    printf(" %9.1f", s->us[idx] / 1000.0);
+  }
+  printf(" %9.1f\n", s->us[s->count - 1] / 1000.0);
+}
+
+// Commands, as the applets issue them
+
+static void make_oath(uint32_t n, storage_oath_entry_t *e) {
+  memset(e, 0, sizeof(*e));
+  e->name_len = (uint8_t)snprintf((char *)e->name, sizeof(e->name),
+                                  "issuer%lu:user@example.com",
+                                  (unsigned long)n);
+  e->key_len = 20;
+  hsm_get_random(e->key, e->key_len);
+  e->prop = 0x21;
+  e->type = (n % 4 == 0) ? 2 : 1; // A quarter are HOTP
+  e->digits = 6;
+}
+
+static void make_fido2(uint32_t n, storage_fido2_entry_t *e) {
+  memset(e, 0, sizeof(*e));
+  hsm_get_random(e->rp_id_hash, sizeof(e->rp_id_hash));
+  e->user_id_len = 16 + n % 48;
+  hsm_get_random(e->user_id, e->user_id_len);
+  e->cred_id_len = 48;
+  hsm_get_random(e->cred_id, e->cred_id_len);
+  hsm_get_random(e->priv_key, sizeof(e->priv_key));
+  e->flags = 1;
+}
+
+static int pick_slot(bool fido2) {
+  uint32_t count = fido2 ? STORAGE_FIDO2_MAX_CREDS : STORAGE_OATH_MAX_ACCOUNTS;
+  uint32_t start = rng_next() % count;
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t slot = (uint8_t)((start + i) % count);
+    if (fido2 ? storage_view_fido2_cred(slot) != NULL
+              : storage_view_oath_account(slot) != NULL)
+      return slot;
+  }
+  return -1;
+}
+
+static void model_set(model_entry_t *m, const uint8_t *id, uint8_t id_len,
+                      uint32_t counter) {
+  m->present = true;
+  m->id_len = id_len;
+  memcpy(m->id, id, id_len);
+  m->counter = counter;
+}
+
+static void mismatch(const char *what, unsigned slot) {
+  fprintf(stderr, "model mismatch: %s (slot %u)\n", what, slot);
+  g_mismatches++;
+}
+
+// Everything acknowledged must be back after a reboot. Only the PIN retry
+// reset is written back lazily, so a power cut may leave fewer retries.
+static void verify_model(bool power_cut) {
+  for (unsigned i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
+    const model_entry_t *m = &g_model_oath[i];
+    const storage_oath_entry_t *e = storage_view_oath_account((uint8_t)i);
+    if (!m->present != !e)
+      mismatch(m->present ? "OATH account lost" : "OATH account revived", i);
+    else if (e && (e->name_len != m->id_len ||
+                   memcmp(e->name, m->id, m->id_len) != 0))
+      mismatch("OATH account name", i);
+    else if (e && e->counter != m->counter)
+      mismatch("HOTP counter", i);
+  }
+  for (unsigned i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
+    const model_entry_t *m = &g_model_fido2[i];
+    const storage_fido2_entry_t *e = storage_view_fido2_cred((uint8_t)i);
+    if (!m->present != !e)
+      mismatch(m->present ? "credential lost" : "credential revived", i);
+    else if (e && (e->cred_id_len != m->id_len ||
+                   memcmp(e->cred_id, m->id, m->id_len) != 0))
+      mismatch("credential ID", i);
+    else if (e && e->sign_count != m->counter)
+      mismatch("sign count", i);
+  }
+  storage_system_t pin;
+  if (!storage_load_pin_data(&pin) ||
+      pin.retries_remaining > g_model_retries ||
+      (!power_cut && pin.retries_remaining != g_model_retries))
+    mismatch("PIN retry counter", 0);
+  g_model_retries = pin.retries_remaining;
+}
+
+// Reset the device, after a clean shutdown (the main loop flushed) or a
+// power cut (the write-back is lost), and check what it boots with
+static void reboot(void) {
+  bool power_cut = rng_next() & 1;
+  if (power_cut)
+    g_power_cuts++;
+  else
+    storage_flush();
+  storage_deinit();
+  storage_init();
+  storage_set_writeback_window(STORAGE_WRITEBACK_WINDOW_MS);
+  verify_model(power_cut);
+}
+
+// Charge a PIN attempt as hsm_verify_pin_secure() does: the decrement is
+// flushed before the comparison, a correct PIN's reset is written back
+static bool verify_pin(bool correct) {
+  storage_system_t pin;
+  if (!storage_load_pin_data(&pin) || pin.retries_remaining == 0)
+    return false;
+  pin.retries_remaining--;
+  if (!storage_save_pin_data(&pin) || !storage_flush())
+    return false;
+  g_model_retries = pin.retries_remaining;
+  if (!correct)
+    return false;
+  pin.retries_remaining = HSM_PIN_MAX_RETRIES;
+  if (storage_save_pin_data(&pin))
+    g_model_retries = pin.retries_remaining;
+  return true;
+}
+
+static uint32_t g_next_name = 0;
+
+static void run_command(event_kind_t kind) {
+  switch (kind) {
+  case EV_ASSERTION: {
+    // PIN verification, GetAssertion bumps the sign counter, CTAP2 flushes
+    // before answering
+    if (!verify_pin(true))
+      break;
+    uint32_t count;
+    int slot = pick_slot(true);
+    if (slot >= 0 && storage_increment_fido2_sign_count((uint8_t)slot, &count))
+      g_model_fido2[slot].counter = count;
+    storage_flush();
+    break;
+  }
+  case EV_PIN_FAILURE:
+    verify_pin(false);
+    break;
+  case EV_HOTP: {
+    storage_iter_t it = STORAGE_ITER_INIT;
+    const storage_oath_entry_t *e;
+    uint32_t counter;
+    uint8_t slot;
+    while ((e = storage_next_oath_account(&it, &slot)) != NULL) {
+      if (e->type == 2) {
+        if (storage_increment_oath_counter(slot, &counter))
+          g_model_oath[slot].counter = counter;
+        break;
+      }
+    }
+    break;
+  }
+  case EV_OATH_LIST: {
+    storage_iter_t it = STORAGE_ITER_INIT;
+    storage_oath_entry_t copy;
+    uint8_t slot;
+    while (storage_next_oath_account(&it, &slot) != NULL)
+      storage_load_oath_account(slot, &copy); // TOTP over every key
+    break;
+  }
+  case EV_REGISTRATION: {
+    storage_fido2_entry_t e;
+    int slot = storage_find_free_fido2_slot();
+    if (slot < 0)
+      break;
+    make_fido2(g_next_name++, &e);
+    if (storage_txn_begin() && storage_save_fido2_cred((uint8_t)slot, &e)) {
+      if (storage_txn_commit() && storage_flush())
+        model_set(&g_model_fido2[slot], e.cred_id, e.cred_id_len, 0);
+    } else {
+      storage_txn_abort();
+    }
+    break;
+  }
+  case EV_OATH_ADD: {
+    storage_oath_entry_t e;
+    int slot = storage_find_free_oath_slot();
+    if (slot < 0)
+      break;
+    make_oath(g_next_name++, &e);
+    if (storage_txn_begin() && storage_save_oath_account((uint8_t)slot, &e)) {
+      if (storage_txn_commit())
+        model_set(&g_model_oath[slot], e.name, e.name_len, e.counter);
+    } else {
+      storage_txn_abort();
+    }
+    break;
+  }
+  case EV_OATH_DELETE: {
+    // The applet flushes before acknowledging a deletion
+    int slot = pick_slot(false);
+    if (slot >= 0 && storage_delete_oath_account((uint8_t)slot) &&
+        storage_flush())
+      g_model_oath[slot].present = false;
+    break;
+  }
+  case EV_REBOOT:
+    reboot();
+    break;
+  default:
+    break;
+  }
+}
+
+// Flash busy time of one storage call sequence
+static uint64_t busy_now(void) {
+  flash_sim_stats_t s;
+  flash_sim_get_stats(&s);
+  return s.busy_us;
+}
+
+static void idle_until(uint64_t until_ms) {
+  uint64_t quiet = flash_sim_now_us() / 1000 + IDLE_QUIET_MS;
+  if (quiet < until_ms)
+    flash_sim_advance_us((quiet - flash_sim_now_us() / 1000) * 1000);
+  for (int t = 0; t < IDLE_TICKS_MAX &&
+                  flash_sim_now_us() / 1000 + IDLE_TICK_MS < until_ms;
+       t++) {
+    uint64_t b0 = busy_now();
+    storage_task();
+    uint64_t spent = busy_now() - b0;
+    if (spent)
+      sample_add(&g_task_us, spent);
+    flash_sim_advance_us(IDLE_TICK_MS * 1000);
+  }
+  if (flash_sim_now_us() / 1000 < until_ms)
+    flash_sim_advance_us((until_ms - flash_sim_now_us() / 1000) * 1000);
+}
+
+static int cmp_event(const void *a, const void *b) {
+  const event_t *x = a, *y = b;
+  return (x->at_ms > y->at_ms) - (x->at_ms < y->at_ms);
+}
+
+static size_t add_events(event_t *ev, size_t n, event_kind_t kind,
+                         uint32_t count, uint64_t day_start_ms) {
+  for (uint32_t i = 0; i < count; i++) {
+    ev[n].kind = kind;
+    ev[n].at_ms = day_start_ms +
+                  rng_next() % (ACTIVE_HOURS * 3600u * 1000u);
+    n++;
+  }
+  return n;
+}
+
+// 0 or 1 event today, for something done `per_period` times a period
+static uint32_t daily(uint32_t per_period, uint32_t period_days) {
+  return (rng_next() % period_days) < per_period ? 1 : 0;
+}
+
+// `erases` holds the erases of each modelled sector during the run
+static void region_report(const char *name, uint32_t offset, uint32_t size,
+                          const uint32_t *erases, uint32_t days) {
+  uint32_t base, count = flash_sim_sector_count(&base);
+  uint64_t total = 0;
+  uint32_t worst = 0;
+  for (uint32_t s = 0; s < count; s++) {
+    uint32_t at = base + s * FLASH_SECTOR_SIZE;
+    if (at < offset || at >= offset + size)
+      continue;
+    uint32_t e = erases[s];
+    total += e;
+    if (e > worst)
+      worst = e;
+  }
+  double per_day = (double)worst / days;
+  printf("  %-10s %4lu sectors %9llu erases  worst %7lu (%6.2f/day)",
+         name, (unsigned long)(size / FLASH_SECTOR_SIZE),
+         (unsigned long long)total, (unsigned long)worst, per_day);
+  if (per_day > 0)
+    printf("  -> %.0f years\n",
+           FLASH_SIM_ENDURANCE_CYCLES / per_day / 365.0);
+  else
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+  uint32_t days = 365;
+  flash_sim_timing_t timing = FLASH_SIM_TIMING_TYPICAL;
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--worst") == 0) {
+      flash_sim_timing_t worst = FLASH_SIM_TIMING_WORST;
+      timing = worst;
+    } else if (positional++ == 0) {
+      days = (uint32_t)strtoul(argv[i], NULL, 0);
+    } else {
+      // Spread nearby seeds apart; 0 would stall xorshift
+      g_rng = (uint32_t)strtoul(argv[i], NULL, 0) * 2654435761u ^ 0x9E3779B9u;
+      if (g_rng == 0)
+        g_rng = 1;
+    }
+  }
+  if (days == 0)
+    days = 1;
+
+  flash_sim_init(&timing);
+  storage_init();
+  storage_set_writeback_window(STORAGE_WRITEBACK_WINDOW_MS);
+
+  // Enrolment, not counted
+  for (uint32_t i = 0; i < INITIAL_OATH; i++) {
+    storage_oath_entry_t e;
+    make_oath(g_next_name++, &e);
+    storage_save_oath_account((uint8_t)i, &e);
+    model_set(&g_model_oath[i], e.name, e.name_len, e.counter);
+  }
+  for (uint32_t i = 0; i < INITIAL_FIDO2; i++) {
+    storage_fido2_entry_t e;
+    make_fido2(g_next_name++, &e);
+    storage_save_fido2_cred((uint8_t)i, &e);
+    model_set(&g_model_fido2[i], e.cred_id, e.cred_id_len, 0);
+  }
+  storage_flush();
+  storage_commit();
+  flash_sim_reset_stats();
+  uint32_t base, sectors = flash_sim_sector_count(&base);
+  uint32_t *erases = calloc(sectors, sizeof(uint32_t));
+  if (!erases)
+    return 1;
+  for (uint32_t s = 0; s < sectors; s++)
+    erases[s] = flash_sim_sector_erases(s);
+
+  enum { MAX_EVENTS_PER_DAY = 64 };
+  event_t ev[MAX_EVENTS_PER_DAY];
+  for (uint32_t day = 0; day < days; day++) {
+    uint64_t day_start = (uint64_t)day * 24 * 3600 * 1000 + 8 * 3600 * 1000;
+    if (flash_sim_now_us() / 1000 < day_start)
+      flash_sim_advance_us(day_start * 1000 - flash_sim_now_us());
+
+    size_t n = 0;
+    n = add_events(ev, n, EV_ASSERTION, ASSERTIONS_PER_DAY, day_start);
+    n = add_events(ev, n, EV_PIN_FAILURE, PIN_FAILURES_PER_DAY, day_start);
+    n = add_events(ev, n, EV_HOTP, HOTP_PER_DAY, day_start);
+    n = add_events(ev, n, EV_OATH_LIST, OATH_LISTS_PER_DAY, day_start);
+    n = add_events(ev, n, EV_REGISTRATION, daily(REGISTRATIONS_PER_WEEK, 7),
+                   day_start);
+    n = add_events(ev, n, EV_OATH_ADD, daily(OATH_ADDS_PER_MONTH, 30),
+                   day_start);
+    n = add_events(ev, n, EV_OATH_DELETE, daily(OATH_DELETES_PER_MONTH, 30),
+                   day_start);
+    n = add_events(ev, n, EV_REBOOT, daily(REBOOTS_PER_WEEK, 7), day_start);
+    qsort(ev, n, sizeof(ev[0]), cmp_event);
+
+    for (size_t i = 0; i < n; i++) {
+      idle_until(ev[i].at_ms);
+      uint64_t b0 = busy_now();
+      run_command(ev[i].kind);
+      sample_add(&g_command_us[ev[i].kind], busy_now() - b0);
+    }
+    // Evening: the last write-back, then the host suspends the bus
+    idle_until(flash_sim_now_us() / 1000 + 5000);
+    storage_flush();
+  }
+
+  flash_sim_stats_t st;
+  flash_sim_get_stats(&st);
+  printf("Simulated %lu days (%s flash timings), %lu errors\n",
+         (unsigned long)days,
+         timing.sector_erase_us == 45000 ? "typical" : "worst-case",
+         (unsigned long)g_errors);
+  printf("  %zu reboots (%lu power cuts), %lu model mismatches\n",
+         g_command_us[EV_REBOOT].count, (unsigned long)g_power_cuts,
+         (unsigned long)g_mismatches);
+  printf("  %llu erases, %llu page programs, %llu bytes programmed "
+         "(%.1f KB/day)\n",
+         (unsigned long long)st.erases, (unsigned long long)st.page_programs,
+         (unsigned long long)st.bytes_programmed,
+         st.bytes_programmed / 1024.0 / days);
+
+  printf("\nFlash busy time per call (ms)\n");
+  printf("  %-14s %8s %9s %9s %9s %9s %9s\n", "call", "count", "p50", "p90",
+         "p99", "p99.9", "max");
+  for (int k = 0; k < EV_KIND_COUNT; k++)
+    print_percentiles(k_event_names[k], &g_command_us[k]);
+  print_percentiles("storage_task", &g_task_us);
+
+  // Lifetime from the erases of the simulated days only
+  for (uint32_t s = 0; s < sectors; s++)
+    erases[s] = flash_sim_sector_erases(s) - erases[s];
+  printf("\nErases per region (endurance %u cycles)\n",
+         FLASH_SIM_ENDURANCE_CYCLES);
+  region_report("counters", STORAGE_COUNTER_OFFSET, STORAGE_COUNTER_SIZE_BYTES,
+                erases, days);
+  region_report("groups", STORAGE_GROUPS_OFFSET, STORAGE_GROUPS_SIZE_BYTES,
+                erases, days);
+  region_report("log", STORAGE_OFFSET, STORAGE_SIZE_BYTES, erases, days);
+  region_report("legacy", STORAGE_LEGACY_OFFSET, STORAGE_LEGACY_SIZE_BYTES,
+                erases, days);
+  free(erases);
+  return g_errors || g_mismatches ? 1 : 0;
+}
@@ -52,6 +52,8 @@ typedef enum { APPLET_NONE = 0, APPLET_OATH, APPLET_OPENPGP } ccid_applet_t;
 void ccid_engine_init(void);
 void opentoken_process_ccid_apdu(uint8_t const *buffer, uint16_t len,
                                  uint8_t *out_buffer, uint16_t *out_len);
+// Milliseconds since the last APDU was received
+uint32_t ccid_engine_idle_ms(void);
 
 // APDU Processing Functions
 bool ccid_parse_apdu(const uint8_t *buffer, uint16_t len, apdu_command_t *cmd);
@@ -73,6 +73,7 @@ typedef struct {
     uint8_t current_command;
     bool user_presence_required;
     bool user_verification_required;
+    uint32_t last_message_ms; // Arrival of the last CTAPHID message
 } ctap2_context_t;
 
 // CTAP2 Credential Structure
@@ -93,6 +94,9 @@ void opentoken_process_ctap2_command(uint8_t *buffer, uint16_t len);
 // CTAP2 Engine initialization
 void ctap2_engine_init(void);
 
+// Milliseconds since the last CTAPHID message, 0 while one is being handled
+uint32_t ctap2_engine_idle_ms(void);
+
 // CTAP2 Command handlers
 uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data, uint16_t cbor_len, 
                                    uint8_t *response, uint16_t *response_len);
@@ -0,0 +1,24 @@
+#ifndef CYCLE_COUNT_H
+#define CYCLE_COUNT_H
+
+#include <stdint.h>
+
+// Cortex-M33 DWT cycle counter for on-device measurements.
+// Build with -DOPENTOKEN_CYCLE_BENCH to enable the counter and the "Bench:"
+// log lines; otherwise these compile to nothing.
+#ifdef OPENTOKEN_CYCLE_BENCH
+#include "hardware/structs/m33.h"
+
+static inline void cycle_count_enable(void) {
+  m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+  m33_hw->dwt_cyccnt = 0;
+  m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+
+static inline uint32_t cycle_count_now(void) { return m33_hw->dwt_cyccnt; }
+#else
+static inline void cycle_count_enable(void) {}
+static inline uint32_t cycle_count_now(void) { return 0; }
+#endif
+
+#endif // CYCLE_COUNT_H
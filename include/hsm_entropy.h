@@ -0,0 +1,51 @@
+#ifndef HSM_ENTROPY_H
+#define HSM_ENTROPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Entropy source for the HSM DRBG. On the RP2350 it reads the TRNG (ring
+// oscillator, von Neumann debiased, with the block's own CRNGT/autocorrelation
+// checks enabled). Builds without the TRNG (other chips, host tools) fall
+// back to the SDK's get_rand_64().
+//
+// Every byte goes through the SP 800-90B continuous health tests, assuming
+// HSM_ENTROPY_BITS_PER_BYTE of min-entropy per byte:
+// - repetition count: HSM_ENTROPY_RCT_CUTOFF identical bytes in a row fail
+// - adaptive proportion: the first byte of each HSM_ENTROPY_APT_WINDOW byte
+//   window seen HSM_ENTROPY_APT_CUTOFF times in that window fails
+// (cutoffs for a false positive rate of 2^-20). hsm_entropy_init() runs
+// them over HSM_ENTROPY_STARTUP_BYTES before any output is used. A poll
+// that fails a test or a hardware check returns an error and the source
+// is restarted; its bytes are never used.
+
+#define HSM_ENTROPY_BITS_PER_BYTE 4
+#define HSM_ENTROPY_RCT_CUTOFF 6   // 1 + ceil(20 / H)
+#define HSM_ENTROPY_APT_WINDOW 512
+#define HSM_ENTROPY_APT_CUTOFF 63  // Binomial(511, 2^-H), alpha 2^-20
+#define HSM_ENTROPY_STARTUP_BYTES 1024
+
+// Bytes mbedtls must collect from this source per seed/reseed: 256 bits at
+// the assumed rate
+#define HSM_ENTROPY_THRESHOLD (256 / HSM_ENTROPY_BITS_PER_BYTE)
+
+// Start the source and run the startup tests
+bool hsm_entropy_init(void);
+
+// mbedtls_entropy_f_source_ptr: register with mbedtls_entropy_add_source()
+// as a strong source with HSM_ENTROPY_THRESHOLD
+int hsm_entropy_poll(void *data, unsigned char *output, size_t len,
+                     size_t *olen);
+
+typedef struct {
+  uint64_t bytes;          // Delivered since boot
+  uint32_t rct_failures;   // Repetition count test
+  uint32_t apt_failures;   // Adaptive proportion test
+  uint32_t hw_failures;    // TRNG checks / timeouts
+  bool hardware;           // TRNG (false: software fallback)
+} hsm_entropy_stats_t;
+
+void hsm_entropy_get_stats(hsm_entropy_stats_t *out);
+
+#endif // HSM_ENTROPY_H
@@ -2,6 +2,7 @@
 #define HSM_LAYER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Maximum number of PIN retry attempts before lockout
@@ -42,9 +43,23 @@ typedef struct {
 // Initialize HSM layer
 void hsm_init(void);
 
-// Get cryptographically secure random bytes
+// Get cryptographically secure random bytes (from the pre-filled pool when
+// it has enough)
 bool hsm_get_random(uint8_t *out, size_t len);
 
+// Main-loop maintenance: refill the random and keypair pools and reseed the
+// DRBG when due, all subject to the maintenance policy
+void hsm_task(void);
+
+// Asked by hsm_task() before background work; returning false postpones it
+// to a later call. NULL (the default) always allows it.
+typedef bool (*hsm_maintenance_policy_t)(void);
+void hsm_set_maintenance_policy(hsm_maintenance_policy_t may_run);
+
+// Zeroize the cached key-wrap context and the keypair pool (device reset);
+// rebuilt on next use
+void hsm_drop_key_contexts(void);
+
 // Operações de Chave (FIDO2/OpenPGP)
 // Generate ECC P-256 keypair and store in secure slot
 bool hsm_generate_key_ecc(hsm_key_slot_t slot, hsm_pubkey_t *pubkey_out);
@@ -57,6 +72,29 @@ bool hsm_sign_ecc_slot(hsm_key_slot_t slot, const uint8_t *hash_in,
                        uint16_t hash_len, uint8_t *signature_out,
                        uint16_t *signature_len);
 
+// Keypair pool: P-256 keypairs generated ahead of time by hsm_task() so
+// that a new credential does not wait for a keygen. Private keys are held
+// wrapped with the device key. Depth 0 disables the pool.
+#ifndef HSM_KEYPOOL_DEPTH
+#define HSM_KEYPOOL_DEPTH 4
+#endif
+#ifndef HSM_KEYPOOL_REFILL_MS
+#define HSM_KEYPOOL_REFILL_MS 100 // hsm_task() generates at most one per
+#endif
+
+typedef struct {
+  uint8_t depth;     // HSM_KEYPOOL_DEPTH
+  uint8_t available; // Keypairs ready now
+  uint32_t hits;     // hsm_take_keypair() served from the pool
+  uint32_t misses;   // hsm_take_keypair() generated on the spot
+  uint32_t refills;  // Keypairs generated by hsm_task()
+} hsm_keypool_stats_t;
+
+// Keypair for a new credential: from the pool when it has one, generated
+// on the spot otherwise
+bool hsm_take_keypair(hsm_keypair_t *keypair_out);
+void hsm_get_keypool_stats(hsm_keypool_stats_t *out);
+
 // Legacy functions for backward compatibility - DEPRECATED
 bool hsm_generate_key_ecc_legacy(hsm_keypair_t *keypair_out);
 bool hsm_sign_ecc(const uint8_t *priv_key, const uint8_t *hash_in,
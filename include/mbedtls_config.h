@@ -34,8 +34,18 @@
 #define MBEDTLS_HKDF_C
 
 // Prerequisites for Entropy and DRBG
+// The only strong source is hsm_entropy_poll(), added by the HSM layer; no
+// MBEDTLS_ENTROPY_HARDWARE_ALT, whose poll comes with the SDK's
+// pico_mbedtls.c (not linked, see CMakeLists.txt)
 #define MBEDTLS_NO_PLATFORM_ENTROPY
-#define MBEDTLS_ENTROPY_HARDWARE_ALT
+
+// SHA-256 on the RP2350 SHA-256 block (src/secure/sha256_alt.c). Other
+// targets and host builds keep mbedtls' software SHA-256. include/ comes
+// before the SDK's system include dirs, so mbedtls/sha256.h picks up
+// include/sha256_alt.h rather than pico_mbedtls' header of the same name.
+#if defined(PICO_RP2350) && PICO_RP2350
+#define MBEDTLS_SHA256_ALT
+#endif
 
 // Curves
 #define MBEDTLS_ECP_DP_SECP256R1_ENABLED
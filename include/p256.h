@@ -0,0 +1,36 @@
+#ifndef P256_H
+#define P256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Constant-time P-256 (secp256r1) key generation and ECDSA signing, used by
+// the HSM layer in OPENTOKEN_P256_FAST builds in place of mbedtls_ecp.
+//
+// Field and scalar arithmetic are 8x32-bit Montgomery multiplication and
+// squaring. On Armv8-M Mainline with the DSP extension (the RP2350's
+// Cortex-M33) the inner products are UMAAL; elsewhere the same code runs on
+// portable 64-bit C. Points use the complete formulas of Renes, Costello
+// and Batina (2016), so no input takes a different path. k*G is a comb over
+// two const tables of 15 precomputed points in flash.
+//
+// Keys and signatures are big-endian byte strings; the signature is r || s.
+// f_rng has the mbedtls signature and supplies the scalars.
+
+typedef int (*p256_rng_t)(void *ctx, unsigned char *out, size_t len);
+
+// New keypair: priv in [1, n-1] and its public point
+bool p256_keygen(uint8_t priv[32], uint8_t pub_x[32], uint8_t pub_y[32],
+                 p256_rng_t f_rng, void *p_rng);
+
+// Public point of priv (false if priv is not in [1, n-1])
+bool p256_public_key(const uint8_t priv[32], uint8_t pub_x[32],
+                     uint8_t pub_y[32]);
+
+// ECDSA signature over hash (its leftmost 256 bits, as in SEC 1)
+bool p256_ecdsa_sign(const uint8_t priv[32], const uint8_t *hash,
+                     size_t hash_len, uint8_t sig[64], p256_rng_t f_rng,
+                     void *p_rng);
+
+#endif // P256_H
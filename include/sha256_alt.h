@@ -0,0 +1,28 @@
+#ifndef SHA256_ALT_H
+#define SHA256_ALT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// MBEDTLS_SHA256_ALT context for src/secure/sha256_alt.c (RP2350 SHA-256
+// block). Included by mbedtls/sha256.h; host builds never define
+// MBEDTLS_SHA256_ALT and keep mbedtls' software SHA-256.
+//
+// The layout follows mbedtls' own context so the software path can take
+// over a hash at any point: state[] is the chaining value whenever the
+// context is not running in hardware.
+typedef struct mbedtls_sha256_context {
+  uint32_t total[2];      // Bytes hashed (low, high)
+  uint32_t state[8];      // Chaining value (stale while hw is set)
+  uint8_t buffer[64];     // Partial block
+  int is224;
+  bool hw;                // Blocks go to the SHA-256 block
+} mbedtls_sha256_context;
+
+#ifdef OPENTOKEN_CYCLE_BENCH
+// Print cycles per byte of mbedtls_sha256() for 64 B, 1 KB and 32 KB
+// inputs, hardware vs the software path ("Bench:" lines)
+void sha256_alt_bench(void);
+#endif
+
+#endif // SHA256_ALT_H
@@ -6,14 +6,29 @@
 
 // Initialize storage (load cache if needed)
 void storage_init(void);
+// Drop all RAM state as a reset would, pending changes included; the next
+// storage_init() loads from flash again (host simulators reboot with it)
+void storage_deinit(void);
 
 // Storage Constants
-#define STORAGE_SIZE_BYTES (32 * 1024) // 32KB Encrypted Storage
+// The change log is a ring of equal segments, one active at a time. Both
+// sizes can be overridden at build time; the entry group area is sized in
+// storage_flash.h.
+#ifndef STORAGE_SIZE_BYTES
+#define STORAGE_SIZE_BYTES (128 * 1024) // 128KB change log ring
+#endif
+#ifndef STORAGE_SEGMENT_SIZE_BYTES
+#define STORAGE_SEGMENT_SIZE_BYTES (16 * 1024) // 8 segments, one active
+#endif
 #define STORAGE_MAGIC 0x53454352       // "SECR"
-#define STORAGE_VERSION 2
+#define STORAGE_VERSION 8
+
+// Slot limits. Entries are stored with variable-length records, so the
+// number that actually fits depends on their name/key/ID lengths; a save
+// fails with ERROR_STORAGE_FULL once the flash groups of its kind are full.
 
 // OATH Storage
-#define STORAGE_OATH_MAX_ACCOUNTS 50
+#define STORAGE_OATH_MAX_ACCOUNTS 128
 
 typedef struct {
   uint8_t name[64];
@@ -25,15 +40,22 @@ typedef struct {
   uint8_t digits;   // 6 or 8
   uint8_t active;   // 1 if active
   uint32_t counter; // For HOTP
+  uint16_t counter_handle; // Monotonic counter backing `counter` (storage owned)
 } storage_oath_entry_t;
 
 bool storage_load_oath_account(uint8_t index, storage_oath_entry_t *out_entry);
 bool storage_save_oath_account(uint8_t index,
                                const storage_oath_entry_t *entry);
 bool storage_delete_oath_account(uint8_t index);
+// Persist counter + 1 without rewriting the entry (HOTP)
+bool storage_increment_oath_counter(uint8_t index, uint32_t *value_out);
+// Lookups from the RAM name index / free-slot bitmap (no entry copy).
+// Return the slot, or -1 if there is none.
+int storage_find_oath_account(const uint8_t *name, uint8_t name_len);
+int storage_find_free_oath_slot(void);
 
 // FIDO2 / WebAuthn Storage (Resident Keys)
-#define STORAGE_FIDO2_MAX_CREDS 50
+#define STORAGE_FIDO2_MAX_CREDS 128
 
 typedef struct {
   uint8_t rp_id_hash[32];
@@ -45,11 +67,16 @@ typedef struct {
   uint32_t sign_count;
   uint8_t active;
   uint8_t flags;
+  uint16_t counter_handle; // Monotonic counter backing sign_count
 } storage_fido2_entry_t;
 
 bool storage_load_fido2_cred(uint8_t index, storage_fido2_entry_t *out_entry);
 bool storage_save_fido2_cred(uint8_t index, const storage_fido2_entry_t *entry);
 bool storage_delete_fido2_cred(uint8_t index);
+// Persist sign_count + 1 without rewriting the entry
+bool storage_increment_fido2_sign_count(uint8_t index, uint32_t *value_out);
+// First free credential slot (no entry decrypted), or -1 if all are in use
+int storage_find_free_fido2_slot(void);
 bool storage_find_fido2_cred_by_rp(const uint8_t *rp_id_hash,
                                    storage_fido2_entry_t *out_entry,
                                    uint8_t *index_out);
@@ -85,8 +112,161 @@ typedef struct {
 bool storage_load_pin_data(storage_system_t *out_data);
 bool storage_save_pin_data(const storage_system_t *data);
 
+// Decrypted entry cache
+// Only a fixed number of OATH accounts and FIDO2 credentials are kept
+// decrypted in RAM. A compact per-slot table (lookup key, size, counter
+// handle, flash location) stays resident; other entries are decrypted from
+// flash on demand into a cache line, evicting the least recently used one
+// (CLOCK). Entries with unflushed changes are never evicted.
+#ifndef STORAGE_OATH_CACHE_LINES
+#define STORAGE_OATH_CACHE_LINES 16
+#endif
+#ifndef STORAGE_FIDO2_CACHE_LINES
+#define STORAGE_FIDO2_CACHE_LINES 16
+#endif
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;    // Entry decrypted from flash
+  uint32_t evictions; // Entries displaced to make room (misses and saves)
+  uint8_t lines;      // Pool size
+  uint8_t resident;   // Lines holding an entry
+} storage_cache_stats_t;
+
+// Counters since boot or the last reset, to size the pools for a workload
+void storage_get_cache_stats(storage_cache_stats_t *oath_out,
+                             storage_cache_stats_t *fido2_out);
+void storage_reset_cache_stats(void);
+
+// Read-only views
+// Const pointers into the decrypted RAM cache, for read paths that should
+// not copy entries (or their secrets) onto the stack. The line a view points
+// to stays put until the next call that loads, views, finds, saves or
+// deletes another entry of the same kind, that slot is saved or deleted, or
+// storage is reset; do not keep it across those calls and never write
+// through it. NULL if the slot is not active.
+const storage_oath_entry_t *storage_view_oath_account(uint8_t index);
+const storage_fido2_entry_t *storage_view_fido2_cred(uint8_t index);
+
+// Iterate active entries in slot order:
+//   storage_iter_t it = STORAGE_ITER_INIT;
+//   while ((e = storage_next_oath_account(&it, &slot)) != NULL) ...
+typedef struct {
+  uint16_t next; // Next slot to examine
+} storage_iter_t;
+
+#define STORAGE_ITER_INIT {0}
+
+const storage_oath_entry_t *storage_next_oath_account(storage_iter_t *it,
+                                                      uint8_t *index_out);
+const storage_fido2_entry_t *storage_next_fido2_cred(storage_iter_t *it,
+                                                     uint8_t *index_out);
+uint8_t storage_count_oath_accounts(void);
+uint8_t storage_count_fido2_creds(void);
+
 // IO
+// Setters only update the RAM cache and mark the entry pending (write-back).
+// Pending entries reach flash as one batch of sealed records appended to the
+// active log segment, either when storage_flush() is called at a durability
+// point or from storage_task() once the oldest pending change is older than
+// the write-back window. A window of 0 makes every setter write through.
+// storage_commit() checkpoints: it reseals only the entry groups changed
+// since the last checkpoint and starts the next log segment. It runs when the
+// log is full and after bulk changes (format/reset).
+#ifndef STORAGE_WRITEBACK_WINDOW_MS
+#define STORAGE_WRITEBACK_WINDOW_MS 1000
+#endif
+
+bool storage_flush(void);
+void storage_task(void); // Call from the main loop
+void storage_set_writeback_window(uint32_t window_ms);
 void storage_commit(void);
 bool storage_reset_device(void);
 
+// Transactions
+// Group the changes of one command into a single durable commit. Between
+// storage_txn_begin() and storage_txn_commit() setters only change the RAM
+// cache: nothing is flushed or checkpointed (storage_flush() returns false),
+// whatever the write-back window. The commit writes every change as one log
+// batch, which boot applies entirely or not at all. storage_txn_abort()
+// discards the changes instead and reloads the touched sections from flash;
+// monotonic counters advanced meanwhile stay advanced. Changed OATH/FIDO2
+// entries stay cached until the commit, so a transaction can save at most
+// STORAGE_*_CACHE_LINES entries of each kind (deletes are not limited).
+// Transactions do not nest; begin flushes earlier changes first.
+bool storage_txn_begin(void);
+bool storage_txn_commit(void);
+void storage_txn_abort(void);
+
+// Compaction
+// Superseded log records are only reclaimed by a checkpoint. So that a full
+// log rarely makes a command pay for one, storage_task() checkpoints in the
+// background once the active segment is STORAGE_COMPACT_THRESHOLD_PCT full,
+// one slice per call: each slice erases or reseals a single changed group
+// into its spare sector, and the last one programs the next segment header.
+// A group changed after its slice is resealed again.
+#ifndef STORAGE_COMPACT_THRESHOLD_PCT
+#define STORAGE_COMPACT_THRESHOLD_PCT 50
+#endif
+
+// Asked before each background slice (pre-erase or compaction); returning
+// false postpones the work to a later storage_task() call. NULL (the
+// default) always allows it. The write-back flush is not subject to it.
+typedef bool (*storage_maintenance_policy_t)(void);
+void storage_set_maintenance_policy(storage_maintenance_policy_t may_run);
+
+typedef struct {
+  uint32_t log_used;       // Bytes of the active log segment in use
+  uint32_t log_free;       // Bytes left before a checkpoint is forced
+  uint32_t log_superseded; // Of log_used, records replaced by a newer one
+  uint8_t groups_dirty;    // Groups the next checkpoint reseals
+  uint8_t groups_staged;   // Of those, already resealed by compaction
+  uint32_t slices;         // Compaction slices run since boot
+  uint32_t checkpoints;    // Checkpoints completed in the background
+  uint32_t forced;         // Checkpoints a flush had to run (log full)
+} storage_compaction_stats_t;
+
+void storage_get_compaction_stats(storage_compaction_stats_t *out);
+
+// Telemetry
+// Histograms since boot, log2 buckets: bucket 0 counts zeros, bucket i
+// values in [2^(i-1), 2^i), the last bucket everything larger.
+#define STORAGE_HIST_BUCKETS 24
+
+typedef struct {
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t buckets[STORAGE_HIST_BUCKETS];
+} storage_histogram_t;
+
+typedef enum {
+  STORAGE_HIST_FLUSH_US,         // storage_flush() log appends
+  STORAGE_HIST_CHECKPOINT_US,    // storage_commit() checkpoints
+  STORAGE_HIST_IRQ_OFF_US,       // Each sector erase / page program
+  STORAGE_HIST_ENCRYPTED_BYTES,  // Sealed by one flush or checkpoint
+  STORAGE_HIST_PROGRAMMED_BYTES, // Programmed by one flush or checkpoint
+  STORAGE_HIST_COUNT
+} storage_histogram_id_t;
+
+void storage_histogram_add(storage_histogram_t *hist, uint32_t value);
+const storage_histogram_t *storage_get_histogram(storage_histogram_id_t id);
+
+typedef struct {
+  uint64_t bytes_encrypted;  // Since boot, background work included
+  uint64_t bytes_programmed; // Since boot, counter area included
+  uint16_t sectors;          // Storage area sectors with an erase count
+  uint16_t worst_sector;     // Most erased of them
+  uint32_t worst_erases;
+  uint32_t total_erases;
+} storage_telemetry_t;
+
+void storage_get_telemetry(storage_telemetry_t *out);
+
+// Lifetime erases of a sector of the storage area (counter area up to the
+// end of flash, in address order). The counts travel in the checkpoint
+// manifests, so erases after the last few checkpoints before a power loss
+// are not counted.
+uint32_t storage_get_erase_count(uint32_t sector);
+
 #endif // STORAGE_H
@@ -0,0 +1,53 @@
+#ifndef STORAGE_COUNTER_H
+#define STORAGE_COUNTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Wear-leveled monotonic counters (FIDO2 sign_count, HOTP counters).
+// Increments clear one bit in flash (1->0 program, no erase); when a counter
+// runs out of bits the live values are rotated into the next sector, which
+// storage_counter_prepare() has normally erased beforehand.
+
+#define STORAGE_COUNTER_MAX_HANDLES 256
+#define STORAGE_COUNTER_NONE 0xFFFF
+
+typedef uint16_t storage_counter_handle_t;
+
+// Scan the counter area and select the active sector (formats on first boot)
+void storage_counter_init(void);
+
+// Erase the sector the next rotation writes to, unless it already is (idle
+// maintenance). Returns true if it erased.
+bool storage_counter_prepare(void);
+
+// Allocate a counter starting at initial_value
+bool storage_counter_alloc(uint32_t initial_value,
+                           storage_counter_handle_t *handle_out);
+
+// Mark a handle referenced by a stored entry as in use after boot.
+// Returns false if the counter area held no value for it at boot or the
+// handle was already claimed or reallocated since.
+// Until claimed, every handle that had a value at boot is kept across
+// rotations and never handed out, since its entry may not be decrypted yet.
+bool storage_counter_claim(storage_counter_handle_t handle);
+
+// Every entry has been loaded: values nobody claimed are orphans and are
+// dropped at the next rotation
+void storage_counter_release_unclaimed(void);
+
+// Release a handle; its slot is reclaimed at the next sector rotation
+void storage_counter_free(storage_counter_handle_t handle);
+
+// Release every handle (device reset)
+void storage_counter_free_all(void);
+
+bool storage_counter_read(storage_counter_handle_t handle, uint32_t *value_out);
+
+// Increment by one / move forward to new_value. Counters never go backwards.
+bool storage_counter_increment(storage_counter_handle_t handle,
+                               uint32_t *value_out);
+bool storage_counter_advance(storage_counter_handle_t handle,
+                             uint32_t new_value);
+
+#endif // STORAGE_COUNTER_H
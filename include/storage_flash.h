@@ -0,0 +1,69 @@
+#ifndef STORAGE_FLASH_H
+#define STORAGE_FLASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/flash.h"
+#include "storage.h"
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (16 * 1024 * 1024) // Default to 16MB for Tenstar
+#endif
+
+// Flash map (end of flash, growing down)
+// [ ... firmware ... ] [COUNTERS] [GROUPS] [LOG REGION] [LEGACY v2 IMAGE]
+// The v2 single-blob image lives in the last 32KB of flash. A freshly
+// formatted store imports it and then erases it (see storage_migrate.c).
+#define STORAGE_LEGACY_SIZE_BYTES (32 * 1024)
+#define STORAGE_LEGACY_OFFSET (PICO_FLASH_SIZE_BYTES - STORAGE_LEGACY_SIZE_BYTES)
+#define STORAGE_OFFSET (STORAGE_LEGACY_OFFSET - STORAGE_SIZE_BYTES)
+
+// Sealed entry groups, one A/B sector pair per group (see storage.c). Group
+// 0 holds the system entry and HSM keys; OATH and FIDO2 each own a pool. The
+// defaults hold every slot even with maximum-length names, keys and IDs.
+#ifndef STORAGE_OATH_GROUPS
+#define STORAGE_OATH_GROUPS 7
+#endif
+#ifndef STORAGE_FIDO2_GROUPS
+#define STORAGE_FIDO2_GROUPS 9
+#endif
+#define STORAGE_GROUP_COUNT (1 + STORAGE_OATH_GROUPS + STORAGE_FIDO2_GROUPS)
+#define STORAGE_GROUPS_SIZE_BYTES (STORAGE_GROUP_COUNT * 2 * FLASH_SECTOR_SIZE)
+#define STORAGE_GROUPS_OFFSET (STORAGE_OFFSET - STORAGE_GROUPS_SIZE_BYTES)
+
+// Monotonic counter area (see storage_counter.c)
+#define STORAGE_COUNTER_SECTORS 4
+#define STORAGE_COUNTER_SIZE_BYTES (STORAGE_COUNTER_SECTORS * FLASH_SECTOR_SIZE)
+#define STORAGE_COUNTER_OFFSET (STORAGE_GROUPS_OFFSET - STORAGE_COUNTER_SIZE_BYTES)
+
+// Everything above: the sectors with an erase count
+#define STORAGE_AREA_OFFSET STORAGE_COUNTER_OFFSET
+#define STORAGE_AREA_SECTORS                                                   \
+  ((PICO_FLASH_SIZE_BYTES - STORAGE_AREA_OFFSET) / FLASH_SECTOR_SIZE)
+
+#define STORAGE_PAGE_ALIGN(x)                                                  \
+  (((x) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1))
+
+// Memory-mapped (XIP) read access to a flash offset
+const uint8_t *storage_flash_ptr(uint32_t offset);
+
+// Erase/program with interrupts disabled one sector/page at a time. Offsets
+// and lengths must be sector (erase) or page (program) aligned.
+void storage_flash_erase(uint32_t offset, uint32_t len);
+void storage_flash_program(uint32_t offset, const uint8_t *data, uint32_t len);
+
+// True if every byte in [offset, offset + len) reads 0xFF
+bool storage_flash_is_erased(uint32_t offset, uint32_t len);
+
+// Telemetry kept by the erase/program calls above: erases of each storage
+// area sector (since boot, plus what storage.c restores from the manifests),
+// bytes programmed since boot and how long each erase/program held
+// interrupts off
+uint32_t storage_flash_erase_count(uint32_t sector);
+void storage_flash_add_erase_count(uint32_t sector, uint32_t erases);
+uint64_t storage_flash_bytes_programmed(void);
+const storage_histogram_t *storage_flash_irq_off_us(void);
+
+#endif // STORAGE_FLASH_H
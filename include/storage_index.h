@@ -0,0 +1,48 @@
+#ifndef STORAGE_INDEX_H
+#define STORAGE_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// RAM hash index from 32-bit keys to storage slots (FIDO2 by rp_id_hash,
+// OATH by account name). Open addressing with linear probing; every slot is
+// its own bucket entry, so all slots sharing a key sit in the same probe run.
+// Matches are candidates only: the caller confirms them against the full
+// digest or name. Removal shifts the run back (no tombstones), so lookups
+// stay O(1) after any number of save/delete cycles.
+// The bucket array is supplied by the caller (power of two, at least twice the
+// slot capacity to keep probe runs short).
+
+#define STORAGE_INDEX_EMPTY 0xFFFF
+
+typedef struct {
+  uint32_t key;
+  uint16_t slot; // STORAGE_INDEX_EMPTY if unused
+} storage_index_bucket_t;
+
+typedef struct {
+  storage_index_bucket_t *buckets;
+  uint32_t mask; // bucket count - 1
+  uint32_t count;
+} storage_index_t;
+
+void storage_index_init(storage_index_t *index,
+                        storage_index_bucket_t *buckets,
+                        uint32_t bucket_count);
+void storage_index_clear(storage_index_t *index);
+
+// Keys: first 4 bytes of a SHA-256 digest / FNV-1a hash of a name
+uint32_t storage_index_digest_key(const uint8_t *digest);
+uint32_t storage_index_name_key(const uint8_t *name, uint32_t len);
+
+// Add a slot under a key. Fails if the table is full.
+bool storage_index_insert(storage_index_t *index, uint32_t key, uint16_t slot);
+// Drop a slot filed under a key (no-op if not present)
+void storage_index_remove(storage_index_t *index, uint32_t key, uint16_t slot);
+
+// Candidate slots for a key, in ascending slot order. Returns the total
+// number of candidates; at most max_slots are written.
+uint32_t storage_index_find(const storage_index_t *index, uint32_t key,
+                            uint16_t *slots_out, uint32_t max_slots);
+
+#endif // STORAGE_INDEX_H
@@ -0,0 +1,64 @@
+#ifndef STORAGE_MIGRATE_H
+#define STORAGE_MIGRATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Import of storage images written by older firmware. Every layout that can
+// be imported has an entry in a table keyed on the STORAGE_VERSION that
+// wrote it (see storage_migrate.c). An import is streamed: one pass
+// authenticates the whole image, a second decrypts it again and converts it
+// entry by entry into the current structs, which storage.c saves through
+// its setters. Both passes work through the image in slices of a given
+// size, so RAM use does not depend on the image size and the main loop can
+// spread the work over many calls. The old image is only erased once every
+// entry is on flash in the new format, starting with the sector it needs to
+// authenticate.
+
+#define STORAGE_MIGRATE_NONE 0xFFFFFFFF // No layout / no import (version)
+
+typedef enum {
+  STORAGE_MIGRATE_ABSENT,  // No older image on flash
+  STORAGE_MIGRATE_PRESENT, // An older image that can be imported
+  STORAGE_MIGRATE_LEFTOVER // What an interrupted erase left of an image
+} storage_migrate_probe_t;
+
+typedef enum {
+  STORAGE_MIGRATE_ENTRY_SYSTEM, // storage_system_t
+  STORAGE_MIGRATE_ENTRY_OATH,   // storage_oath_entry_t
+  STORAGE_MIGRATE_ENTRY_FIDO2,  // storage_fido2_entry_t
+  STORAGE_MIGRATE_ENTRY_HSM_KEY // storage_hsm_key_t
+} storage_migrate_entry_t;
+
+// Receives each active entry of the image, in the current layout and with
+// the slot it had there (counter_handle fields are 0). Returning false stops
+// the import.
+typedef bool (*storage_migrate_sink_t)(storage_migrate_entry_t kind,
+                                       uint8_t slot, const void *entry);
+
+typedef enum {
+  STORAGE_MIGRATE_MORE,     // Call again
+  STORAGE_MIGRATE_DONE,     // Every entry went to the sink
+  STORAGE_MIGRATE_REJECTED, // Image does not authenticate / is not the layout
+  STORAGE_MIGRATE_STOPPED   // The sink refused an entry
+} storage_migrate_status_t;
+
+// Look for an older image without decrypting anything. *version_out is the
+// STORAGE_VERSION of the layout found.
+storage_migrate_probe_t storage_migrate_probe(uint32_t *version_out);
+
+// Start importing the image of `version`, sealed with the storage master key
+bool storage_migrate_begin(uint32_t version, const uint8_t key[32]);
+
+// Work through up to `budget` more bytes of the image
+storage_migrate_status_t storage_migrate_step(storage_migrate_sink_t sink,
+                                              uint32_t budget);
+
+// Wipe the stream state and key (after the last step, or to give up)
+void storage_migrate_end(void);
+
+// Erase one more sector of the image of `version`. Returns true once all of
+// it reads erased.
+bool storage_migrate_erase_step(uint32_t version);
+
+#endif // STORAGE_MIGRATE_H
@@ -7,12 +7,16 @@
 #include "error_handling.h"
 #include "oath_applet.h"
 #include "openpgp_applet.h"
+#include "pico/stdlib.h"
 #include <stdio.h>
 #include <string.h>
 
 // Global state for selected applet
 static ccid_applet_t current_applet = APPLET_NONE;
 
+// Arrival time of the last APDU (APDUs are handled synchronously)
+static uint32_t last_apdu_ms = 0;
+
 // Forward declarations for static wrapper functions
 static bool oath_applet_process_apdu_wrapper(void *context);
 static bool openpgp_applet_process_apdu_wrapper(void *context);
@@ -25,6 +29,10 @@ void ccid_engine_init(void) {
   printf("CCID Engine: Initialized - Protocol-independent APDU routing\n");
 }
 
+uint32_t ccid_engine_idle_ms(void) {
+  return to_ms_since_boot(get_absolute_time()) - last_apdu_ms;
+}
+
 //--------------------------------------------------------------------+
 // ISO7816 APDU PARSING
 //--------------------------------------------------------------------+
@@ -161,6 +169,8 @@ void opentoken_process_ccid_apdu(uint8_t const *buffer, uint16_t len,
   apdu_command_t cmd;
   apdu_response_t response;
 
+  last_apdu_ms = to_ms_since_boot(get_absolute_time());
+
   // Input validation with comprehensive error handling
   if (!buffer || !out_buffer || !out_len) {
     ERROR_REPORT_ERROR(ERROR_PROTOCOL_INVALID_COMMAND,
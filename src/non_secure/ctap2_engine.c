@@ -10,6 +10,7 @@
 #include "mbedtls/platform_util.h"
 #include "mbedtls/sha1.h"
 #include "mbedtls/sha256.h"
+#include "pico/stdlib.h"
 #include "storage.h"
 #include "tusb.h"
 #include <stdbool.h>
@@ -52,6 +53,13 @@ void ctap2_engine_init(void) {
   hsm_init(); // Ensure HSM is initialized
 }
 
+uint32_t ctap2_engine_idle_ms(void) {
+  if (g_ctap2_ctx.state == CTAP2_STATE_PROCESSING ||
+      g_ctap2_ctx.state == CTAP2_STATE_WAITING_USER_PRESENCE)
+    return 0;
+  return to_ms_since_boot(get_absolute_time()) - g_ctap2_ctx.last_message_ms;
+}
+
 // Helper to encode ECC Public Key as COSE Map
 static bool ctap_encode_cose_key(cbor_encoder_t *enc, const hsm_pubkey_t *pub) {
   if (!cbor_encode_map_start(enc, 5))
@@ -325,11 +333,9 @@ uint8_t ctap2_handle_get_info(uint8_t *response, uint16_t *response_len) {
   return CTAP2_OK;
 }
 
-// CTAP2 MakeCredential command handler
-uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data,
-                                     uint16_t cbor_len, uint8_t *response,
-                                     uint16_t *response_len) {
-  printf("CTAP2: Handling MakeCredential\n");
+// MakeCredential, run inside a storage transaction by the handler below
+static uint8_t make_credential(const uint8_t *cbor_data, uint16_t cbor_len,
+                               uint8_t *response, uint16_t *response_len) {
 
   cbor_decoder_t dec;
   cbor_decoder_init(&dec, cbor_data, cbor_len);
@@ -474,9 +480,9 @@ uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data,
     return CTAP2_ERR_PIN_REQUIRED;
   }
 
-  // Generate new key pair
+  // New key pair, pre-generated by hsm_task() when the pool has one
   hsm_keypair_t keypair;
-  if (!hsm_generate_key_ecc_legacy(&keypair)) {
+  if (!hsm_take_keypair(&keypair)) {
     return CTAP2_ERR_PROCESSING;
   }
 
@@ -501,17 +507,9 @@ uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data,
     cred.sign_count = 0;
     cred.active = 1;
 
-    // Find empty slot
-    bool stored = false;
-    for (uint8_t slot = 0; slot < STORAGE_FIDO2_MAX_CREDS; slot++) {
-      storage_fido2_entry_t existing;
-      if (!storage_load_fido2_cred(slot, &existing) || !existing.active) {
-        if (storage_save_fido2_cred(slot, &cred)) {
-          stored = true;
-          break;
-        }
-      }
-    }
+    // Find empty slot (from the resident slot table, nothing decrypted)
+    int slot = storage_find_free_fido2_slot();
+    bool stored = slot >= 0 && storage_save_fido2_cred((uint8_t)slot, &cred);
 
     if (!stored) {
       mbedtls_platform_zeroize(&cred, sizeof(cred));
@@ -573,6 +571,23 @@ uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data,
   return CTAP2_OK;
 }
 
+// CTAP2 MakeCredential command handler. A resident credential is only kept
+// if the whole command succeeds, and is on flash before the response.
+uint8_t ctap2_handle_make_credential(const uint8_t *cbor_data,
+                                     uint16_t cbor_len, uint8_t *response,
+                                     uint16_t *response_len) {
+  printf("CTAP2: Handling MakeCredential\n");
+
+  if (!storage_txn_begin())
+    return CTAP2_ERR_PROCESSING;
+  uint8_t status = make_credential(cbor_data, cbor_len, response, response_len);
+  if (status != CTAP2_OK) {
+    storage_txn_abort();
+    return status;
+  }
+  return storage_txn_commit() ? CTAP2_OK : CTAP2_ERR_PROCESSING;
+}
+
 // CTAP2 GetAssertion command handler
 uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
                                    uint8_t *response, uint16_t *response_len) {
@@ -669,11 +684,13 @@ uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
   // getNextAssertion. For now, we take the first one or the one matching
   // allowList. Since allowList parsing is omitted for brevity, we take the
   // first found.
-  storage_fido2_entry_t cred;
+  // Read the credential in place: the private key is not copied out
   uint8_t cred_index = cred_indices[0];
-  if (!storage_load_fido2_cred(cred_index, &cred)) {
+  const storage_fido2_entry_t *cred = storage_view_fido2_cred(cred_index);
+  if (!cred) {
     return CTAP2_ERR_NO_CREDENTIALS;
   }
+  uint32_t sign_count;
 
   // Verify user presence
   if (!ctap2_verify_user_presence()) {
@@ -685,9 +702,10 @@ uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
     return CTAP2_ERR_PIN_REQUIRED;
   }
 
-  // Increment signature counter
-  cred.sign_count++;
-  storage_save_fido2_cred(cred_index, &cred);
+  // Increment signature counter (one bit in the counter area, no erase)
+  if (!storage_increment_fido2_sign_count(cred_index, &sign_count)) {
+    return CTAP2_ERR_PROCESSING;
+  }
 
   // Build authenticator data
   uint8_t auth_data[256];
@@ -698,7 +716,7 @@ uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
 
   uint16_t auth_data_len =
       ctap_build_authdata(auth_data, sizeof(auth_data), rp_id_hash, flags,
-                          cred.sign_count, NULL, 0, NULL);
+                          sign_count, NULL, 0, NULL);
 
   // Create signature base (authData + clientDataHash)
   uint8_t sign_data[256 + 32];
@@ -708,7 +726,7 @@ uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
   // Sign the data
   uint8_t signature[64];
   uint16_t sig_len;
-  if (!hsm_sign_ecc(cred.priv_key, sign_data, auth_data_len + 32, signature,
+  if (!hsm_sign_ecc(cred->priv_key, sign_data, auth_data_len + 32, signature,
                     &sig_len)) {
     return CTAP2_ERR_PROCESSING;
   }
@@ -745,7 +763,7 @@ uint8_t ctap2_handle_get_assertion(const uint8_t *cbor_data, uint16_t cbor_len,
   // credential.id
   if (!cbor_encode_tstr(&enc, "id"))
     return CTAP2_ERR_PROCESSING;
-  if (!cbor_encode_bstr(&enc, cred.cred_id, 32))
+  if (!cbor_encode_bstr(&enc, cred->cred_id, 32))
     return CTAP2_ERR_PROCESSING;
 
   // 2. authData (0x02)
@@ -804,11 +822,13 @@ void opentoken_process_ctap2_command(uint8_t *buffer, uint16_t len) {
   // Update context with error checking
   g_ctap2_ctx.current_cid = cid;
   g_ctap2_ctx.state = CTAP2_STATE_PROCESSING;
+  g_ctap2_ctx.last_message_ms = to_ms_since_boot(get_absolute_time());
 
   if (cmd == (CTAPHID_CMD_INIT | CTAPHID_INIT_FLAG)) {
     // CTAPHID_INIT command
     if (payload_len < 8) {
       // ... error handling ...
+      g_ctap2_ctx.state = CTAP2_STATE_ERROR;
       return;
     }
     // ... existing init logic ...
@@ -885,6 +905,11 @@ void opentoken_process_ctap2_command(uint8_t *buffer, uint16_t len) {
       break;
     }
 
+    // A success response promises the credential state is on flash
+    if (status == CTAP2_OK && !storage_flush()) {
+      status = CTAP2_ERR_PROCESSING;
+    }
+
     // Send response or error with proper error handling
     if (status == CTAP2_OK && response_len > 0) {
       if (!ctap_send_response(cid, cmd, response, response_len)) {
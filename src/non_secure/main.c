@@ -22,6 +22,17 @@
 // to satisfy retry_operation's function pointer requirement
 bool opentoken_usb_init(void) { return tusb_init(); }
 
+// Background work (storage sector erases and compaction, HSM pool refills
+// and DRBG reseeds) only runs once both interfaces have been quiet for a
+// while, so a slice never lands inside a command or between the commands of
+// a burst
+#define MAINTENANCE_QUIET_MS 250
+
+static bool maintenance_allowed(void) {
+  return ctap2_engine_idle_ms() >= MAINTENANCE_QUIET_MS &&
+         ccid_engine_idle_ms() >= MAINTENANCE_QUIET_MS;
+}
+
 // External descriptor declarations (defined in usb_descriptors.c)
 extern tusb_desc_device_t const desc_device;
 extern uint8_t const desc_configuration[];
@@ -42,6 +53,9 @@ void tud_umount_cb(void) {
   // Update USB stability tracking
   usb_stability_update_state(USB_STATE_DISCONNECTED);
 
+  // Host is gone; the device may lose power next
+  storage_flush();
+
   // Cleanup resources on disconnect
   error_cleanup_resources();
 }
@@ -52,6 +66,9 @@ void tud_suspend_cb(bool remote_wakeup_en) {
 
   // Update USB stability tracking
   usb_stability_update_state(USB_STATE_SUSPENDED);
+
+  // Persist deferred storage writes before the bus goes idle
+  storage_flush();
 }
 
 void tud_resume_cb(void) {
@@ -103,6 +120,9 @@ int main() {
   // Initialize applets
   openpgp_applet_init();
 
+  storage_set_maintenance_policy(maintenance_allowed);
+  hsm_set_maintenance_policy(maintenance_allowed);
+
   // OTP Keyboard Task is still needed here for polling? 
   // If otp_keyboard is strictly secure, polling should happen in secure world or via IPC.
   // For now, we assume otp_keyboard_task needs to be called.
@@ -132,6 +152,12 @@ int main() {
     // OTP Keyboard Task (Button polling)
     otp_keyboard_task();
 
+    // Deferred storage write-back and compaction
+    storage_task();
+
+    // When idle: random and keypair pool refills, DRBG reseed
+    hsm_task();
+
     // Periodic system health monitoring
     uint32_t now = to_ms_since_boot(get_absolute_time());
     if (now - last_health_check > 5000) { // Every 5 seconds
@@ -91,7 +91,9 @@ static bool calculate_totp(const storage_oath_entry_t *entry,
 }
 
 // Calculate HOTP code
-static bool calculate_hotp(storage_oath_entry_t *entry, uint32_t *code_out) {
+// The caller persists the counter step (storage_increment_oath_counter)
+static bool calculate_hotp(const storage_oath_entry_t *entry,
+                           uint32_t *code_out) {
   // Convert counter to big-endian 8-byte array
   uint8_t challenge[8];
   uint64_t counter = entry->counter;
@@ -107,41 +109,11 @@ static bool calculate_hotp(storage_oath_entry_t *entry, uint32_t *code_out) {
     return false;
   }
 
-  // Increment counter for next use
-  entry->counter++;
-
   // Truncate to get final code
   *code_out = oath_truncate(hmac, 6); // Default to 6 digits
   return true;
 }
 
-// Helper to find account by name using Flash Storage
-static int find_account(const uint8_t *name, uint8_t len) {
-  storage_oath_entry_t entry;
-  for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-    if (storage_load_oath_account(i, &entry)) {
-      if (entry.name_len == len && memcmp(entry.name, name, len) == 0) {
-        return i;
-      }
-    }
-  }
-  return -1;
-}
-
-// Find a free slot
-static int find_free_slot(void) {
-  storage_oath_entry_t entry;
-  for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-    if (!storage_load_oath_account(i, &entry)) {
-      return i; // Using the failure to load (empty/inactive) as a sign of free
-                // slot?
-      // Better: storage_load checks active bit. If not active, it returns
-      // false.
-    }
-  }
-  return -1;
-}
-
 bool oath_applet_select(const uint8_t *aid, uint8_t len) {
   if (len == OATH_AID_LEN && memcmp(aid, OATH_AID, OATH_AID_LEN) == 0) {
     is_selected = true;
@@ -224,16 +196,21 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     // We'll implement this as a security feature but require confirmation
     printf("OATH Applet: RESET Command - clearing all accounts.\n");
 
-    // Clear all OATH accounts from storage
-    bool reset_success = true;
-    for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
+    // Clear all OATH accounts from storage, all or nothing
+    bool reset_success = storage_txn_begin();
+    for (int i = 0; reset_success && i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
       if (!storage_delete_oath_account(i)) {
-        // Continue even if some deletions fail
-        printf("OATH RESET: Warning - failed to delete account at slot %d\n",
-               i);
+        printf("OATH RESET: Failed to delete account at slot %d\n", i);
+        reset_success = false;
       }
     }
 
+    // The deletes above are committed as a single batch
+    if (reset_success)
+      reset_success = storage_txn_commit();
+    else
+      storage_txn_abort();
+
     if (reset_success) {
       printf("OATH RESET: All accounts cleared successfully\n");
       SET_SW(OATH_SW_OK);
@@ -263,7 +240,8 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
         // Now allowed because session is authenticated
         memcpy(pin_data.pin_hash, new_pin, 32);
         pin_data.retries_remaining = 3;
-        if (storage_save_pin_data(&pin_data)) {
+        // Flushed before OK: a power cut must not revert the new PIN
+        if (storage_save_pin_data(&pin_data) && storage_flush()) {
           printf("OATH Applet: OATH PIN updated successfully.\n");
           SET_SW(OATH_SW_OK);
         } else {
@@ -281,54 +259,53 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
   case OATH_INS_CALCULATE_ALL: {
     printf("OATH Applet: CALCULATE_ALL Command - generating all TOTP codes.\n");
 
-    storage_oath_entry_t entry;
+    storage_iter_t it = STORAGE_ITER_INIT;
+    const storage_oath_entry_t *entry;
     uint16_t total_accounts = 0;
 
     // Build response with all active TOTP accounts and their codes
-    for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-      if (storage_load_oath_account(i, &entry)) {
-        // Only process TOTP accounts for CALCULATE_ALL
-        if ((entry.prop & 0xF0) == OATH_TYPE_TOTP) {
-          uint32_t code = 0;
-          if (calculate_totp(&entry, NULL, &code)) {
-            // Calculate response length needed
-            uint8_t name_tlv_len = 2 + entry.name_len; // 71 + len + name
-            uint8_t code_tlv_len = 7; // 76 + 5 + digits + 4-byte code
-            uint8_t total_inner_len = name_tlv_len + code_tlv_len;
-
-            // Check buffer space (Response buffer typically 256 or 512)
-            if (*response_len + 2 + total_inner_len > 250) {
-              printf("OATH CALCULATE_ALL: Response buffer full, truncating\n");
-              break;
-            }
-
-            uint8_t *ptr = response + *response_len;
-
-            // Name list entry (tag 72)
-            *ptr++ = OATH_TAG_NAME_LIST; // 72
-            *ptr++ = total_inner_len;    // Length of inner TLV data
-
-            // Name TLV (tag 71)
-            *ptr++ = OATH_TAG_NAME;  // 71
-            *ptr++ = entry.name_len; // Name length
-            memcpy(ptr, entry.name, entry.name_len);
-            ptr += entry.name_len;
-
-            // Response value TLV (tag 76)
-            *ptr++ = OATH_TAG_RESPONSE_VAL; // 76
-            *ptr++ = 5;                     // Length: 1 + 4
-            *ptr++ = 6;                     // Digits
-            *ptr++ = (code >> 24) & 0xFF;   // Code (big-endian)
-            *ptr++ = (code >> 16) & 0xFF;
-            *ptr++ = (code >> 8) & 0xFF;
-            *ptr++ = code & 0xFF;
-
-            *response_len += (2 + total_inner_len);
-            total_accounts++;
-
-            printf("OATH CALCULATE_ALL: Added TOTP code %06u for '%.*s'\n",
-                   code, entry.name_len, entry.name);
+    while ((entry = storage_next_oath_account(&it, NULL)) != NULL) {
+      // Only process TOTP accounts for CALCULATE_ALL
+      if ((entry->prop & 0xF0) == OATH_TYPE_TOTP) {
+        uint32_t code = 0;
+        if (calculate_totp(entry, NULL, &code)) {
+          // Calculate response length needed
+          uint8_t name_tlv_len = 2 + entry->name_len; // 71 + len + name
+          uint8_t code_tlv_len = 7; // 76 + 5 + digits + 4-byte code
+          uint8_t total_inner_len = name_tlv_len + code_tlv_len;
+
+          // Check buffer space (Response buffer typically 256 or 512)
+          if (*response_len + 2 + total_inner_len > 250) {
+            printf("OATH CALCULATE_ALL: Response buffer full, truncating\n");
+            break;
           }
+
+          uint8_t *ptr = response + *response_len;
+
+          // Name list entry (tag 72)
+          *ptr++ = OATH_TAG_NAME_LIST; // 72
+          *ptr++ = total_inner_len;    // Length of inner TLV data
+
+          // Name TLV (tag 71)
+          *ptr++ = OATH_TAG_NAME;   // 71
+          *ptr++ = entry->name_len; // Name length
+          memcpy(ptr, entry->name, entry->name_len);
+          ptr += entry->name_len;
+
+          // Response value TLV (tag 76)
+          *ptr++ = OATH_TAG_RESPONSE_VAL; // 76
+          *ptr++ = 5;                     // Length: 1 + 4
+          *ptr++ = 6;                     // Digits
+          *ptr++ = (code >> 24) & 0xFF;   // Code (big-endian)
+          *ptr++ = (code >> 16) & 0xFF;
+          *ptr++ = (code >> 8) & 0xFF;
+          *ptr++ = code & 0xFF;
+
+          *response_len += (2 + total_inner_len);
+          total_accounts++;
+
+          printf("OATH CALCULATE_ALL: Added TOTP code %06u for '%.*s'\n",
+                 code, entry->name_len, entry->name);
         }
       }
     }
@@ -410,9 +387,9 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     }
 
     // Find existing account or free slot
-    int idx = find_account(name_buf, name_len);
+    int idx = storage_find_oath_account(name_buf, name_len);
     if (idx == -1) {
-      idx = find_free_slot();
+      idx = storage_find_free_oath_slot();
       printf("OATH PUT: Using new slot %d\n", idx);
     } else {
       printf("OATH PUT: Updating existing account at slot %d\n", idx);
@@ -436,8 +413,15 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     new_entry.counter = 0; // Initialize HOTP counter
     new_entry.active = 1;
 
-    // Save to storage
-    if (storage_save_oath_account(idx, &new_entry)) {
+    // Save to storage (durable before the response)
+    bool saved =
+        storage_txn_begin() && storage_save_oath_account(idx, &new_entry);
+    if (saved)
+      saved = storage_txn_commit();
+    else
+      storage_txn_abort();
+
+    if (saved) {
       printf("OATH PUT: Account '%.*s' saved successfully to slot %d\n",
              name_len, name_buf, idx);
       SET_SW(OATH_SW_OK);
@@ -452,48 +436,47 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
   case OATH_INS_LIST: {
     printf("OATH Applet: LIST Command - Enumerating accounts.\n");
 
-    storage_oath_entry_t entry;
+    storage_iter_t it = STORAGE_ITER_INIT;
+    const storage_oath_entry_t *entry;
     uint16_t account_count = 0;
 
     // Build response with all active accounts
     // Response format: Sequence of [72 Len [71 NameLen Name] [75 1 Property]]
-    for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-      if (storage_load_oath_account(i, &entry)) {
-        // Calculate total length for this account entry
-        uint8_t name_tlv_len = 2 + entry.name_len; // 71 + len + name
-        uint8_t prop_tlv_len = 3;                  // 75 + 1 + property
-        uint8_t total_inner_len = name_tlv_len + prop_tlv_len;
-
-        // Check if we have enough space in response buffer
-        if (*response_len + 2 + total_inner_len >
-            256) { // Assume max 256 byte response
-          printf("OATH LIST: Response buffer full, truncating list\n");
-          break;
-        }
+    while ((entry = storage_next_oath_account(&it, NULL)) != NULL) {
+      // Calculate total length for this account entry
+      uint8_t name_tlv_len = 2 + entry->name_len; // 71 + len + name
+      uint8_t prop_tlv_len = 3;                   // 75 + 1 + property
+      uint8_t total_inner_len = name_tlv_len + prop_tlv_len;
+
+      // Check if we have enough space in response buffer
+      if (*response_len + 2 + total_inner_len >
+          256) { // Assume max 256 byte response
+        printf("OATH LIST: Response buffer full, truncating list\n");
+        break;
+      }
 
-        uint8_t *ptr = response + *response_len;
+      uint8_t *ptr = response + *response_len;
 
-        // Name list entry (tag 72)
-        *ptr++ = OATH_TAG_NAME_LIST; // 72
-        *ptr++ = total_inner_len;    // Length of inner TLV data
+      // Name list entry (tag 72)
+      *ptr++ = OATH_TAG_NAME_LIST; // 72
+      *ptr++ = total_inner_len;    // Length of inner TLV data
 
-        // Name TLV (tag 71)
-        *ptr++ = OATH_TAG_NAME;  // 71
-        *ptr++ = entry.name_len; // Name length
-        memcpy(ptr, entry.name, entry.name_len);
-        ptr += entry.name_len;
+      // Name TLV (tag 71)
+      *ptr++ = OATH_TAG_NAME;   // 71
+      *ptr++ = entry->name_len; // Name length
+      memcpy(ptr, entry->name, entry->name_len);
+      ptr += entry->name_len;
 
-        // Property TLV (tag 75)
-        *ptr++ = OATH_TAG_PROPERTY; // 75
-        *ptr++ = 1;                 // Property length (always 1)
-        *ptr++ = entry.prop;        // Property value
+      // Property TLV (tag 75)
+      *ptr++ = OATH_TAG_PROPERTY; // 75
+      *ptr++ = 1;                 // Property length (always 1)
+      *ptr++ = entry->prop;        // Property value
 
-        *response_len += (2 + total_inner_len);
-        account_count++;
+      *response_len += (2 + total_inner_len);
+      account_count++;
 
-        printf("OATH LIST: Added account '%.*s' (prop=0x%02X)\n",
-               entry.name_len, entry.name, entry.prop);
-      }
+      printf("OATH LIST: Added account '%.*s' (prop=0x%02X)\n",
+             entry->name_len, entry->name, entry->prop);
     }
 
     printf("OATH LIST: Listed %d accounts, response length = %d\n",
@@ -556,16 +539,16 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     }
 
     // Find the account
-    int idx = find_account(name_buf, name_len);
+    int idx = storage_find_oath_account(name_buf, name_len);
     if (idx < 0) {
       printf("OATH CALCULATE: Account '%.*s' not found\n", name_len, name_buf);
       SET_SW(OATH_SW_FILE_NOT_FOUND);
       return;
     }
 
-    // Load account data
-    storage_oath_entry_t entry;
-    if (!storage_load_oath_account(idx, &entry)) {
+    // Account data, read in place
+    const storage_oath_entry_t *entry = storage_view_oath_account(idx);
+    if (!entry) {
       printf("OATH CALCULATE: Failed to load account data\n");
       SET_SW(OATH_SW_FILE_NOT_FOUND);
       return;
@@ -575,29 +558,29 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     uint32_t code = 0;
     bool calculation_success = false;
 
-    if ((entry.prop & 0xF0) == OATH_TYPE_TOTP) {
+    if ((entry->prop & 0xF0) == OATH_TYPE_TOTP) {
       // TOTP calculation
       printf("OATH CALCULATE: Calculating TOTP for '%.*s'\n", name_len,
              name_buf);
       led_status_set(LED_COLOR_YELLOW); // Indicate OATH activity
       calculation_success = calculate_totp(
-          &entry, (challenge_len == 8) ? challenge_buf : NULL, &code);
+          entry, (challenge_len == 8) ? challenge_buf : NULL, &code);
 
       // Delay slightly to make sure the flash is visible if needed, then revert
       sleep_ms(10);
       led_status_set(LED_COLOR_GREEN);
-    } else if ((entry.prop & 0xF0) == OATH_TYPE_HOTP) {
+    } else if ((entry->prop & 0xF0) == OATH_TYPE_HOTP) {
       // HOTP calculation - increment counter and save back
       printf("OATH CALCULATE: Calculating HOTP for '%.*s' (counter=%u)\n",
-             name_len, name_buf, entry.counter);
-      calculation_success = calculate_hotp(&entry, &code);
+             name_len, name_buf, entry->counter);
+      calculation_success = calculate_hotp(entry, &code);
 
-      // Save updated counter back to storage
+      // Persist the counter step before the code is released
       if (calculation_success) {
-        storage_save_oath_account(idx, &entry);
+        calculation_success = storage_increment_oath_counter(idx, NULL);
       }
     } else {
-      printf("OATH CALCULATE: Unknown OATH type 0x%02X\n", entry.prop);
+      printf("OATH CALCULATE: Unknown OATH type 0x%02X\n", entry->prop);
       SET_SW(OATH_SW_WRONG_P1P2);
       return;
     }
@@ -665,15 +648,15 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
     }
 
     // Find the account
-    int idx = find_account(name_buf, name_len);
+    int idx = storage_find_oath_account(name_buf, name_len);
     if (idx < 0) {
       printf("OATH DELETE: Account '%.*s' not found\n", name_len, name_buf);
       SET_SW(OATH_SW_FILE_NOT_FOUND);
       return;
     }
 
-    // Delete the account
-    if (storage_delete_oath_account(idx)) {
+    // Delete the account (on flash before OK is returned)
+    if (storage_delete_oath_account(idx) && storage_flush()) {
       printf("OATH DELETE: Account '%.*s' deleted successfully\n", name_len,
              name_buf);
       SET_SW(OATH_SW_OK);
@@ -693,42 +676,40 @@ void oath_applet_process_apdu(const uint8_t *apdu, uint16_t len,
 
 // Helper to calculate default OTP (first available HOTP) for Keyboard Interface
 bool oath_applet_calculate_default(char *code_out_str) {
-  storage_oath_entry_t entry;
+  storage_iter_t it = STORAGE_ITER_INIT;
+  const storage_oath_entry_t *entry;
+  uint8_t i;
 
   // Search for the first valid HOTP account
-  for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-    if (storage_load_oath_account(i, &entry)) {
-      // Check if it's an HOTP account (Property 0x1?)
-      if ((entry.prop & 0xF0) == OATH_TYPE_HOTP) {
-        uint32_t code = 0;
-        printf("OATH: Found default HOTP account '%.*s' at slot %d\n",
-               entry.name_len, entry.name, i);
-
-        if (calculate_hotp(&entry, &code)) {
-          // Save updated counter
-          storage_save_oath_account(i, &entry);
-
-          // Format as 6-digit string
-          sprintf(code_out_str, "%06lu", code);
-          return true;
-        }
+  while ((entry = storage_next_oath_account(&it, &i)) != NULL) {
+    // Check if it's an HOTP account (Property 0x1?)
+    if ((entry->prop & 0xF0) == OATH_TYPE_HOTP) {
+      uint32_t code = 0;
+      printf("OATH: Found default HOTP account '%.*s' at slot %d\n",
+             entry->name_len, entry->name, i);
+
+      if (calculate_hotp(entry, &code) &&
+          storage_increment_oath_counter(i, NULL)) {
+
+        // Format as 6-digit string
+        sprintf(code_out_str, "%06lu", code);
+        return true;
       }
     }
   }
 
   // If no HOTP found, try TOTP as fallback?
   // Use TOTP if no HOTP found
-  for (int i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-    if (storage_load_oath_account(i, &entry)) {
-      if ((entry.prop & 0xF0) == OATH_TYPE_TOTP) {
-        uint32_t code = 0;
-        printf("OATH: Found default TOTP account '%.*s' at slot %d\n",
-               entry.name_len, entry.name, i);
-
-        if (calculate_totp(&entry, NULL, &code)) {
-          sprintf(code_out_str, "%06lu", code);
-          return true;
-        }
+  it = (storage_iter_t)STORAGE_ITER_INIT;
+  while ((entry = storage_next_oath_account(&it, &i)) != NULL) {
+    if ((entry->prop & 0xF0) == OATH_TYPE_TOTP) {
+      uint32_t code = 0;
+      printf("OATH: Found default TOTP account '%.*s' at slot %d\n",
+             entry->name_len, entry->name, i);
+
+      if (calculate_totp(entry, NULL, &code)) {
+        sprintf(code_out_str, "%06lu", code);
+        return true;
       }
     }
   }
@@ -6,6 +6,7 @@
  * browsers to communicate with the OpenToken device for credential management.
  */
 
+#include "hsm_layer.h"
 #include "pico/bootrom.h"
 #include "storage.h"
 #include "tusb.h"
@@ -22,9 +23,17 @@
 #define WEBUSB_CMD_GET_STATUS 0x04
 #define WEBUSB_CMD_RESET_DEVICE 0x05
 #define WEBUSB_CMD_REBOOT_BOOTLOADER 0x06
+#define WEBUSB_CMD_GET_TELEMETRY 0x07
 #define WEBUSB_CMD_LIST_OATH 0x10
 #define WEBUSB_CMD_DELETE_OATH 0x11
 
+// GET_TELEMETRY pages (second command byte)
+#define WEBUSB_TELEMETRY_SUMMARY 0x00
+#define WEBUSB_TELEMETRY_ERASES 0x01
+#define WEBUSB_TELEMETRY_HISTOGRAM 0x02
+#define WEBUSB_TELEMETRY_KEYPOOL 0x03
+#define WEBUSB_TELEMETRY_MAX_ERASES 60 // Erase counts per response
+
 // Response status codes
 #define WEBUSB_STATUS_OK 0x00
 #define WEBUSB_STATUS_ERROR 0x01
@@ -59,15 +68,15 @@ static void handle_list_creds(void) {
   uint8_t offset = 1;
   uint8_t count = 0;
 
-  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS && offset < 240; i++) {
-    storage_fido2_entry_t cred;
-    if (storage_load_fido2_cred(i, &cred)) {
-      // Format: slot_id (1) + rp_id_hash (8 bytes only, truncated)
-      webusb_response[offset++] = i;
-      memcpy(&webusb_response[offset], cred.rp_id_hash, 8);
-      offset += 8;
-      count++;
-    }
+  storage_iter_t it = STORAGE_ITER_INIT;
+  const storage_fido2_entry_t *cred;
+  uint8_t slot;
+  while (offset < 240 && (cred = storage_next_fido2_cred(&it, &slot))) {
+    // Format: slot_id (1) + rp_id_hash (8 bytes only, truncated)
+    webusb_response[offset++] = slot;
+    memcpy(&webusb_response[offset], cred->rp_id_hash, 8);
+    offset += 8;
+    count++;
   }
 
   // Insert count after status byte
@@ -87,7 +96,8 @@ static void handle_delete_cred(uint8_t slot_id) {
     return;
   }
 
-  if (storage_delete_fido2_cred(slot_id)) {
+  // On flash before OK: a power cut must not bring the credential back
+  if (storage_delete_fido2_cred(slot_id) && storage_flush()) {
     webusb_response[0] = WEBUSB_STATUS_OK;
   } else {
     webusb_response[0] = WEBUSB_STATUS_ERROR;
@@ -101,23 +111,9 @@ static void handle_delete_cred(uint8_t slot_id) {
 static void handle_get_status(void) {
   webusb_response[0] = WEBUSB_STATUS_OK;
 
-  // Count active FIDO2 credentials
-  uint8_t fido2_count = 0;
-  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
-    storage_fido2_entry_t cred;
-    if (storage_load_fido2_cred(i, &cred)) {
-      fido2_count++;
-    }
-  }
-
-  // Count active OATH accounts
-  uint8_t oath_count = 0;
-  for (uint8_t i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
-    storage_oath_entry_t entry;
-    if (storage_load_oath_account(i, &entry)) {
-      oath_count++;
-    }
-  }
+  // Count active entries (no entry is copied)
+  uint8_t fido2_count = storage_count_fido2_creds();
+  uint8_t oath_count = storage_count_oath_accounts();
 
   webusb_response[1] = fido2_count;
   webusb_response[2] = STORAGE_FIDO2_MAX_CREDS;
@@ -134,17 +130,17 @@ static void handle_list_oath(void) {
   uint8_t offset = 2;
   uint8_t count = 0;
 
-  for (uint8_t i = 0; i < STORAGE_OATH_MAX_ACCOUNTS && offset < 200; i++) {
-    storage_oath_entry_t entry;
-    if (storage_load_oath_account(i, &entry)) {
-      // Format: slot_id (1) + name_len (1) + name (up to 32 bytes)
-      webusb_response[offset++] = i;
-      uint8_t name_len = (entry.name_len > 32) ? 32 : entry.name_len;
-      webusb_response[offset++] = name_len;
-      memcpy(&webusb_response[offset], entry.name, name_len);
-      offset += name_len;
-      count++;
-    }
+  storage_iter_t it = STORAGE_ITER_INIT;
+  const storage_oath_entry_t *entry;
+  uint8_t slot;
+  while (offset < 200 && (entry = storage_next_oath_account(&it, &slot))) {
+    // Format: slot_id (1) + name_len (1) + name (up to 32 bytes)
+    webusb_response[offset++] = slot;
+    uint8_t name_len = (entry->name_len > 32) ? 32 : entry->name_len;
+    webusb_response[offset++] = name_len;
+    memcpy(&webusb_response[offset], entry->name, name_len);
+    offset += name_len;
+    count++;
   }
 
   webusb_response[1] = count;
@@ -162,7 +158,8 @@ static void handle_delete_oath(uint8_t slot_id) {
     return;
   }
 
-  if (storage_delete_oath_account(slot_id)) {
+  // On flash before OK, as for DELETE_CRED
+  if (storage_delete_oath_account(slot_id) && storage_flush()) {
     webusb_response[0] = WEBUSB_STATUS_OK;
   } else {
     webusb_response[0] = WEBUSB_STATUS_ERROR;
@@ -170,6 +167,90 @@ static void handle_delete_oath(uint8_t slot_id) {
   webusb_response_len = 1;
 }
 
+static uint8_t *put_le32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    *p++ = (uint8_t)(v >> (8 * i));
+  return p;
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t v) {
+  p = put_le32(p, (uint32_t)v);
+  return put_le32(p, (uint32_t)(v >> 32));
+}
+
+/**
+ * @brief Handle GET_TELEMETRY command - storage wear and write cost, keypair
+ * pool hit rate
+ * @param page WEBUSB_TELEMETRY_* page
+ * @param arg First sector (ERASES) or histogram id (HISTOGRAM)
+ *
+ * Request: command, page, arg (2, little-endian; a missing high byte is 0).
+ * All values little-endian. Responses start with status, page:
+ * - SUMMARY: bytes encrypted (8), bytes programmed (8), sectors (2), most
+ *   erased sector (2), its erases (4), total erases (4), histogram count
+ *   (1), buckets per histogram (1)
+ * - ERASES: first sector (2), count n (1), n lifetime erase counts (4 each)
+ * - HISTOGRAM: id (1), samples (4), max (4), sum (8), buckets (4 each)
+ * - KEYPOOL: depth (1), available (1), hits (4), misses (4), refills (4);
+ *   hit rate is hits / (hits + misses)
+ */
+static void handle_get_telemetry(uint8_t page, uint16_t arg) {
+  uint8_t *p = webusb_response;
+  *p++ = WEBUSB_STATUS_OK;
+  *p++ = page;
+
+  if (page == WEBUSB_TELEMETRY_SUMMARY) {
+    storage_telemetry_t t;
+    storage_get_telemetry(&t);
+    p = put_le64(p, t.bytes_encrypted);
+    p = put_le64(p, t.bytes_programmed);
+    *p++ = (uint8_t)t.sectors;
+    *p++ = (uint8_t)(t.sectors >> 8);
+    *p++ = (uint8_t)t.worst_sector;
+    *p++ = (uint8_t)(t.worst_sector >> 8);
+    p = put_le32(p, t.worst_erases);
+    p = put_le32(p, t.total_erases);
+    *p++ = STORAGE_HIST_COUNT;
+    *p++ = STORAGE_HIST_BUCKETS;
+  } else if (page == WEBUSB_TELEMETRY_ERASES) {
+    storage_telemetry_t t;
+    storage_get_telemetry(&t);
+    uint8_t count = 0;
+    if (arg < t.sectors) {
+      count = (t.sectors - arg > WEBUSB_TELEMETRY_MAX_ERASES)
+                  ? WEBUSB_TELEMETRY_MAX_ERASES
+                  : (uint8_t)(t.sectors - arg);
+    }
+    *p++ = (uint8_t)arg;
+    *p++ = (uint8_t)(arg >> 8);
+    *p++ = count;
+    for (uint8_t i = 0; i < count; i++)
+      p = put_le32(p, storage_get_erase_count(arg + i));
+  } else if (page == WEBUSB_TELEMETRY_HISTOGRAM && arg < STORAGE_HIST_COUNT) {
+    const storage_histogram_t *hist =
+        storage_get_histogram((storage_histogram_id_t)arg);
+    *p++ = (uint8_t)arg;
+    p = put_le32(p, hist->count);
+    p = put_le32(p, hist->max);
+    p = put_le64(p, hist->sum);
+    for (int i = 0; i < STORAGE_HIST_BUCKETS; i++)
+      p = put_le32(p, hist->buckets[i]);
+  } else if (page == WEBUSB_TELEMETRY_KEYPOOL) {
+    hsm_keypool_stats_t k;
+    hsm_get_keypool_stats(&k);
+    *p++ = k.depth;
+    *p++ = k.available;
+    p = put_le32(p, k.hits);
+    p = put_le32(p, k.misses);
+    p = put_le32(p, k.refills);
+  } else {
+    webusb_response[0] = WEBUSB_STATUS_NOT_FOUND;
+    webusb_response_len = 1;
+    return;
+  }
+  webusb_response_len = (uint16_t)(p - webusb_response);
+}
+
 /**
  * @brief Handle RESET_DEVICE command - Perform a full secure wipe
  */
@@ -249,6 +330,12 @@ void opentoken_webusb_rx_cb(uint8_t const *buffer, uint16_t bufsize) {
     handle_reset_device();
     break;
 
+  case WEBUSB_CMD_GET_TELEMETRY:
+    handle_get_telemetry(bufsize >= 2 ? buffer[1] : WEBUSB_TELEMETRY_SUMMARY,
+                         (uint16_t)((bufsize >= 3 ? buffer[2] : 0) |
+                                    (bufsize >= 4 ? buffer[3] << 8 : 0)));
+    break;
+
   case WEBUSB_CMD_REBOOT_BOOTLOADER:
     handle_reboot_bootloader();
     return; // Don't send response twice
@@ -0,0 +1,186 @@
+/*
+ * OpenToken HSM - Entropy source (RP2350 TRNG)
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "hsm_entropy.h"
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "mbedtls/entropy.h"
+#include "mbedtls/platform_util.h"
+
+#if defined(PICO_RP2350) && PICO_RP2350
+#define HSM_ENTROPY_TRNG 1
+#include "hardware/resets.h"
+#include "hardware/structs/trng.h"
+#include "hardware/sync.h"
+#else
+#define HSM_ENTROPY_TRNG 0
+#include "pico/rand.h"
+#endif
+
+#if HSM_ENTROPY_TRNG
+// One EHR read: 6 words of 32 conditioned bits
+#define SOURCE_BLOCK_BYTES 24
+// Ring oscillator samples per collected bit (the reset value is tuned for
+// simulation, far too long for use)
+#define TRNG_SAMPLE_COUNT 32
+#define TRNG_TIMEOUT_SPINS 100000
+#define TRNG_ERROR_BITS                                                        \
+  (TRNG_RNG_ISR_AUTOCORR_ERR_BITS | TRNG_RNG_ISR_CRNGT_ERR_BITS |              \
+   TRNG_RNG_ISR_VN_ERR_BITS)
+#else
+#define SOURCE_BLOCK_BYTES 8 // One get_rand_64()
+#endif
+
+static bool g_started = false;
+static hsm_entropy_stats_t g_stats;
+
+// Continuous health test state
+static uint8_t g_rct_value;
+static uint32_t g_rct_run = 0;
+static uint8_t g_apt_value;
+static uint32_t g_apt_seen = 0;
+static uint32_t g_apt_pos = 0;
+
+#if HSM_ENTROPY_TRNG
+static void source_start(void) { unreset_block_wait(RESETS_RESET_TRNG_BITS); }
+
+// pico_rand drives the same TRNG (get_rand_*() on the RP2350), resetting and
+// reconfiguring it under PICO_SPINLOCK_ID_RAND. Each block is collected
+// under that lock from a fresh configuration, so neither driver sees the
+// other's settings or takes the other's EHR.
+static bool source_read(uint8_t out[SOURCE_BLOCK_BYTES]) {
+  spin_lock_t *lock = spin_lock_instance(PICO_SPINLOCK_ID_RAND);
+  uint32_t save = spin_lock_blocking(lock);
+
+  trng_hw->rnd_source_enable = 0;
+  trng_hw->trng_sw_reset = 1;
+  trng_hw->rng_imr = ~0u; // Polled, no interrupts
+  trng_hw->trng_config = 0;
+  trng_hw->sample_cnt1 = TRNG_SAMPLE_COUNT;
+  trng_hw->trng_debug_control = 0; // Keep VN, CRNGT and autocorrelation on
+  trng_hw->rng_icr = ~0u;
+  trng_hw->rnd_source_enable = 1;
+
+  bool ok = false;
+  for (uint32_t spin = 0; spin < TRNG_TIMEOUT_SPINS; spin++) {
+    uint32_t isr = trng_hw->rng_isr;
+    if (isr & TRNG_ERROR_BITS)
+      break;
+    if (isr & TRNG_RNG_ISR_EHR_VALID_BITS) {
+      ok = true;
+      break;
+    }
+  }
+  if (ok) {
+    for (uint32_t i = 0; i < SOURCE_BLOCK_BYTES / 4; i++) {
+      uint32_t word = trng_hw->ehr_data[i];
+      memcpy(out + 4 * i, &word, sizeof(word));
+    }
+  }
+  trng_hw->rnd_source_enable = 0;
+  trng_hw->rng_icr = ~0u;
+
+  spin_unlock(lock, save);
+  return ok;
+}
+#else
+static void source_start(void) {}
+
+static bool source_read(uint8_t out[SOURCE_BLOCK_BYTES]) {
+  uint64_t r = get_rand_64();
+  memcpy(out, &r, sizeof(r));
+  return true;
+}
+#endif
+
+static void health_reset(void) {
+  g_rct_run = 0;
+  g_apt_seen = 0;
+  g_apt_pos = 0;
+}
+
+// SP 800-90B 4.4.1 and 4.4.2 over each byte
+static bool health_check(const uint8_t *p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (g_rct_run > 0 && p[i] == g_rct_value) {
+      if (++g_rct_run >= HSM_ENTROPY_RCT_CUTOFF) {
+        g_stats.rct_failures++;
+        return false;
+      }
+    } else {
+      g_rct_value = p[i];
+      g_rct_run = 1;
+    }
+
+    if (g_apt_pos == 0) {
+      g_apt_value = p[i];
+      g_apt_seen = 1;
+    } else if (p[i] == g_apt_value &&
+               ++g_apt_seen >= HSM_ENTROPY_APT_CUTOFF) {
+      g_stats.apt_failures++;
+      return false;
+    }
+    if (++g_apt_pos == HSM_ENTROPY_APT_WINDOW)
+      g_apt_pos = 0;
+  }
+  return true;
+}
+
+// Read one block through the health tests. On a failure the source and the
+// tests start over, and hsm_entropy_init() has to pass again.
+static bool read_block(uint8_t out[SOURCE_BLOCK_BYTES]) {
+  if (!source_read(out)) {
+    g_stats.hw_failures++;
+  } else if (health_check(out, SOURCE_BLOCK_BYTES)) {
+    return true;
+  }
+  mbedtls_platform_zeroize(out, SOURCE_BLOCK_BYTES);
+  g_started = false;
+  return false;
+}
+
+bool hsm_entropy_init(void) {
+  uint8_t block[SOURCE_BLOCK_BYTES];
+  g_stats.hardware = HSM_ENTROPY_TRNG;
+  source_start();
+  health_reset();
+  g_started = true;
+  for (uint32_t done = 0; done < HSM_ENTROPY_STARTUP_BYTES;
+       done += SOURCE_BLOCK_BYTES) {
+    if (!read_block(block))
+      return false;
+  }
+  mbedtls_platform_zeroize(block, sizeof(block));
+  return true;
+}
+
+int hsm_entropy_poll(void *data, unsigned char *output, size_t len,
+                     size_t *olen) {
+  uint8_t block[SOURCE_BLOCK_BYTES];
+  (void)data;
+  *olen = 0;
+  if (!g_started && !hsm_entropy_init())
+    return MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+
+  for (size_t done = 0; done < len; done += SOURCE_BLOCK_BYTES) {
+    if (!read_block(block)) {
+      mbedtls_platform_zeroize(output, done);
+      return MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+    }
+    size_t n = len - done < SOURCE_BLOCK_BYTES ? len - done : SOURCE_BLOCK_BYTES;
+    memcpy(output + done, block, n);
+  }
+  mbedtls_platform_zeroize(block, sizeof(block));
+  g_stats.bytes += len;
+  *olen = len;
+  return 0;
+}
+
+void hsm_entropy_get_stats(hsm_entropy_stats_t *out) {
+  if (out)
+    *out = g_stats;
+}
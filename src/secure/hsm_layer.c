@@ -1,6 +1,9 @@
 #include "hsm_layer.h"
+#include "cycle_count.h"
 #include "error_handling.h"
+#include "hsm_entropy.h"
 #include "mbedtls_config.h"
+#include "p256.h"
 #include "storage.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,6 +12,7 @@
 #include <string.h>
 
 // Pico SDK for Hardware Root of Trust
+#include "pico/stdlib.h"
 #include "pico/unique_id.h"
 
 // mbedTLS Includes
@@ -29,15 +33,58 @@ static mbedtls_entropy_context entropy;
 static mbedtls_ctr_drbg_context ctr_drbg;
 static bool is_init = false;
 
-// Hardware-backed encryption key derived from RP2350 unique ID
-static uint8_t g_derived_storage_key[32] = {0};
+// Random pool: DRBG output generated ahead of time by hsm_task() while the
+// maintenance policy allows it, so credential IDs, nonces and ECDSA k are a
+// memcpy rather than a CTR_DRBG generate (key schedule, blocks and update)
+// each. Bytes are handed out from the top of the pool and zeroized as they
+// go. Only the part of a request the pool can no longer cover is generated
+// by the DRBG on the spot.
+#define HSM_RANDOM_POOL_SIZE 512
+#define HSM_RANDOM_POOL_LOW 256 // hsm_task() refills below this
+
+// Reseed from the entropy source after this many DRBG requests or this long,
+// whichever comes first. mbedtls' own reseed interval stays as the hard
+// limit: if the source stays unhealthy the DRBG stops generating.
+#define HSM_RESEED_REQUESTS 1024
+#define HSM_RESEED_INTERVAL_MS (10 * 60 * 1000)
+#define HSM_RESEED_RETRY_MS 1000
+
+static uint8_t g_random_pool[HSM_RANDOM_POOL_SIZE];
+static size_t g_random_avail = 0;
+static uint32_t g_reseed_ms = 0;  // Last successful (re)seed
+static uint32_t g_reseed_try_ms = 0;
+static hsm_maintenance_policy_t g_maintenance_policy = NULL;
+
+// Keypair pool (HSM_KEYPOOL_DEPTH, see hsm_layer.h): taken from the top,
+// refilled by hsm_task() one keygen at a time. Private keys are wrapped by
+// hsm_encrypt_key() as nonce || tag || ciphertext.
+#define HSM_WRAPPED_KEY_SIZE (12 + 16 + 32)
+
+typedef struct {
+  hsm_pubkey_t pub;
+  uint8_t wrapped[HSM_WRAPPED_KEY_SIZE];
+} hsm_pooled_key_t;
+
+#if HSM_KEYPOOL_DEPTH > 0
+static hsm_pooled_key_t g_keypool[HSM_KEYPOOL_DEPTH];
+static uint32_t g_keypool_refill_ms = 0; // Last keygen by hsm_task()
+#endif
+static uint8_t g_keypool_avail = 0;
+static hsm_keypool_stats_t g_keypool_stats = {.depth = HSM_KEYPOOL_DEPTH};
+
+// Key-wrap context: AES-256-GCM keyed with a key derived from the RP2350
+// unique ID. The key schedule is built once and kept for the device's
+// lifetime; the raw key is not kept. hsm_drop_key_contexts() zeroizes it.
+static mbedtls_gcm_context g_wrap_gcm;
 static bool g_key_derived = false;
+static uint32_t g_wrap_setup_cycles = 0; // OPENTOKEN_CYCLE_BENCH builds
 
 // Derive a unique key for this specific hardware
 static void hsm_derive_hardware_key(void) {
   if (g_key_derived)
     return;
 
+  uint32_t t0 = cycle_count_now();
   pico_unique_board_id_t board_id;
   pico_get_unique_board_id(&board_id);
 
@@ -46,20 +93,43 @@ static void hsm_derive_hardware_key(void) {
       mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
   const char *salt = "OpenToken-Hardened-Salt-v1";
   const char *info = "StorageEncryptionKey";
+  uint8_t key[32];
 
   if (mbedtls_hkdf(md_info, (const unsigned char *)salt, strlen(salt),
                    board_id.id, 8, (const unsigned char *)info, strlen(info),
-                   g_derived_storage_key, 32) != 0) {
+                   key, 32) != 0) {
     printf("HSM: HKDF Key derivation failed!\n");
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return;
+  }
+
+  mbedtls_gcm_init(&g_wrap_gcm);
+  int ret = mbedtls_gcm_setkey(&g_wrap_gcm, MBEDTLS_CIPHER_ID_AES, key, 256);
+  mbedtls_platform_zeroize(key, sizeof(key));
+  if (ret != 0) {
+    mbedtls_gcm_free(&g_wrap_gcm);
+    printf("HSM: Key-wrap context setup failed!\n");
     return;
   }
 
   g_key_derived = true;
+  g_wrap_setup_cycles = cycle_count_now() - t0;
   printf("HSM: Hardware-backed storage key derived successfully\n");
 }
 
+void hsm_drop_key_contexts(void) {
+  if (g_key_derived)
+    mbedtls_gcm_free(&g_wrap_gcm); // Zeroizes the key schedule
+  g_key_derived = false;
+#if HSM_KEYPOOL_DEPTH > 0
+  mbedtls_platform_zeroize(g_keypool, sizeof(g_keypool));
+#endif
+  g_keypool_avail = 0;
+}
+
 // Static wrapper prototypes
 static bool ensure_init_wrapper(void);
+static int hsm_random(void *ctx, unsigned char *out, size_t len);
 static bool storage_save_hsm_key_wrapper(void *context);
 
 static void ensure_init(void) {
@@ -68,12 +138,21 @@ static void ensure_init(void) {
   mbedtls_entropy_init(&entropy);
   mbedtls_ctr_drbg_init(&ctr_drbg);
 
-  // Seed with some fixed string + timer if possible (in Pico use standard RNG)
-  // Pico SDK pico_mbedtls handles this if using standard platform setup,
-  // but here we just do a basic seed.
+  // The health-tested TRNG is the only strong source (no
+  // MBEDTLS_ENTROPY_HARDWARE_ALT poll, see mbedtls_config.h), so every seed
+  // and reseed is built from its bytes
   const char *pers = "opentoken";
-  mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
-                        (const unsigned char *)pers, strlen(pers));
+  if (!hsm_entropy_init() ||
+      mbedtls_entropy_add_source(&entropy, hsm_entropy_poll, NULL,
+                                 HSM_ENTROPY_THRESHOLD,
+                                 MBEDTLS_ENTROPY_SOURCE_STRONG) != 0 ||
+      mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
+                            (const unsigned char *)pers, strlen(pers)) != 0) {
+    mbedtls_ctr_drbg_free(&ctr_drbg);
+    mbedtls_entropy_free(&entropy);
+    return;
+  }
+  g_reseed_ms = to_ms_since_boot(get_absolute_time());
 
   // Also derive the hardware key during initialization
   hsm_derive_hardware_key();
@@ -107,20 +186,104 @@ static bool ensure_init_wrapper(void) {
   return is_init;
 }
 
+// mbedtls f_rng over the random pool
+static int hsm_random(void *ctx, unsigned char *out, size_t len) {
+  (void)ctx;
+  if (!is_init)
+    return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+  size_t n = len < g_random_avail ? len : g_random_avail;
+  g_random_avail -= n;
+  memcpy(out, g_random_pool + g_random_avail, n);
+  mbedtls_platform_zeroize(g_random_pool + g_random_avail, n);
+  if (n == len)
+    return 0;
+  return mbedtls_ctr_drbg_random(&ctr_drbg, out + n, len - n);
+}
+
+#ifdef OPENTOKEN_P256_FAST
+// Keygen and signing on p256.c (constant-time, UMAAL field arithmetic on
+// the M33). Checked against mbedtls_ecp by host_tools/native/bench_p256.
+static bool p256_generate(uint8_t priv[32], uint8_t pub_x[32],
+                          uint8_t pub_y[32]) {
+  return p256_keygen(priv, pub_x, pub_y, hsm_random, NULL);
+}
+
+static bool p256_sign(const uint8_t priv[32], const uint8_t *hash,
+                      size_t hash_len, uint8_t sig[64]) {
+  return p256_ecdsa_sign(priv, hash, hash_len, sig, hsm_random, NULL);
+}
+#else
+// P-256 group, loaded once for the device's lifetime so keygen and signing
+// skip the group load. Its generator comb table is the precomputed const
+// table mbedtls ships in flash by default.
+static mbedtls_ecp_group g_p256;
+static bool g_p256_ready = false;
+
+static mbedtls_ecp_group *p256_group(void) {
+  if (g_p256_ready)
+    return &g_p256;
+  mbedtls_ecp_group_init(&g_p256);
+  if (mbedtls_ecp_group_load(&g_p256, MBEDTLS_ECP_DP_SECP256R1) != 0) {
+    mbedtls_ecp_group_free(&g_p256);
+    return NULL;
+  }
+  g_p256_ready = true;
+  return &g_p256;
+}
+
+// New P-256 keypair, big-endian
+static bool p256_generate(uint8_t priv[32], uint8_t pub_x[32],
+                          uint8_t pub_y[32]) {
+  mbedtls_ecp_group *grp = p256_group();
+  if (!grp)
+    return false;
+
+  mbedtls_mpi d;
+  mbedtls_ecp_point q;
+  mbedtls_mpi_init(&d);
+  mbedtls_ecp_point_init(&q);
+  bool ok =
+      mbedtls_ecp_gen_keypair(grp, &d, &q, hsm_random, NULL) == 0 &&
+      mbedtls_mpi_write_binary(&d, priv, 32) == 0 &&
+      mbedtls_mpi_write_binary(&q.MBEDTLS_PRIVATE(X), pub_x, 32) == 0 &&
+      mbedtls_mpi_write_binary(&q.MBEDTLS_PRIVATE(Y), pub_y, 32) == 0;
+  mbedtls_mpi_free(&d); // Zeroizes the limbs
+  mbedtls_ecp_point_free(&q);
+  if (!ok)
+    mbedtls_platform_zeroize(priv, 32);
+  return ok;
+}
+
+// ECDSA P-256 signature as r || s
+static bool p256_sign(const uint8_t priv[32], const uint8_t *hash,
+                      size_t hash_len, uint8_t sig[64]) {
+  mbedtls_ecp_group *grp = p256_group();
+  if (!grp)
+    return false;
+
+  mbedtls_mpi d, r, s;
+  mbedtls_mpi_init(&d);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+  bool ok = mbedtls_mpi_read_binary(&d, priv, 32) == 0 &&
+            mbedtls_ecdsa_sign(grp, &r, &s, &d, hash, hash_len, hsm_random,
+                               NULL) == 0 &&
+            mbedtls_mpi_write_binary(&r, sig, 32) == 0 &&
+            mbedtls_mpi_write_binary(&s, sig + 32, 32) == 0;
+  mbedtls_mpi_free(&d);
+  mbedtls_mpi_free(&r);
+  mbedtls_mpi_free(&s);
+  return ok;
+}
+#endif
+
 // Secure encryption for private key storage using AES-GCM
 static bool hsm_encrypt_key(const uint8_t *input, uint16_t input_len,
                             uint8_t *output_128) {
   if (!g_key_derived) {
     hsm_derive_hardware_key();
-  }
-
-  mbedtls_gcm_context gcm;
-  mbedtls_gcm_init(&gcm);
-
-  if (mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, g_derived_storage_key,
-                         256) != 0) {
-    mbedtls_gcm_free(&gcm);
-    return false;
+    if (!g_key_derived)
+      return false;
   }
 
   uint8_t *nonce = output_128;
@@ -128,45 +291,28 @@ static bool hsm_encrypt_key(const uint8_t *input, uint16_t input_len,
   uint8_t *ciphertext = output_128 + 12 + 16;
 
   // Generate random nonce
-  mbedtls_ctr_drbg_random(&ctr_drbg, nonce, 12);
-
-  if (mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, input_len, nonce, 12,
-                                NULL, 0, input, ciphertext, 16, tag) != 0) {
-    mbedtls_gcm_free(&gcm);
+  if (hsm_random(NULL, nonce, 12) != 0)
     return false;
-  }
 
-  mbedtls_gcm_free(&gcm);
-  return true;
+  return mbedtls_gcm_crypt_and_tag(&g_wrap_gcm, MBEDTLS_GCM_ENCRYPT, input_len,
+                                   nonce, 12, NULL, 0, input, ciphertext, 16,
+                                   tag) == 0;
 }
 
 static bool hsm_decrypt_key(const uint8_t *input_128, uint8_t *output,
                             uint16_t output_len) {
   if (!g_key_derived) {
     hsm_derive_hardware_key();
-  }
-
-  mbedtls_gcm_context gcm;
-  mbedtls_gcm_init(&gcm);
-
-  if (mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, g_derived_storage_key,
-                         256) != 0) {
-    mbedtls_gcm_free(&gcm);
-    return false;
+    if (!g_key_derived)
+      return false;
   }
 
   const uint8_t *nonce = input_128;
   const uint8_t *tag = input_128 + 12;
   const uint8_t *ciphertext = input_128 + 12 + 16;
 
-  if (mbedtls_gcm_auth_decrypt(&gcm, output_len, nonce, 12, NULL, 0, tag, 16,
-                               ciphertext, output) != 0) {
-    mbedtls_gcm_free(&gcm);
-    return false;
-  }
-
-  mbedtls_gcm_free(&gcm);
-  return true;
+  return mbedtls_gcm_auth_decrypt(&g_wrap_gcm, output_len, nonce, 12, NULL, 0,
+                                  tag, 16, ciphertext, output) == 0;
 }
 
 // Hash PIN with salt for secure comparison
@@ -197,6 +343,15 @@ hsm_pin_result_t hsm_verify_pin_secure(const uint8_t *pin_in,
     return HSM_PIN_LOCKED;
   }
 
+  // Charge the attempt before checking it. The decrement is on flash before
+  // the comparison, so neither a power cut nor a failing flush gives a free
+  // guess; without a flash write no PIN is checked at all.
+  pin_data.retries_remaining--;
+  if (!storage_save_pin_data(&pin_data) || !storage_flush()) {
+    printf("HSM: Retry counter not written, PIN not checked.\n");
+    return HSM_PIN_ERROR;
+  }
+
   // Hash the input PIN with stored salt
   uint8_t input_hash[32];
   hash_pin(pin_in, pin_len, pin_data.pin_salt, input_hash);
@@ -210,15 +365,15 @@ hsm_pin_result_t hsm_verify_pin_secure(const uint8_t *pin_in,
   mbedtls_platform_zeroize(input_hash, 32);
 
   if (diff == 0) {
-    // PIN correct - reset retry counter
+    // PIN correct - reset retry counter. Written back lazily: a power cut
+    // before that loses the reset and leaves this attempt charged, which
+    // only errs on the safe side.
     pin_data.retries_remaining = HSM_PIN_MAX_RETRIES;
     storage_save_pin_data(&pin_data);
     printf("HSM: PIN verified successfully.\n");
     return HSM_PIN_SUCCESS;
   } else {
-    // PIN incorrect - decrement retry counter
-    pin_data.retries_remaining--;
-    storage_save_pin_data(&pin_data);
+    // PIN incorrect - the decrement above stands
     printf("HSM: PIN incorrect. %d retries remaining.\n",
            pin_data.retries_remaining);
     return HSM_PIN_INCORRECT;
@@ -254,7 +409,8 @@ bool hsm_reset_pin_counter(const uint8_t *admin_pin, uint16_t admin_pin_len) {
   mbedtls_platform_zeroize(admin_hash, 32);
 
   if (diff == 0) {
-    // Admin PIN correct - reset user PIN counter
+    // Admin PIN correct - reset user PIN counter (written back lazily; a
+    // power cut before that leaves the counter where it was)
     pin_data.retries_remaining = HSM_PIN_MAX_RETRIES;
     storage_save_pin_data(&pin_data);
     printf("HSM: PIN counter reset successfully.\n");
@@ -297,36 +453,22 @@ bool hsm_generate_key_ecc(hsm_key_slot_t slot, hsm_pubkey_t *pubkey_out) {
     return false;
   }
 
-  mbedtls_ecp_keypair key;
-  mbedtls_ecp_keypair_init(&key);
-
-  if (mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, &key,
-                          mbedtls_ctr_drbg_random, &ctr_drbg) != 0) {
+  storage_hsm_key_t storage_key = {0};
+  uint8_t raw_priv[32];
+  if (!p256_generate(raw_priv, storage_key.pub_x, storage_key.pub_y)) {
     timeout_reset();
     ERROR_REPORT_ERROR(ERROR_CRYPTO_KEY_GENERATION,
                        "ECC key generation failed for slot %d", slot);
-    mbedtls_ecp_keypair_free(&key);
     return false;
   }
 
   timeout_reset();
 
-  // Extract public key
-  storage_hsm_key_t storage_key = {0};
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(Q).MBEDTLS_PRIVATE(X),
-                           storage_key.pub_x, 32);
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(Q).MBEDTLS_PRIVATE(Y),
-                           storage_key.pub_y, 32);
-
-  // Extract and encrypt private key before storage
-  uint8_t raw_priv[32];
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(d), raw_priv, 32);
-
+  // Encrypt private key before storage
   if (!hsm_encrypt_key(raw_priv, 32, storage_key.priv)) {
     ERROR_REPORT_ERROR(ERROR_CRYPTO_KEY_GENERATION,
                        "Symmetric encryption failed");
     memset(raw_priv, 0, sizeof(raw_priv));
-    mbedtls_ecp_keypair_free(&key);
     return false;
   }
 
@@ -344,7 +486,6 @@ bool hsm_generate_key_ecc(hsm_key_slot_t slot, hsm_pubkey_t *pubkey_out) {
           &RETRY_CONFIG_STORAGE)) {
     ERROR_REPORT_ERROR(ERROR_STORAGE_WRITE_FAILED,
                        "Failed to store key in slot %d", slot);
-    mbedtls_ecp_keypair_free(&key);
     // Clear storage key from memory
     memset(&storage_key, 0, sizeof(storage_key));
     return false;
@@ -358,7 +499,6 @@ bool hsm_generate_key_ecc(hsm_key_slot_t slot, hsm_pubkey_t *pubkey_out) {
 
   // Clear storage key from memory
   memset(&storage_key, 0, sizeof(storage_key));
-  mbedtls_ecp_keypair_free(&key);
 
   printf("HSM: Key generated and stored securely in slot %d\n", slot);
   return true;
@@ -388,6 +528,7 @@ bool hsm_sign_ecc_slot(hsm_key_slot_t slot, const uint8_t *hash_in,
                        uint16_t hash_len, uint8_t *signature_out,
                        uint16_t *signature_len) {
   ensure_init();
+  uint32_t bench_t0 = cycle_count_now();
   printf("HSM: Signing with key from slot %d...\n", slot);
 
   if (slot >= HSM_KEY_SLOT_MAX) {
@@ -404,7 +545,10 @@ bool hsm_sign_ecc_slot(hsm_key_slot_t slot, const uint8_t *hash_in,
 
   // Decrypt private key temporarily for signing
   uint8_t raw_priv[32];
-  if (!hsm_decrypt_key(storage_key.priv, raw_priv, 32)) {
+  uint32_t bench_unwrap = cycle_count_now();
+  bool unwrapped = hsm_decrypt_key(storage_key.priv, raw_priv, 32);
+  bench_unwrap = cycle_count_now() - bench_unwrap;
+  if (!unwrapped) {
     printf("HSM: Private key decryption failed (Auth Error?)\n");
     memset(&storage_key, 0, sizeof(storage_key));
     return false;
@@ -414,42 +558,128 @@ bool hsm_sign_ecc_slot(hsm_key_slot_t slot, const uint8_t *hash_in,
   memset(&storage_key, 0, sizeof(storage_key));
 
   // Perform signing operation
-  mbedtls_ecp_keypair key;
-  mbedtls_ecp_keypair_init(&key);
-  mbedtls_ecp_group_load(&key.MBEDTLS_PRIVATE(grp), MBEDTLS_ECP_DP_SECP256R1);
-  mbedtls_mpi_read_binary(&key.MBEDTLS_PRIVATE(d), raw_priv, 32);
+  uint8_t signature[64];
+  bool success = p256_sign(raw_priv, hash_in, hash_len, signature);
 
-  // Clear raw private key from memory immediately after loading
+  // Clear raw private key from memory immediately after use
   memset(raw_priv, 0, sizeof(raw_priv));
 
-  mbedtls_mpi r, s;
-  mbedtls_mpi_init(&r);
-  mbedtls_mpi_init(&s);
-
-  bool success = false;
-  if (mbedtls_ecdsa_sign(&key.MBEDTLS_PRIVATE(grp), &r, &s,
-                         &key.MBEDTLS_PRIVATE(d), hash_in, hash_len,
-                         mbedtls_ctr_drbg_random, &ctr_drbg) == 0) {
-    mbedtls_mpi_write_binary(&r, signature_out, 32);
-    mbedtls_mpi_write_binary(&s, signature_out + 32, 32);
+  if (success) {
+    memcpy(signature_out, signature, sizeof(signature));
     *signature_len = 64;
-    success = true;
     printf("HSM: Signature generated successfully\n");
   } else {
     printf("HSM: Signature generation failed\n");
   }
 
-  // Clean up all cryptographic material
-  mbedtls_mpi_free(&r);
-  mbedtls_mpi_free(&s);
-  mbedtls_ecp_keypair_free(&key);
-
+#ifdef OPENTOKEN_CYCLE_BENCH
+  printf("Bench: hsm_sign_ecc_slot %lu cycles, unwrap %lu on the cached key "
+         "(~%lu cycles of key setup avoided)\n",
+         (unsigned long)(cycle_count_now() - bench_t0),
+         (unsigned long)bench_unwrap, (unsigned long)g_wrap_setup_cycles);
+#else
+  (void)bench_t0;
+#endif
   return success;
 }
 
+#if HSM_KEYPOOL_DEPTH > 0
+// Generate one keypair into the pool (hsm_task())
+static void keypool_refill_one(void) {
+  hsm_pooled_key_t *entry = &g_keypool[g_keypool_avail];
+  uint8_t priv[32];
+  bool ok = p256_generate(priv, entry->pub.x, entry->pub.y) &&
+            hsm_encrypt_key(priv, sizeof(priv), entry->wrapped);
+  mbedtls_platform_zeroize(priv, sizeof(priv));
+  if (!ok) {
+    mbedtls_platform_zeroize(entry, sizeof(*entry));
+    return;
+  }
+  g_keypool_avail++;
+  g_keypool_stats.refills++;
+}
+#endif
+
 bool hsm_get_random(uint8_t *out, size_t len) {
   ensure_init();
-  return mbedtls_ctr_drbg_random(&ctr_drbg, out, len) == 0;
+  return hsm_random(NULL, out, len) == 0;
+}
+
+void hsm_task(void) {
+  if (!is_init)
+    return;
+
+  // All of it is background work (TRNG collection with interrupts off, DRBG
+  // output, keygens) and waits for a quiet host. Meanwhile hsm_random()
+  // covers an exhausted pool from the DRBG, and mbedtls still reseeds on its
+  // own once its reseed interval runs out.
+  if (g_maintenance_policy && !g_maintenance_policy())
+    return;
+
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  if ((ctr_drbg.reseed_counter >= HSM_RESEED_REQUESTS ||
+       now - g_reseed_ms >= HSM_RESEED_INTERVAL_MS) &&
+      now - g_reseed_try_ms >= HSM_RESEED_RETRY_MS) {
+    g_reseed_try_ms = now;
+    if (mbedtls_ctr_drbg_reseed(&ctr_drbg, NULL, 0) == 0) {
+      g_reseed_ms = now;
+      // Pool bytes predate the reseed; start over
+      mbedtls_platform_zeroize(g_random_pool, sizeof(g_random_pool));
+      g_random_avail = 0;
+    } else {
+      ERROR_REPORT_ERROR(ERROR_CRYPTO_RNG_FAILURE, "DRBG reseed failed");
+    }
+  }
+
+  if (g_random_avail < HSM_RANDOM_POOL_LOW) {
+    size_t want = HSM_RANDOM_POOL_SIZE - g_random_avail;
+    if (mbedtls_ctr_drbg_random(&ctr_drbg, g_random_pool + g_random_avail,
+                                want) == 0)
+      g_random_avail += want;
+  }
+
+#if HSM_KEYPOOL_DEPTH > 0
+  if (g_keypool_avail < HSM_KEYPOOL_DEPTH &&
+      now - g_keypool_refill_ms >= HSM_KEYPOOL_REFILL_MS) {
+    g_keypool_refill_ms = now;
+    keypool_refill_one();
+  }
+#endif
+}
+
+void hsm_set_maintenance_policy(hsm_maintenance_policy_t may_run) {
+  g_maintenance_policy = may_run;
+}
+
+bool hsm_take_keypair(hsm_keypair_t *keypair_out) {
+  ensure_init();
+
+#if HSM_KEYPOOL_DEPTH > 0
+  if (g_keypool_avail > 0) {
+    hsm_pooled_key_t *entry = &g_keypool[--g_keypool_avail];
+    bool unwrapped = hsm_decrypt_key(entry->wrapped, keypair_out->priv, 32);
+    keypair_out->pub = entry->pub;
+    mbedtls_platform_zeroize(entry, sizeof(*entry));
+    if (unwrapped) {
+      g_keypool_stats.hits++;
+      return true;
+    }
+    ERROR_REPORT_ERROR(ERROR_CRYPTO_INVALID_KEY, "Pooled key unwrap failed");
+  }
+#endif
+
+  g_keypool_stats.misses++;
+  if (!p256_generate(keypair_out->priv, keypair_out->pub.x,
+                     keypair_out->pub.y)) {
+    printf("HSM: Key Gen Failed\n");
+    return false;
+  }
+  return true;
+}
+
+void hsm_get_keypool_stats(hsm_keypool_stats_t *out) {
+  *out = g_keypool_stats;
+  out->available = g_keypool_avail;
 }
 
 // Key management functions
@@ -477,23 +707,11 @@ bool hsm_generate_key_ecc_legacy(hsm_keypair_t *keypair_out) {
          "securely\n");
   ensure_init();
 
-  mbedtls_ecp_keypair key;
-  mbedtls_ecp_keypair_init(&key);
-
-  if (mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, &key,
-                          mbedtls_ctr_drbg_random, &ctr_drbg) != 0) {
+  if (!p256_generate(keypair_out->priv, keypair_out->pub.x,
+                     keypair_out->pub.y)) {
     printf("HSM: Key Gen Failed\n");
-    mbedtls_ecp_keypair_free(&key);
     return false;
   }
-
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(Q).MBEDTLS_PRIVATE(X),
-                           keypair_out->pub.x, 32);
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(Q).MBEDTLS_PRIVATE(Y),
-                           keypair_out->pub.y, 32);
-  mbedtls_mpi_write_binary(&key.MBEDTLS_PRIVATE(d), keypair_out->priv, 32);
-
-  mbedtls_ecp_keypair_free(&key);
   return true;
 }
 
@@ -504,32 +722,9 @@ bool hsm_sign_ecc(const uint8_t *priv_key, const uint8_t *hash_in,
   printf("HSM: Using legacy signing (deprecated) - private key exposed\n");
   ensure_init();
 
-  mbedtls_ecp_keypair key;
-  mbedtls_ecp_keypair_init(&key);
-  mbedtls_ecp_group_load(&key.MBEDTLS_PRIVATE(grp), MBEDTLS_ECP_DP_SECP256R1);
-  mbedtls_mpi_read_binary(&key.MBEDTLS_PRIVATE(d), priv_key, 32);
-
-  mbedtls_mpi r, s;
-  mbedtls_mpi_init(&r);
-  mbedtls_mpi_init(&s);
-
-  if (mbedtls_ecdsa_sign(&key.MBEDTLS_PRIVATE(grp), &r, &s,
-                         &key.MBEDTLS_PRIVATE(d), hash_in, hash_len,
-                         mbedtls_ctr_drbg_random, &ctr_drbg) != 0) {
-    mbedtls_mpi_free(&r);
-    mbedtls_mpi_free(&s);
-    mbedtls_ecp_keypair_free(&key);
+  if (!p256_sign(priv_key, hash_in, hash_len, signature_out))
     return false;
-  }
-
-  mbedtls_mpi_write_binary(&r, signature_out, 32);
-  mbedtls_mpi_write_binary(&s, signature_out + 32, 32);
   *signature_len = 64;
-
-  mbedtls_mpi_free(&r);
-  mbedtls_mpi_free(&s);
-  mbedtls_ecp_keypair_free(&key);
-
   return true;
 }
 
@@ -539,5 +734,6 @@ static bool storage_save_hsm_key_wrapper(void *context) {
     uint8_t slot;
     const storage_hsm_key_t *key;
   } *ctx = context;
-  return storage_save_hsm_key(ctx->slot, ctx->key);
+  // A new key is only reported once it is on flash
+  return storage_save_hsm_key(ctx->slot, ctx->key) && storage_flush();
 }
\ No newline at end of file
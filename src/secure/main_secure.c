@@ -3,8 +3,10 @@
  * Copyright (c) 2025 OpenToken Project
  */
 
+#include "cycle_count.h"
 #include "error_handling.h"
 #include "hsm_layer.h"
+#include "mbedtls/sha256.h"
 #include "storage.h"
 
 
@@ -26,6 +28,8 @@ static const retry_config_t RETRY_CONFIG_CRYPTO_SEC = {.max_attempts = 3,
                                                            false};
 
 void secure_world_init(void) {
+  cycle_count_enable(); // OPENTOKEN_CYCLE_BENCH builds only
+
   // Initialize secure storage first
   if (!retry_operation((bool (*)(void))storage_init,
                        &RETRY_CONFIG_STORAGE_SEC)) {
@@ -41,6 +45,10 @@ void secure_world_init(void) {
     system_enter_safe_mode();
   }
 
+#if defined(OPENTOKEN_CYCLE_BENCH) && defined(MBEDTLS_SHA256_ALT)
+  sha256_alt_bench();
+#endif
+
   // Initialize Secure User Presence (Button)
   otp_keyboard_init();
 }
@@ -0,0 +1,635 @@
+/*
+ * OpenToken HSM - Constant-time P-256 keygen and ECDSA signing
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "p256.h"
+#include <string.h>
+
+#include "mbedtls/platform_util.h"
+
+// Field elements and scalars: 8 little-endian 32-bit limbs, kept in
+// Montgomery form (x * 2^256 mod m) while being computed on. Every
+// function runs the same instructions and memory accesses whatever the
+// values; the only branches are on public data (exponent bits of p-2 and
+// n-2, rejection of out-of-range random scalars).
+
+#define LIMBS 8
+
+typedef uint32_t limb_t;
+
+typedef struct {
+  limb_t x[LIMBS], y[LIMBS], z[LIMBS]; // Homogeneous projective (X:Y:Z)
+} point_t;
+
+typedef struct {
+  limb_t x[LIMBS], y[LIMBS]; // Affine, Montgomery form
+} affine_t;
+
+// Modulus with -m^-1 mod 2^32 and 2^512 mod m (into Montgomery form)
+typedef struct {
+  limb_t m[LIMBS];
+  limb_t minv;
+  limb_t rr[LIMBS];
+  limb_t m_minus_2[LIMBS]; // Fermat inversion exponent
+} modulus_t;
+
+static const modulus_t k_p = {
+    .m = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x00000000,
+          0x00000000, 0x00000001, 0xFFFFFFFF},
+    .minv = 0x00000001,
+    .rr = {0x00000003, 0x00000000, 0xFFFFFFFF, 0xFFFFFFFB, 0xFFFFFFFE,
+           0xFFFFFFFF, 0xFFFFFFFD, 0x00000004},
+    .m_minus_2 = {0xFFFFFFFD, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x00000000,
+                  0x00000000, 0x00000001, 0xFFFFFFFF},
+};
+
+static const modulus_t k_n = {
+    .m = {0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF,
+          0xFFFFFFFF, 0x00000000, 0xFFFFFFFF},
+    .minv = 0xEE00BC4F,
+    .rr = {0xBE79EEA2, 0x83244C95, 0x49BD6FA6, 0x4699799C, 0x2B6BEC59,
+           0x2845B239, 0xF3D95620, 0x66E12D94},
+    .m_minus_2 = {0xFC63254F, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF,
+                  0xFFFFFFFF, 0x00000000, 0xFFFFFFFF},
+};
+
+// Curve b, Montgomery form
+static const limb_t k_b[LIMBS] = {0x29C4BDDF, 0xD89CDF62, 0x78843090,
+                                  0xACF005CD, 0xF7212ED6, 0xE5A220AB,
+                                  0x04874834, 0xDC30061D};
+
+// 1 in Montgomery form mod p
+static const limb_t k_one[LIMBS] = {0x00000001, 0x00000000, 0x00000000,
+                                    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+                                    0xFFFFFFFE, 0x00000000};
+
+// Comb tables: k_comb[t][i - 1] = sum over bits b of i of 2^(32b + 128t) G,
+// affine in Montgomery form. k*G takes 32 doublings, each followed by one
+// lookup in both tables (bits j, j+32, j+64, j+96 and j+128, ..., j+224).
+static const affine_t k_comb[2][15] = {
+    {
+        {{0x18A9143C, 0x79E730D4, 0x5FEDB601, 0x75BA95FC, 0x77622510,
+          0x79FB732B, 0xA53755C6, 0x18905F76},
+         {0xCE95560A, 0xDDF25357, 0xBA19E45C, 0x8B4AB8E4, 0xDD21F325,
+          0xD2E88688, 0x25885D85, 0x8571FF18}},
+        {{0x4147519A, 0x20288602, 0x26B372F0, 0xD0981EAC, 0xA785EBC8,
+          0xA9D4A7CA, 0xDBDF58E9, 0xD953C50D},
+         {0xFD590F8F, 0x9D6361CC, 0x44E6C917, 0x72E9626B, 0x22EB64CF,
+          0x7FD96110, 0x9EB288F3, 0x863EBB7E}},
+        {{0x5CDB6485, 0x7856B623, 0x2F0A2F97, 0x808F0EA2, 0x4F7E300B,
+          0x3E68D954, 0xB5FF80A0, 0x00076055},
+         {0x838D2010, 0x7634EB9B, 0x3243708A, 0x54014FBB, 0x842A6606,
+          0xE0E47D39, 0x34373EE0, 0x83087761}},
+        {{0x16A0D2BB, 0x4F922FC5, 0x1A623499, 0x0D5CC16C, 0x57C62C8B,
+          0x9241CF3A, 0xFD1B667F, 0x2F5E6961},
+         {0xF5A01797, 0x5C15C70B, 0x60956192, 0x3D20B44D, 0x071FDB52,
+          0x04911B37, 0x8D6F0F7B, 0xF648F916}},
+        {{0xE137BBBC, 0x9E566847, 0x8A6A0BEC, 0xE434469E, 0x79D73463,
+          0xB1C42761, 0x133D0015, 0x5ABE0285},
+         {0xC04C7DAB, 0x92AA837C, 0x43260C07, 0x573D9F4C, 0x78E6CC37,
+          0x0C931562, 0x6B6F7383, 0x94BB725B}},
+        {{0x720F141C, 0xBBF9B48F, 0x2DF5BC74, 0x6199B3CD, 0x411045C4,
+          0xDC3F6129, 0x2F7DC4EF, 0xCDD6BBCB},
+         {0xEAF436FD, 0xCCA6700B, 0xB99326BE, 0x6F647F6D, 0x014F2522,
+          0x0C0FA792, 0x4BDAE5F6, 0xA361BEBD}},
+        {{0x597C13C7, 0x28AA2558, 0x50B7C3E1, 0xC38D635F, 0xF3C09D1D,
+          0x07039AEC, 0xC4B5292C, 0xBA12CA09},
+         {0x59F91DFD, 0x9E408FA4, 0xCEEA07FB, 0x3AF43B66, 0x9D780B29,
+          0x1ECEB089, 0x701FEF4B, 0x53EBB99D}},
+        {{0xB0E63D34, 0x4FE7EE31, 0xA9E54FAB, 0xF4600572, 0xD5E7B5A4,
+          0xC0493334, 0x06D54831, 0x8589FB92},
+         {0x6583553A, 0xAA70F5CC, 0xE25649E5, 0x0879094A, 0x10044652,
+          0xCC904507, 0x02541C4F, 0xEBB0696D}},
+        {{0xAC1647C5, 0x4616CA15, 0xC4CF5799, 0xB8127D47, 0x764DFBAC,
+          0xDC666AA3, 0xD1B27DA3, 0xEB2820CB},
+         {0x6A87E008, 0x9406F8D8, 0x922378F3, 0xD87DFA9D, 0x80CCECB2,
+          0x56ED2E42, 0x55A7DA1D, 0x1F28289B}},
+        {{0x3B89DA99, 0xABBAA0C0, 0xB8284022, 0xA6F2D79E, 0xB81C05E8,
+          0x27847862, 0x05E54D63, 0x337A4B59},
+         {0x21F7794A, 0x3C67500D, 0x7D6D7F61, 0x207005B7, 0x04CFD6E8,
+          0x0A5A3781, 0xF4C2FBD6, 0x0D65E0D5}},
+        {{0xB5275D38, 0xD9D09BBE, 0x0BE0A358, 0x4268A745, 0x973EB265,
+          0xF0762FF4, 0x52F4A232, 0xC23DA242},
+         {0x0B94520C, 0x5DA1B84F, 0xB05BD78E, 0x09666763, 0x94D29EA1,
+          0x3A4DCB86, 0xC790CFF1, 0x19DE3B8C}},
+        {{0x26C5FE04, 0x183A716C, 0x3BBA1BDB, 0x3B28DE0B, 0xA4CB712C,
+          0x7432C586, 0x91FCCBFD, 0xE34DCBD4},
+         {0xAAA58403, 0xB408D46B, 0x82E97A53, 0x9A697486, 0x36AAA8AF,
+          0x9E390127, 0x7B4E0F7F, 0xE7641F44}},
+        {{0xDF64BA59, 0x7D753941, 0x0B0242FC, 0xD33F10EC, 0xA1581859,
+          0x4F06DFC6, 0x052A57BF, 0x4A12DF57},
+         {0x9439DBD0, 0xBFA6338F, 0xBDE53E1F, 0xD3C24BD4, 0x21F1B314,
+          0xFD5E4FFA, 0xBB5BEA46, 0x6AF5AA93}},
+        {{0x10C91999, 0xDA10B699, 0x2A580491, 0x0A24B440, 0xB8CC2090,
+          0x3E0094B4, 0x66A44013, 0x5FE3475A},
+         {0xF93E7B4B, 0xB0F8CABD, 0x7C23F91A, 0x292B501A, 0xCD1E6263,
+          0x42E889AE, 0xECFEA916, 0xB544E308}},
+        {{0x16DDFDCE, 0x6478C6E9, 0xF89179E6, 0x2C329166, 0x4D4E67E1,
+          0x4E8D6E76, 0xA6B0C20B, 0xE0B6B2BD},
+         {0xBB7EFB57, 0x0D312DF2, 0x790C4007, 0x1AAC0DDE, 0x679BC944,
+          0xF90336AD, 0x25A63774, 0x71C023DE}},
+    },
+    {
+        {{0xBFE20925, 0x62A8C244, 0x8FDCE867, 0x91C19AC3, 0xDD387063,
+          0x5A96A5D5, 0x21D324F6, 0x61D587D4},
+         {0xA37173EA, 0xE87673A2, 0x53778B65, 0x23848008, 0x05BAB43E,
+          0x10F8441E, 0x4621EFBE, 0xFA11FE12}},
+        {{0x6D3549CF, 0xD433E50F, 0xFACD665E, 0x6F33696F, 0xCE11FCB4,
+          0x695BFDAC, 0xAF7C9860, 0x810EE252},
+         {0x7159BB2C, 0x65450FE1, 0x758B357B, 0xF7DFBEBE, 0xD69FEA72,
+          0x2B057E74, 0x92731745, 0xD485717A}},
+        {{0xFC9877EE, 0xD11D47DC, 0x801D0002, 0xC8B36210, 0x54C260B6,
+          0xD002C117, 0x6962F046, 0x04C17CD8},
+         {0xB0DADDF5, 0x6D9BD094, 0x24CE55C0, 0xBEA23575, 0x72DA03B5,
+          0x663356E6, 0xFED97474, 0xF7BA4DE9}},
+        {{0xF4F8B16A, 0x56F8410E, 0xC47B266A, 0x97241AFE, 0x6D9C87C1,
+          0x0A406B8E, 0xCD42AB1B, 0x803F3E02},
+         {0x04DBEC69, 0x7F0309A8, 0x3BBAD05F, 0xA83B85F7, 0xAD8E197F,
+          0xC6097273, 0x5067ADC1, 0xC097440E}},
+        {{0x80EC21FE, 0x5FE14BFE, 0xC255BE82, 0xF6CE116A, 0x2F4A5D67,
+          0x98BC5A07, 0xDB7E63AF, 0xFAD27148},
+         {0x29AB05B3, 0x90C0B6AC, 0x4E251AE6, 0x37A9A83C, 0xC2AADE7D,
+          0x0A7DC875, 0x9F0E1A84, 0x77387DE3}},
+        {{0x927DAFC6, 0x84A9521D, 0x5C09CD19, 0x52C1FB69, 0xF9366DDE,
+          0x9D9581A0, 0xA16D7E64, 0x9ABE210B},
+         {0x48915220, 0x480AF84A, 0x4DD816C6, 0xFA73176A, 0x1681CA5A,
+          0xC7D53987, 0x87F344B0, 0x7881C257}},
+        {{0x05058880, 0xD75A3E65, 0x643943F2, 0x7DA365EF, 0xFAB24925,
+          0x4147861C, 0xFDB808FF, 0xC5C4BDB0},
+         {0xB272B56B, 0x73513E34, 0x11B9043A, 0xC8327E95, 0xF8844969,
+          0xFD8CE37D, 0x46C2B6B5, 0x2D56DB94}},
+        {{0x35D0B34A, 0xE3417BC0, 0x8327C0A7, 0x440B386B, 0xAC0362D1,
+          0x8FB7262D, 0xE0CDF943, 0x2C41114C},
+         {0xAD95A0B1, 0x2BA5CEF1, 0x67D54362, 0xC09B37A8, 0x01E486C9,
+          0x26D6CDD2, 0x42FF9297, 0x20477ABF}},
+        {{0xA7BF9B7C, 0xF4F80824, 0x3FBE30D0, 0x365D2320, 0x97CF9CE3,
+          0xBFBE5320, 0xB3055526, 0xE3604700},
+         {0x6CC6C2C7, 0x4DCB9911, 0xBA4CBEE6, 0x72683708, 0x637AD9EC,
+          0xDCDED434, 0xA3DEE15F, 0x6542D677}},
+        {{0x15339848, 0x231C210E, 0x70778C8D, 0xE87A28E8, 0x6956E170,
+          0x9D1DE661, 0x2BB09C0B, 0x4AC3C938},
+         {0x6998987D, 0x19BE0551, 0xAE09F4D6, 0x8B2376C4, 0x1A3F933D,
+          0x1DE0B765, 0xE39705F4, 0x380D94C7}},
+        {{0xA16BD00A, 0xEB54EA74, 0xF5C0BCC1, 0xD839E9AD, 0x1F9BFC06,
+          0x092BB7F1, 0x1163DC4E, 0x318F97B3},
+         {0xC30D7138, 0xECC0C5BE, 0xABC30220, 0x44E8DF23, 0xB0223606,
+          0x2BB7972F, 0x9A84FF4D, 0xFA41FAA1}},
+        {{0xF67D04C3, 0x2E80937C, 0x89EEB811, 0x1E312BE2, 0x92594D60,
+          0x56B5D887, 0x187FBD3D, 0x0224DA14},
+         {0x0C5FE36F, 0x87ABB863, 0x4EF51F5F, 0x580F3C60, 0xB3B429EC,
+          0x964FB1BF, 0x42BFFF33, 0x60838EF0}},
+        {{0x20C26DEF, 0xF0F58F66, 0x582B2D1E, 0x025585EA, 0x01CE3881,
+          0xFBE7D79B, 0x303F1730, 0x28CCEA01},
+         {0x79644BA5, 0xD1DABCD1, 0x06FFF0B8, 0x1FC643E8, 0x66B3E17B,
+          0xA60A76FC, 0xA1D013BF, 0xC18BAF48}},
+        {{0xADDB7D07, 0x396EF794, 0x24455500, 0x0B4FC742, 0xC78AA3CE,
+          0xFAFF8EAC, 0xE8D4D97D, 0x14E9ADA5},
+         {0x2F7079E2, 0xDAA480A1, 0xE4B0800E, 0x45BAA3CD, 0x7838157D,
+          0x01765E2D, 0x8E9D9AE8, 0xA0AD4FAB}},
+        {{0x0BFC8FF3, 0xC9A1DC0E, 0xE936F42F, 0x14EFD82B, 0xCCA381EF,
+          0x67016F7C, 0xED8AEE96, 0x1432C1CA},
+         {0x70B23C26, 0xEC684829, 0x0735B273, 0xA64FE873, 0xEAEF0F5A,
+          0xE389F6E5, 0x5AC8D2C6, 0xCAEF480B}},
+    },
+};
+
+// ---------------------------------------------------------------------------
+// Limb arithmetic
+// ---------------------------------------------------------------------------
+
+#if defined(__ARM_ARCH_8M_MAIN__) && defined(__ARM_FEATURE_DSP)
+// (hi:lo) = a * b + lo + hi; cannot overflow, one cycle on the M33
+static inline void mac(limb_t *lo, limb_t *hi, limb_t a, limb_t b) {
+  limb_t l = *lo, h = *hi;
+  __asm__("umaal %0, %1, %2, %3" : "+r"(l), "+r"(h) : "r"(a), "r"(b));
+  *lo = l;
+  *hi = h;
+}
+#else
+static inline void mac(limb_t *lo, limb_t *hi, limb_t a, limb_t b) {
+  uint64_t t = (uint64_t)a * b + *lo + *hi;
+  *lo = (limb_t)t;
+  *hi = (limb_t)(t >> 32);
+}
+#endif
+
+// t = a * b (512 bits)
+static void mul_256(limb_t t[2 * LIMBS], const limb_t a[LIMBS],
+                    const limb_t b[LIMBS]) {
+  memset(t, 0, 2 * LIMBS * sizeof(limb_t));
+  for (int i = 0; i < LIMBS; i++) {
+    limb_t c = 0;
+    for (int j = 0; j < LIMBS; j++)
+      mac(&t[i + j], &c, a[j], b[i]);
+    t[i + LIMBS] = c;
+  }
+}
+
+// t = a^2: the 28 cross products once, doubled, plus the 8 squares
+static void sqr_256(limb_t t[2 * LIMBS], const limb_t a[LIMBS]) {
+  memset(t, 0, 2 * LIMBS * sizeof(limb_t));
+  for (int i = 0; i < LIMBS - 1; i++) {
+    limb_t c = 0;
+    for (int j = i + 1; j < LIMBS; j++)
+      mac(&t[i + j], &c, a[i], a[j]);
+    t[i + LIMBS] = c;
+  }
+
+  limb_t top = 0;
+  for (int k = 0; k < 2 * LIMBS; k++) {
+    limb_t next = t[k] >> 31;
+    t[k] = (t[k] << 1) | top;
+    top = next;
+  }
+
+  limb_t c = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    limb_t hi = c;
+    mac(&t[2 * i], &hi, a[i], a[i]);
+    uint64_t s = (uint64_t)t[2 * i + 1] + hi;
+    t[2 * i + 1] = (limb_t)s;
+    c = (limb_t)(s >> 32);
+  }
+}
+
+// r = x - m if (carry:x) >= m, else x
+static void reduce_once(limb_t r[LIMBS], const limb_t x[LIMBS], limb_t carry,
+                        const limb_t m[LIMBS]) {
+  limb_t d[LIMBS];
+  limb_t borrow = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    uint64_t s = (uint64_t)x[i] - m[i] - borrow;
+    d[i] = (limb_t)s;
+    borrow = (limb_t)(s >> 63);
+  }
+  limb_t use_d = 0 - (carry | (borrow ^ 1));
+  for (int i = 0; i < LIMBS; i++)
+    r[i] = (d[i] & use_d) | (x[i] & ~use_d);
+}
+
+// r = t / 2^256 mod m for t < m * 2^256 (Montgomery reduction)
+static void mont_reduce(limb_t r[LIMBS], limb_t t[2 * LIMBS],
+                        const modulus_t *mod) {
+  limb_t carry = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    limb_t q = t[i] * mod->minv;
+    limb_t c = 0;
+    for (int j = 0; j < LIMBS; j++)
+      mac(&t[i + j], &c, q, mod->m[j]);
+    uint64_t s = (uint64_t)t[i + LIMBS] + c + carry;
+    t[i + LIMBS] = (limb_t)s;
+    carry = (limb_t)(s >> 32);
+  }
+  reduce_once(r, t + LIMBS, carry, mod->m);
+}
+
+static void mont_mul(limb_t r[LIMBS], const limb_t a[LIMBS],
+                     const limb_t b[LIMBS], const modulus_t *mod) {
+  limb_t t[2 * LIMBS];
+  mul_256(t, a, b);
+  mont_reduce(r, t, mod);
+}
+
+static void mont_sqr(limb_t r[LIMBS], const limb_t a[LIMBS],
+                     const modulus_t *mod) {
+  limb_t t[2 * LIMBS];
+  sqr_256(t, a);
+  mont_reduce(r, t, mod);
+}
+
+static void mod_add(limb_t r[LIMBS], const limb_t a[LIMBS],
+                    const limb_t b[LIMBS], const modulus_t *mod) {
+  limb_t s[LIMBS];
+  limb_t carry = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    uint64_t t = (uint64_t)a[i] + b[i] + carry;
+    s[i] = (limb_t)t;
+    carry = (limb_t)(t >> 32);
+  }
+  reduce_once(r, s, carry, mod->m);
+}
+
+static void mod_sub(limb_t r[LIMBS], const limb_t a[LIMBS],
+                    const limb_t b[LIMBS], const modulus_t *mod) {
+  limb_t borrow = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    uint64_t t = (uint64_t)a[i] - b[i] - borrow;
+    r[i] = (limb_t)t;
+    borrow = (limb_t)(t >> 63);
+  }
+  limb_t mask = 0 - borrow, carry = 0;
+  for (int i = 0; i < LIMBS; i++) {
+    uint64_t t = (uint64_t)r[i] + (mod->m[i] & mask) + carry;
+    r[i] = (limb_t)t;
+    carry = (limb_t)(t >> 32);
+  }
+}
+
+// r = a^(m-2) = a^-1 (Montgomery in, Montgomery out). The exponent is
+// public, so branching on its bits leaks nothing about a.
+static void mod_inv(limb_t r[LIMBS], const limb_t a[LIMBS],
+                    const modulus_t *mod) {
+  limb_t x[LIMBS];
+  memcpy(x, a, sizeof(x));
+  for (int bit = 255 - 1; bit >= 0; bit--) {
+    mont_sqr(x, x, mod);
+    if ((mod->m_minus_2[bit / 32] >> (bit % 32)) & 1)
+      mont_mul(x, x, a, mod);
+  }
+  memcpy(r, x, sizeof(x));
+}
+
+static void to_mont(limb_t r[LIMBS], const limb_t a[LIMBS],
+                    const modulus_t *mod) {
+  mont_mul(r, a, mod->rr, mod);
+}
+
+static void from_mont(limb_t r[LIMBS], const limb_t a[LIMBS],
+                      const modulus_t *mod) {
+  static const limb_t one[LIMBS] = {1};
+  mont_mul(r, a, one, mod);
+}
+
+static limb_t is_zero(const limb_t a[LIMBS]) {
+  limb_t acc = 0;
+  for (int i = 0; i < LIMBS; i++)
+    acc |= a[i];
+  return ((acc | (0 - acc)) >> 31) ^ 1;
+}
+
+// 1 if a < m (a, m as integers)
+static limb_t less_than(const limb_t a[LIMBS], const limb_t m[LIMBS]) {
+  limb_t borrow = 0;
+  for (int i = 0; i < LIMBS; i++)
+    borrow = (limb_t)(((uint64_t)a[i] - m[i] - borrow) >> 63);
+  return borrow;
+}
+
+static void from_bytes(limb_t r[LIMBS], const uint8_t in[32]) {
+  for (int i = 0; i < LIMBS; i++) {
+    const uint8_t *p = in + 28 - 4 * i;
+    r[i] = ((limb_t)p[0] << 24) | ((limb_t)p[1] << 16) |
+           ((limb_t)p[2] << 8) | p[3];
+  }
+}
+
+static void to_bytes(uint8_t out[32], const limb_t a[LIMBS]) {
+  for (int i = 0; i < LIMBS; i++) {
+    uint8_t *p = out + 28 - 4 * i;
+    p[0] = (uint8_t)(a[i] >> 24);
+    p[1] = (uint8_t)(a[i] >> 16);
+    p[2] = (uint8_t)(a[i] >> 8);
+    p[3] = (uint8_t)a[i];
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Points (Renes-Costello-Batina 2016, a = -3: algorithms 5 and 6)
+// ---------------------------------------------------------------------------
+
+#define FMUL(r, a, b) mont_mul(r, a, b, &k_p)
+#define FADD(r, a, b) mod_add(r, a, b, &k_p)
+#define FSUB(r, a, b) mod_sub(r, a, b, &k_p)
+
+// r = p + q for any p (including the point at infinity) and affine q
+static void point_add_affine(point_t *r, const point_t *p, const affine_t *q) {
+  limb_t t0[LIMBS], t1[LIMBS], t2[LIMBS], t3[LIMBS], t4[LIMBS];
+  limb_t x3[LIMBS], y3[LIMBS], z3[LIMBS];
+
+  FMUL(t0, p->x, q->x);
+  FMUL(t1, p->y, q->y);
+  FADD(t3, q->x, q->y);
+  FADD(t4, p->x, p->y);
+  FMUL(t3, t3, t4);
+  FADD(t4, t0, t1);
+  FSUB(t3, t3, t4);
+  FMUL(t4, q->y, p->z);
+  FADD(t4, t4, p->y);
+  FMUL(y3, q->x, p->z);
+  FADD(y3, y3, p->x);
+  FMUL(z3, k_b, p->z);
+  FSUB(x3, y3, z3);
+  FADD(z3, x3, x3);
+  FADD(x3, x3, z3);
+  FSUB(z3, t1, x3);
+  FADD(x3, t1, x3);
+  FMUL(y3, k_b, y3);
+  FADD(t1, p->z, p->z);
+  FADD(t2, t1, p->z);
+  FSUB(y3, y3, t2);
+  FSUB(y3, y3, t0);
+  FADD(t1, y3, y3);
+  FADD(y3, t1, y3);
+  FADD(t1, t0, t0);
+  FADD(t0, t1, t0);
+  FSUB(t0, t0, t2);
+  FMUL(t1, t4, y3);
+  FMUL(t2, t0, y3);
+  FMUL(y3, x3, z3);
+  FADD(y3, y3, t2);
+  FMUL(x3, t3, x3);
+  FSUB(x3, x3, t1);
+  FMUL(z3, t4, z3);
+  FMUL(t1, t3, t0);
+  FADD(z3, z3, t1);
+
+  memcpy(r->x, x3, sizeof(x3));
+  memcpy(r->y, y3, sizeof(y3));
+  memcpy(r->z, z3, sizeof(z3));
+}
+
+static void point_double(point_t *r, const point_t *p) {
+  limb_t t0[LIMBS], t1[LIMBS], t2[LIMBS], t3[LIMBS];
+  limb_t x3[LIMBS], y3[LIMBS], z3[LIMBS];
+
+  mont_sqr(t0, p->x, &k_p);
+  mont_sqr(t1, p->y, &k_p);
+  mont_sqr(t2, p->z, &k_p);
+  FMUL(t3, p->x, p->y);
+  FADD(t3, t3, t3);
+  FMUL(z3, p->x, p->z);
+  FADD(z3, z3, z3);
+  FMUL(y3, k_b, t2);
+  FSUB(y3, y3, z3);
+  FADD(x3, y3, y3);
+  FADD(y3, x3, y3);
+  FSUB(x3, t1, y3);
+  FADD(y3, t1, y3);
+  FMUL(y3, x3, y3);
+  FMUL(x3, x3, t3);
+  FADD(t3, t2, t2);
+  FADD(t2, t2, t3);
+  FMUL(z3, k_b, z3);
+  FSUB(z3, z3, t2);
+  FSUB(z3, z3, t0);
+  FADD(t3, z3, z3);
+  FADD(z3, z3, t3);
+  FADD(t3, t0, t0);
+  FADD(t0, t3, t0);
+  FSUB(t0, t0, t2);
+  FMUL(t0, t0, z3);
+  FADD(y3, y3, t0);
+  FMUL(t0, p->y, p->z);
+  FADD(t0, t0, t0);
+  FMUL(z3, t0, z3);
+  FSUB(x3, x3, z3);
+  FMUL(z3, t0, t1);
+  FADD(z3, z3, z3);
+  FADD(z3, z3, z3);
+
+  memcpy(r->x, x3, sizeof(x3));
+  memcpy(r->y, y3, sizeof(y3));
+  memcpy(r->z, z3, sizeof(z3));
+}
+
+// r += table[idx - 1], r unchanged for idx 0. Reads every entry.
+static void comb_add(point_t *r, const affine_t table[15], limb_t idx) {
+  affine_t q;
+  memset(&q, 0, sizeof(q));
+  for (limb_t e = 1; e <= 15; e++) {
+    limb_t mask = 0 - ((((e ^ idx) - 1) >> 31) & 1);
+    for (int i = 0; i < LIMBS; i++) {
+      q.x[i] |= table[e - 1].x[i] & mask;
+      q.y[i] |= table[e - 1].y[i] & mask;
+    }
+  }
+
+  point_t sum;
+  point_add_affine(&sum, r, &q);
+  limb_t keep = 0 - (((idx - 1) >> 31) & 1); // idx 0: keep r
+  for (int i = 0; i < LIMBS; i++) {
+    r->x[i] = (sum.x[i] & ~keep) | (r->x[i] & keep);
+    r->y[i] = (sum.y[i] & ~keep) | (r->y[i] & keep);
+    r->z[i] = (sum.z[i] & ~keep) | (r->z[i] & keep);
+  }
+}
+
+static limb_t scalar_bit(const limb_t k[LIMBS], int i) {
+  return (k[i / 32] >> (i % 32)) & 1;
+}
+
+static limb_t comb_index(const limb_t k[LIMBS], int bit) {
+  return scalar_bit(k, bit) | scalar_bit(k, bit + 32) << 1 |
+         scalar_bit(k, bit + 64) << 2 | scalar_bit(k, bit + 96) << 3;
+}
+
+// (x, y) = k * G, affine and out of Montgomery form, for k in [1, n-1]
+static void mul_base(limb_t x[LIMBS], limb_t y[LIMBS], const limb_t k[LIMBS]) {
+  point_t r;
+  memset(&r, 0, sizeof(r));
+  memcpy(r.y, k_one, sizeof(k_one)); // Point at infinity (0:1:0)
+
+  for (int j = 31; j >= 0; j--) {
+    point_double(&r, &r);
+    comb_add(&r, k_comb[0], comb_index(k, j));
+    comb_add(&r, k_comb[1], comb_index(k, j + 128));
+  }
+
+  limb_t zinv[LIMBS];
+  mod_inv(zinv, r.z, &k_p);
+  FMUL(x, r.x, zinv);
+  FMUL(y, r.y, zinv);
+  from_mont(x, x, &k_p);
+  from_mont(y, y, &k_p);
+  mbedtls_platform_zeroize(&r, sizeof(r));
+  mbedtls_platform_zeroize(zinv, sizeof(zinv));
+}
+
+static bool scalar_valid(const limb_t k[LIMBS]) {
+  return (less_than(k, k_n.m) & (is_zero(k) ^ 1)) != 0;
+}
+
+// Uniform scalar in [1, n-1] by rejection (a draw is rejected with
+// probability below 2^-32)
+static bool random_scalar(limb_t k[LIMBS], p256_rng_t f_rng, void *p_rng) {
+  uint8_t buf[32];
+  bool ok = false;
+  for (int tries = 0; tries < 8 && !ok; tries++) {
+    if (f_rng(p_rng, buf, sizeof(buf)) != 0)
+      break;
+    from_bytes(k, buf);
+    ok = scalar_valid(k);
+  }
+  mbedtls_platform_zeroize(buf, sizeof(buf));
+  return ok;
+}
+
+bool p256_keygen(uint8_t priv[32], uint8_t pub_x[32], uint8_t pub_y[32],
+                 p256_rng_t f_rng, void *p_rng) {
+  limb_t d[LIMBS], x[LIMBS], y[LIMBS];
+  bool ok = random_scalar(d, f_rng, p_rng);
+  if (ok) {
+    mul_base(x, y, d);
+    to_bytes(priv, d);
+    to_bytes(pub_x, x);
+    to_bytes(pub_y, y);
+  }
+  mbedtls_platform_zeroize(d, sizeof(d));
+  return ok;
+}
+
+bool p256_public_key(const uint8_t priv[32], uint8_t pub_x[32],
+                     uint8_t pub_y[32]) {
+  limb_t d[LIMBS], x[LIMBS], y[LIMBS];
+  from_bytes(d, priv);
+  bool ok = scalar_valid(d);
+  if (ok) {
+    mul_base(x, y, d);
+    to_bytes(pub_x, x);
+    to_bytes(pub_y, y);
+  }
+  mbedtls_platform_zeroize(d, sizeof(d));
+  return ok;
+}
+
+bool p256_ecdsa_sign(const uint8_t priv[32], const uint8_t *hash,
+                     size_t hash_len, uint8_t sig[64], p256_rng_t f_rng,
+                     void *p_rng) {
+  limb_t d[LIMBS], e[LIMBS], k[LIMBS], r[LIMBS], s[LIMBS], kinv[LIMBS];
+  limb_t x[LIMBS], y[LIMBS];
+  uint8_t buf[32] = {0};
+  bool ok = false;
+
+  from_bytes(d, priv);
+  if (!scalar_valid(d)) {
+    mbedtls_platform_zeroize(d, sizeof(d));
+    return false;
+  }
+
+  // e: the leftmost 256 bits of the hash as an integer, mod n
+  size_t used = hash_len < sizeof(buf) ? hash_len : sizeof(buf);
+  memcpy(buf + sizeof(buf) - used, hash, used);
+  from_bytes(e, buf);
+  reduce_once(e, e, 0, k_n.m);
+
+  for (int tries = 0; tries < 8 && !ok; tries++) {
+    if (!random_scalar(k, f_rng, p_rng))
+      break;
+    mul_base(x, y, k);
+    reduce_once(r, x, 0, k_n.m); // x < p < 2n
+    if (is_zero(r))
+      continue;
+
+    // s = k^-1 (e + r d) mod n, Montgomery products mod n
+    to_mont(kinv, k, &k_n);
+    mod_inv(kinv, kinv, &k_n); // k^-1 R
+    to_mont(s, r, &k_n);
+    mont_mul(s, s, d, &k_n); // r d
+    mod_add(s, s, e, &k_n);
+    mont_mul(s, kinv, s, &k_n);
+    if (is_zero(s))
+      continue;
+
+    to_bytes(sig, r);
+    to_bytes(sig + 32, s);
+    ok = true;
+  }
+
+  mbedtls_platform_zeroize(d, sizeof(d));
+  mbedtls_platform_zeroize(k, sizeof(k));
+  mbedtls_platform_zeroize(kinv, sizeof(kinv));
+  mbedtls_platform_zeroize(s, sizeof(s));
+  mbedtls_platform_zeroize(e, sizeof(e));
+  return ok;
+}
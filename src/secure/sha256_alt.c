@@ -0,0 +1,307 @@
+/*
+ * OpenToken HSM - SHA-256 on the RP2350 SHA-256 block (MBEDTLS_SHA256_ALT)
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "mbedtls/sha256.h"
+
+#if defined(MBEDTLS_SHA256_ALT)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cycle_count.h"
+#include "hardware/dma.h"
+#include "hardware/resets.h"
+#include "hardware/sha256.h"
+#include "mbedtls/platform_util.h"
+
+// The block hashes one message at a time, and its chaining value can be
+// read (SUM0-7) but not loaded. So the context that most recently called
+// starts() owns it. When another context starts, the owner's chaining value
+// is read out and the owner carries on in software. The short-lived hashes
+// (rp_id, PIN, HMAC and HKDF messages) run in hardware; a long-lived one
+// such as the entropy accumulator drops to software whenever something else
+// hashes. SHA-224 always runs in software (the block only has the SHA-256
+// IV). finish() and free() give the block back; mbedtls and the callers in
+// this tree always reach one of them before a context goes out of scope.
+//
+// Whole blocks go to the hardware, by DMA from SHA256_DMA_MIN_BLOCKS up;
+// the partial block and the padding are buffered in the context.
+
+#define SHA256_DMA_MIN_BLOCKS 4 // Fewer: CPU writes beat the DMA setup
+
+static mbedtls_sha256_context *g_owner = NULL;
+static bool g_hw_ready = false;
+static int g_dma_channel = -1;
+static bool g_force_software = false; // sha256_alt_bench()
+
+static const uint32_t k_iv256[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+                                    0xA54FF53A, 0x510E527F, 0x9B05688C,
+                                    0x1F83D9AB, 0x5BE0CD19};
+static const uint32_t k_iv224[8] = {0xC1059ED8, 0x367CD507, 0x3070DD17,
+                                    0xF70E5939, 0xFFC00B31, 0x68581511,
+                                    0x64F98FA7, 0xBEFA4FA4};
+
+static const uint32_t k_rounds[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+    0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+    0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+    0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+    0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+    0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t get_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(uint32_t v, uint8_t *p) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+// FIPS 180-4 compression, 16 word message schedule window
+static void software_block(uint32_t state[8], const uint8_t *block) {
+  uint32_t w[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for (int i = 0; i < 64; i++) {
+    if (i < 16) {
+      w[i] = get_be32(block + 4 * i);
+    } else {
+      uint32_t w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+      w[i & 15] += (ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3)) +
+                   (ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10)) +
+                   w[(i - 7) & 15];
+    }
+    uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+                  ((e & f) ^ (~e & g)) + k_rounds[i] + w[i & 15];
+    uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+                  ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+  mbedtls_platform_zeroize(w, sizeof(w));
+}
+
+static void hardware_setup(void) {
+  if (g_hw_ready)
+    return;
+  unreset_block_wait(RESETS_RESET_SHA256_BITS);
+  sha256_set_bswap(true); // Message bytes in memory order
+  sha256_set_dma_size(4);
+  g_dma_channel = dma_claim_unused_channel(false); // -1: CPU writes only
+  g_hw_ready = true;
+}
+
+// Whether the block has consumed any of ctx's message yet (before that its
+// value is the IV already in ctx->state)
+static bool hardware_has_blocks(const mbedtls_sha256_context *ctx) {
+  return ctx->total[0] >= 64 || ctx->total[1] != 0;
+}
+
+static void hardware_read_state(uint32_t state[8]) {
+  sha256_wait_valid_blocking();
+  for (int i = 0; i < 8; i++)
+    state[i] = sha256_hw->sum[i];
+}
+
+static void hardware_release(mbedtls_sha256_context *owner) {
+  owner->hw = false;
+  g_owner = NULL;
+}
+
+static void hardware_feed(const uint8_t *p, size_t blocks) {
+  if (blocks >= SHA256_DMA_MIN_BLOCKS && g_dma_channel >= 0 &&
+      ((uintptr_t)p & 3) == 0) {
+    dma_channel_config c = dma_channel_get_default_config(g_dma_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, DREQ_SHA256);
+    dma_channel_configure(g_dma_channel, &c, sha256_get_write_addr(), p,
+                          blocks * 16, true);
+    dma_channel_wait_for_finish_blocking(g_dma_channel);
+    return;
+  }
+  for (size_t b = 0; b < blocks; b++, p += 64) {
+    sha256_wait_ready_blocking();
+    for (int i = 0; i < 16; i++) {
+      uint32_t word;
+      memcpy(&word, p + 4 * i, sizeof(word));
+      sha256_put_word(word);
+    }
+  }
+}
+
+static void process_blocks(mbedtls_sha256_context *ctx, const uint8_t *p,
+                           size_t blocks) {
+  if (ctx->hw) {
+    hardware_feed(p, blocks);
+    return;
+  }
+  for (size_t b = 0; b < blocks; b++, p += 64)
+    software_block(ctx->state, p);
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+  if (ctx == NULL)
+    return;
+  if (g_owner == ctx)
+    hardware_release(ctx);
+  mbedtls_platform_zeroize(ctx, sizeof(*ctx));
+}
+
+void mbedtls_sha256_clone(mbedtls_sha256_context *dst,
+                          const mbedtls_sha256_context *src) {
+  *dst = *src;
+  if (src->hw) {
+    // The copy continues in software from the block's current value
+    if (hardware_has_blocks(src))
+      hardware_read_state(dst->state);
+    dst->hw = false;
+  }
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) {
+  if (g_owner == ctx)
+    hardware_release(ctx);
+
+  ctx->total[0] = 0;
+  ctx->total[1] = 0;
+  ctx->is224 = is224;
+  memcpy(ctx->state, is224 ? k_iv224 : k_iv256, sizeof(ctx->state));
+  ctx->hw = false;
+  if (is224 || g_force_software)
+    return 0;
+
+  hardware_setup();
+  if (g_owner != NULL) {
+    // Evict: the owner continues in software
+    if (hardware_has_blocks(g_owner))
+      hardware_read_state(g_owner->state);
+    hardware_release(g_owner);
+  }
+  sha256_start();
+  ctx->hw = true;
+  g_owner = ctx;
+  return 0;
+}
+
+int mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx,
+                                    const unsigned char data[64]) {
+  process_blocks(ctx, data, 1);
+  return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx,
+                          const unsigned char *input, size_t ilen) {
+  if (ilen == 0)
+    return 0;
+
+  size_t left = ctx->total[0] & 0x3F;
+  size_t fill = 64 - left;
+  ctx->total[0] += (uint32_t)ilen;
+  if (ctx->total[0] < (uint32_t)ilen)
+    ctx->total[1]++;
+
+  if (left && ilen >= fill) {
+    memcpy(ctx->buffer + left, input, fill);
+    process_blocks(ctx, ctx->buffer, 1);
+    input += fill;
+    ilen -= fill;
+    left = 0;
+  }
+  if (ilen >= 64) {
+    size_t blocks = ilen / 64;
+    process_blocks(ctx, input, blocks);
+    input += blocks * 64;
+    ilen -= blocks * 64;
+  }
+  if (ilen > 0)
+    memcpy(ctx->buffer + left, input, ilen);
+  return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx,
+                          unsigned char *output) {
+  uint32_t used = ctx->total[0] & 0x3F;
+  ctx->buffer[used++] = 0x80;
+  if (used > 56) {
+    memset(ctx->buffer + used, 0, 64 - used);
+    process_blocks(ctx, ctx->buffer, 1);
+    used = 0;
+  }
+  memset(ctx->buffer + used, 0, 56 - used);
+  put_be32((ctx->total[0] >> 29) | (ctx->total[1] << 3), ctx->buffer + 56);
+  put_be32(ctx->total[0] << 3, ctx->buffer + 60);
+  process_blocks(ctx, ctx->buffer, 1);
+
+  if (ctx->hw) {
+    hardware_read_state(ctx->state);
+    hardware_release(ctx);
+  }
+  for (int i = 0; i < (ctx->is224 ? 7 : 8); i++)
+    put_be32(ctx->state[i], output + 4 * i);
+  return 0;
+}
+
+#ifdef OPENTOKEN_CYCLE_BENCH
+void sha256_alt_bench(void) {
+  static uint8_t data[32768];
+  static const size_t k_sizes[] = {64, 1024, 32768};
+  uint8_t out[32];
+
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)i;
+  for (size_t i = 0; i < sizeof(k_sizes) / sizeof(k_sizes[0]); i++) {
+    uint32_t cycles[2];
+    for (int sw = 0; sw < 2; sw++) {
+      g_force_software = sw;
+      uint32_t t0 = cycle_count_now();
+      mbedtls_sha256(data, k_sizes[i], out, 0);
+      cycles[sw] = cycle_count_now() - t0;
+    }
+    g_force_software = false;
+    printf("Bench: sha256 %u B %lu.%02lu cycles/B hardware, %lu.%02lu "
+           "software\n",
+           (unsigned)k_sizes[i],
+           (unsigned long)(cycles[0] / k_sizes[i]),
+           (unsigned long)(cycles[0] * 100 / k_sizes[i] % 100),
+           (unsigned long)(cycles[1] / k_sizes[i]),
+           (unsigned long)(cycles[1] * 100 / k_sizes[i] % 100));
+  }
+}
+#endif
+
+#endif // MBEDTLS_SHA256_ALT
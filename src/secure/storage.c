@@ -1,7 +1,13 @@
 #include "storage.h"
+#include "cycle_count.h"
 #include "error_handling.h"
 #include "hsm_layer.h"
+#include "storage_counter.h"
+#include "storage_flash.h"
+#include "storage_index.h"
+#include "storage_migrate.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,7 +16,6 @@
 // Pico SDK Headers
 #include "hardware/flash.h"
 #include "hardware/structs/otp.h" // For OTP access (RP2350 specific if avail, or stub)
-#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
 // MbedTLS
@@ -28,205 +33,2711 @@
 // Configuration
 // ----------------------------------------------------------------------------
 
-#ifndef PICO_FLASH_SIZE_BYTES
-#define PICO_FLASH_SIZE_BYTES (16 * 1024 * 1024) // Default to 16MB for Tenstar
+// Flash placement of the group and log regions: see storage_flash.h
+#define STORAGE_SEGMENT_COUNT (STORAGE_SIZE_BYTES / STORAGE_SEGMENT_SIZE_BYTES)
+#define STORAGE_SEGMENT_SECTORS (STORAGE_SEGMENT_SIZE_BYTES / FLASH_SECTOR_SIZE)
+#define STORAGE_NONCE_SIZE 12
+#define STORAGE_TAG_SIZE 16
+#define STORAGE_MAC_SIZE 32
+
+// Every entry is sealed on its own as
+// [storage_record_header_t] [ENCRYPTED ENTRY]
+// with its own nonce/tag. The cleartext part of the record header (type,
+// slot, length, seq) plus the generation of the sector holding it is the GCM
+// AAD, so a record only authenticates for the slot it was written for.
+// System and HSM entries are sealed as their structs. OATH and FIDO2 entries
+// use a packed encoding that only carries the used bytes of their names,
+// keys and IDs (see encode_entry()); a zero-length record is a deleted entry.
+//
+// GROUPS: live entries are kept in groups, one 4KB sector each plus a spare
+// copy:
+// [GROUP HEADER (1 page)] [RECORD] [RECORD] ... [erased]
+// The group header holds an HMAC over its fields and the sealed records.
+// Group 0 holds the system entry and the HSM keys; the OATH and FIDO2
+// sections each own a pool of groups. Which group of its pool a slot lives
+// in is kept in a RAM slot directory (rebuilt from the groups when the
+// section loads), and a slot only moves when its group runs out of bytes, so
+// capacity is bounded by the bytes entries actually use.
+//
+// LOG: changes since the last checkpoint, in one segment of the log ring:
+// [SEGMENT HEADER (1 page)] [RECORD] [RECORD] ... [erased]
+// Records are appended in batches (one per flush) that start on a fresh page.
+// Inside a batch records are packed; a page tail too short for a record
+// header is left erased, as is the end of the batch's last page. Each record
+// counts the records still to come in its batch, and replay applies a batch
+// only once it has found the record that closes it, so a flush (and with it
+// a transaction) is all or nothing across a torn append.
+//
+// The segment header is the checkpoint manifest: the generation of each
+// group copy and an HMAC chain over the group MACs in group order, so a
+// stale, missing or swapped group sector fails the whole checkpoint. It also
+// names its ring position and the ring/group geometry, so a header found in
+// another segment or written by a build with another flash layout is never
+// taken for a checkpoint.
+// A checkpoint reseals only the groups changed since the previous one into
+// their spare sectors, then programs the header of the next (pre-erased)
+// segment in ring order, which is always the oldest; that header page is the
+// commit point. Boot reads the segment headers once into a segment table,
+// picks the valid segment with the highest generation, loads the groups it
+// names and replays its log. Only the active segment is ever replayed, so
+// boot work and RAM do not grow with the size of the ring.
+//
+// IMPORT: an image written by older firmware (see storage_migrate.h) is
+// taken over by a freshly formatted store. Its STORAGE_VERSION stays in the
+// segment headers until every entry is flushed in this format, so an import
+// cut short by power loss resumes at the next boot.
+//
+// WEAR: the erase count of every storage area sector also travels in the
+// segment headers, after the manifest proper and outside the chain (it is
+// telemetry). A header carries one slice of the table, in turn by
+// generation, so the manifests left in the ring hold all of it; boot takes
+// the largest count found for each sector.
+//
+// SECTIONS: boot only checks the group headers against the manifest chain
+// and decrypts the system section (group 0: PIN data and HSM keys). The OATH
+// and FIDO2 groups are authenticated, decrypted and brought up to date from
+// the log the first time an applet touches them, so USB enumeration does not
+// wait for every credential to be decrypted.
+#define STORAGE_SEGMENT_MAGIC 0x534C4F47 // "SLOG"
+#define STORAGE_GROUP_MAGIC 0x53475250   // "SGRP"
+#define STORAGE_RECORD_MAGIC 0x5244      // "RD"
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t type; // storage_record_type_t
+  uint8_t slot;
+  uint16_t length; // Ciphertext bytes following this header
+  uint16_t batch_left; // Records after this one in its log batch
+  uint32_t seq; // Strictly increasing across the log
+  uint8_t nonce[STORAGE_NONCE_SIZE];
+  uint8_t tag[STORAGE_TAG_SIZE];
+} storage_record_header_t;
+
+#define STORAGE_RECORD_AAD_SIZE (offsetof(storage_record_header_t, nonce) + 4)
+
+typedef enum {
+  STORAGE_REC_SYSTEM = 1,
+  STORAGE_REC_OATH = 2,
+  STORAGE_REC_FIDO2 = 3,
+  STORAGE_REC_HSM_KEY = 4
+} storage_record_type_t;
+
+#define STORAGE_RECORD_SIZE(entry)                                             \
+  (sizeof(storage_record_header_t) + sizeof(entry))
+
+#define STORAGE_GROUP_PAYLOAD_SIZE (FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE)
+#define STORAGE_GROUPS_ALL ((uint32_t)((1ULL << STORAGE_GROUP_COUNT) - 1))
+#define STORAGE_GROUP_NONE 0xFF // Slot directory: entry not in any group
+
+// Erase counts per segment header, and headers needed for the whole table
+#define STORAGE_WEAR_SLICE 32
+#define STORAGE_WEAR_SLICES                                                    \
+  ((STORAGE_AREA_SECTORS + STORAGE_WEAR_SLICE - 1) / STORAGE_WEAR_SLICE)
+
+#define FIELD_SIZE(type, field) sizeof(((type *)0)->field)
+
+// Packed OATH entry: name_len, name, key_len, key, prop, type, digits,
+// counter, counter_handle
+#define STORAGE_OATH_PACKED_MAX                                                \
+  (1 + FIELD_SIZE(storage_oath_entry_t, name) + 1 +                            \
+   FIELD_SIZE(storage_oath_entry_t, key) + 3 + 4 + 2)
+// Packed FIDO2 entry: rp_id_hash, user_id_len, user_id, cred_id_len, cred_id,
+// priv_key, sign_count, flags, counter_handle
+#define STORAGE_FIDO2_PACKED_MAX                                               \
+  (FIELD_SIZE(storage_fido2_entry_t, rp_id_hash) + 1 +                         \
+   FIELD_SIZE(storage_fido2_entry_t, user_id) + 1 +                            \
+   FIELD_SIZE(storage_fido2_entry_t, cred_id) +                                \
+   FIELD_SIZE(storage_fido2_entry_t, priv_key) + 4 + 1 + 2)
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t generation;
+  uint32_t base_seq; // Records in this segment continue after this seq
+  uint16_t segment;  // Ring position this header was written for
+  uint8_t segment_count; // Ring and group geometry of the writing build
+  uint8_t group_count;
+  uint32_t group_generation[STORAGE_GROUP_COUNT]; // 0 = group never written
+  uint8_t chain[STORAGE_MAC_SIZE];
+  uint32_t import_version; // Older image being imported, or all ones
+  uint16_t wear_first;     // First sector of the wear slice, or all ones
+  uint32_t wear[STORAGE_WEAR_SLICE]; // Erase counts from wear_first on
+} storage_segment_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t version;
+  uint16_t group;
+  uint16_t records;
+  uint32_t generation;
+  uint32_t payload_size;         // Packed record bytes after the header page
+  uint8_t mac[STORAGE_MAC_SIZE]; // HMAC over the fields above and payload
+} storage_group_header_t;
+
+#define STORAGE_MAX_ENTRY_SIZE sizeof(storage_hsm_key_t)
+#define STORAGE_RECORD_MAX_SIZE                                                \
+  (sizeof(storage_record_header_t) + STORAGE_MAX_ENTRY_SIZE)
+
+_Static_assert(sizeof(storage_hsm_key_t) >= STORAGE_FIDO2_PACKED_MAX &&
+                   sizeof(storage_hsm_key_t) >= STORAGE_OATH_PACKED_MAX &&
+                   sizeof(storage_hsm_key_t) >= sizeof(storage_system_t),
+               "STORAGE_MAX_ENTRY_SIZE must cover every record type");
+_Static_assert(STORAGE_RECORD_MAX_SIZE <= FLASH_PAGE_SIZE,
+               "A log record must fit in a single flash page");
+_Static_assert(STORAGE_RECORD_SIZE(storage_system_t) +
+                       STORAGE_HSM_MAX_KEYS *
+                           STORAGE_RECORD_SIZE(storage_hsm_key_t) <=
+                   STORAGE_GROUP_PAYLOAD_SIZE,
+               "System entry and HSM keys must share group 0");
+_Static_assert(STORAGE_GROUP_COUNT <= 32 && STORAGE_OATH_GROUPS >= 1 &&
+                   STORAGE_FIDO2_GROUPS >= 1,
+               "Group masks are 32 bits; each pool needs a group");
+_Static_assert(sizeof(storage_segment_header_t) <= FLASH_PAGE_SIZE,
+               "Checkpoint manifest must fit the segment header page");
+_Static_assert(STORAGE_SEGMENT_COUNT > STORAGE_WEAR_SLICES,
+               "The manifests left in the ring must hold every wear slice");
+_Static_assert(STORAGE_OATH_MAX_ACCOUNTS <= 255 &&
+                   STORAGE_FIDO2_MAX_CREDS <= 255 && STORAGE_HSM_MAX_KEYS <= 255,
+               "Record headers hold an 8-bit slot");
+_Static_assert(STORAGE_COUNTER_MAX_HANDLES >=
+                   STORAGE_OATH_MAX_ACCOUNTS + STORAGE_FIDO2_MAX_CREDS,
+               "Every OATH/FIDO2 slot needs a counter handle");
+_Static_assert(STORAGE_SIZE_BYTES % STORAGE_SEGMENT_SIZE_BYTES == 0 &&
+                   STORAGE_SEGMENT_SIZE_BYTES % FLASH_SECTOR_SIZE == 0 &&
+                   STORAGE_SEGMENT_COUNT >= 2 && STORAGE_SEGMENT_COUNT <= 255,
+               "Log ring must hold 2 to 255 whole-sector segments");
+
+// Entry tables in record order
+static const struct {
+  uint8_t type;
+  uint8_t count;
+} k_tables[] = {{STORAGE_REC_SYSTEM, 1},
+                {STORAGE_REC_OATH, STORAGE_OATH_MAX_ACCOUNTS},
+                {STORAGE_REC_FIDO2, STORAGE_FIDO2_MAX_CREDS},
+                {STORAGE_REC_HSM_KEY, STORAGE_HSM_MAX_KEYS}};
+#define STORAGE_TABLE_COUNT (sizeof(k_tables) / sizeof(k_tables[0]))
+
+// The Decrypted Cache Structure (system section). OATH accounts and FIDO2
+// credentials go through the bounded entry cache below.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  storage_system_t system;
+  storage_hsm_key_t hsm_keys[STORAGE_HSM_MAX_KEYS];
+} storage_cache_t;
+
+// Global RAM Cache (Decrypted)
+static storage_cache_t g_cache;
+static bool g_dirty = false;
+static bool g_initialized = false;
+
+// Log state
+static uint32_t g_active_segment = 0;
+static uint32_t g_generation = 0;
+static uint32_t g_write_offset = 0; // Absolute flash offset of next record
+static uint32_t g_seq = 0;
+static bool g_log_damaged = false; // Force a checkpoint on the next write
+
+// Segment table: what each log segment's header page holds, read once at
+// boot and kept current as checkpoints move through the ring
+typedef enum {
+  STORAGE_SEG_ERASED,   // Header page erased
+  STORAGE_SEG_MANIFEST, // Checkpoint manifest for this layout (may be stale)
+  STORAGE_SEG_FOREIGN   // Torn or foreign header, or failed authentication
+} storage_segment_state_t;
+
+typedef struct {
+  uint32_t generation; // STORAGE_SEG_MANIFEST only
+  uint8_t state;       // storage_segment_state_t
+} storage_segment_info_t;
+
+static storage_segment_info_t g_segments[STORAGE_SEGMENT_COUNT];
+
+// Leading sectors of the next checkpoint segment known to be erased. The
+// main loop erases them ahead of time so a checkpoint only has to program.
+static uint32_t g_prepared_sectors = 0;
+
+// Checkpointed state of each group (as named by the active segment header)
+typedef struct {
+  uint32_t generation;
+  uint8_t copy; // Sector of the A/B pair holding this generation
+  uint8_t mac[STORAGE_MAC_SIZE];
+} storage_group_state_t;
+
+static storage_group_state_t g_groups[STORAGE_GROUP_COUNT];
+static uint32_t g_groups_dirty = 0;    // Changed since the last checkpoint
+static uint32_t g_groups_prepared = 0; // Dirty groups with an erased spare
+static uint32_t g_groups_staged = 0;   // Dirty groups already resealed
+
+// New state of each staged group: a copy in its spare sector that the next
+// segment header will name. Any change to the group discards it.
+static storage_group_state_t g_staged[STORAGE_GROUP_COUNT];
+
+// A group's contents changed: the next checkpoint reseals it
+static inline void touch_group(uint32_t group) {
+  g_groups_dirty |= 1u << group;
+  g_groups_staged &= ~(1u << group);
+}
+
+// Write-back state: slots changed since the last flush, per record type
+#define STORAGE_SLOT_WORDS                                                     \
+  (((STORAGE_OATH_MAX_ACCOUNTS > STORAGE_FIDO2_MAX_CREDS                       \
+         ? STORAGE_OATH_MAX_ACCOUNTS                                           \
+         : STORAGE_FIDO2_MAX_CREDS) +                                          \
+    31) /                                                                      \
+   32)
+static uint32_t g_pending[STORAGE_REC_HSM_KEY + 1][STORAGE_SLOT_WORDS];
+static bool g_pending_any = false;
+static uint32_t g_pending_since_ms = 0;
+static uint32_t g_writeback_window_ms = STORAGE_WRITEBACK_WINDOW_MS;
+
+static inline bool is_pending(uint8_t type, uint8_t slot) {
+  return (g_pending[type][slot / 32] >> (slot % 32)) & 1;
+}
+
+// Log accounting: length of each slot's newest record in the active segment
+// (0 = none) and the bytes of the older records those superseded
+static uint8_t g_log_len[STORAGE_REC_HSM_KEY + 1][STORAGE_SLOT_WORDS * 32];
+static uint32_t g_log_superseded = 0;
+
+_Static_assert(STORAGE_RECORD_MAX_SIZE <= UINT8_MAX,
+               "Log record lengths are accounted in 8 bits");
+
+static void note_log_record(uint8_t type, uint8_t slot, size_t len) {
+  g_log_superseded += g_log_len[type][slot];
+  g_log_len[type][slot] = (uint8_t)len;
+}
+
+static void reset_log_accounting(void) {
+  memset(g_log_len, 0, sizeof(g_log_len));
+  g_log_superseded = 0;
+}
+
+// Open transaction (see storage_txn_begin()): counter handles it allocated,
+// and handles whose release waits for it to commit
+static bool g_txn_open = false;
+static uint32_t g_txn_allocated[STORAGE_COUNTER_MAX_HANDLES / 32];
+static uint32_t g_txn_released[STORAGE_COUNTER_MAX_HANDLES / 32];
+
+// Release a counter handle no entry references any more. Inside a
+// transaction the entry may come back on abort, so its counter is kept until
+// the transaction commits.
+static void release_counter(uint16_t handle) {
+  if (g_txn_open && handle < STORAGE_COUNTER_MAX_HANDLES)
+    g_txn_released[handle / 32] |= 1u << (handle % 32);
+  else
+    storage_counter_free(handle);
+}
+
+// Import of an older image (see probe_import()). Until it is complete,
+// every call that reads or changes entries finishes it first.
+#define STORAGE_IMPORT_SLICE_BYTES 4096 // Image bytes per storage_task() call
+static uint32_t g_import_version = STORAGE_MIGRATE_NONE; // In progress
+static uint32_t g_manifest_import = STORAGE_MIGRATE_NONE; // As on flash
+static uint32_t g_erase_version = STORAGE_MIGRATE_NONE;   // Imported image
+static bool g_import_open = false;    // Stream started
+static bool g_import_running = false; // Entries are being saved
+static bool g_import_stalled = false; // Failed; retried at the next boot
+
+// Background compaction (see storage_task())
+static storage_maintenance_policy_t g_maintenance_policy = NULL;
+static bool g_compaction_stalled = false; // A slice failed; wait for a change
+static uint32_t g_compaction_slices = 0;
+static uint32_t g_compaction_checkpoints = 0;
+static uint32_t g_forced_checkpoints = 0;
+
+// Telemetry (see storage_get_telemetry()). The interrupts-off histogram is
+// kept by storage_flash.c.
+static storage_histogram_t g_hist[STORAGE_HIST_COUNT];
+static uint64_t g_bytes_encrypted = 0;
+
+typedef struct {
+  uint32_t t0_us;
+  uint64_t encrypted;
+  uint64_t programmed;
+} storage_write_mark_t;
+
+static uint8_t g_page_buf[FLASH_PAGE_SIZE];
+
+// FIDO2 credentials by rp_id_hash (rebuilt at init, kept current by setters)
+#define STORAGE_FIDO2_INDEX_BUCKETS 256
+_Static_assert((STORAGE_FIDO2_INDEX_BUCKETS &
+                (STORAGE_FIDO2_INDEX_BUCKETS - 1)) == 0 &&
+                   STORAGE_FIDO2_INDEX_BUCKETS >= 2 * STORAGE_FIDO2_MAX_CREDS,
+               "FIDO2 index: power of two, twice the credential count");
+
+static storage_index_bucket_t g_fido2_buckets[STORAGE_FIDO2_INDEX_BUCKETS];
+static storage_index_t g_fido2_index;
+
+// OATH accounts by name, and the free OATH slots (bit set = free)
+#define STORAGE_OATH_INDEX_BUCKETS 256
+_Static_assert((STORAGE_OATH_INDEX_BUCKETS &
+                (STORAGE_OATH_INDEX_BUCKETS - 1)) == 0 &&
+                   STORAGE_OATH_INDEX_BUCKETS >= 2 * STORAGE_OATH_MAX_ACCOUNTS,
+               "OATH index: power of two, twice the account count");
+
+static storage_index_bucket_t g_oath_buckets[STORAGE_OATH_INDEX_BUCKETS];
+static storage_index_t g_oath_index;
+static uint32_t g_oath_free[(STORAGE_OATH_MAX_ACCOUNTS + 31) / 32];
+
+// Entry cache. Every OATH/FIDO2 slot has a resident metadata entry; only a
+// pool of cache lines per kind holds decrypted entries. An entry's latest
+// record is in the checkpointed copy of its home group (at group_pos) or,
+// once flushed since the checkpoint, in the active log segment (at
+// log_offset). Entries are decrypted from there on a miss.
+#define STORAGE_META_ACTIVE 0x01 // Slot holds an entry
+#define STORAGE_META_LOGGED 0x02 // Latest record is in the log
+#define STORAGE_LINE_NONE 0xFF
+#define STORAGE_RP_PREFIX_SIZE 8
+
+typedef struct {
+  uint32_t log_offset; // STORAGE_META_LOGGED: flash offset of the record
+  uint16_t group_pos;  // Record offset in the payload of the home group
+  uint16_t size;       // Packed entry bytes
+  uint16_t counter_handle;
+  uint8_t flags; // STORAGE_META_*
+  uint8_t line;  // Cache line holding the entry, or STORAGE_LINE_NONE
+  uint8_t home;  // Group whose checkpointed copy holds the record
+  union {
+    uint32_t name_key;                         // OATH: index key of the name
+    uint8_t rp_prefix[STORAGE_RP_PREFIX_SIZE]; // FIDO2: rp_id_hash prefix
+  } id;
+} storage_slot_meta_t;
+
+static storage_slot_meta_t g_oath_meta[STORAGE_OATH_MAX_ACCOUNTS];
+static storage_slot_meta_t g_fido2_meta[STORAGE_FIDO2_MAX_CREDS];
+
+// Record offsets in the group copies being written by a checkpoint; they
+// become group_pos at the commit point
+static uint16_t g_oath_seal_pos[STORAGE_OATH_MAX_ACCOUNTS];
+static uint16_t g_fido2_seal_pos[STORAGE_FIDO2_MAX_CREDS];
+
+_Static_assert(STORAGE_OATH_CACHE_LINES >= 1 &&
+                   STORAGE_OATH_CACHE_LINES <= STORAGE_OATH_MAX_ACCOUNTS &&
+                   STORAGE_FIDO2_CACHE_LINES >= 1 &&
+                   STORAGE_FIDO2_CACHE_LINES <= STORAGE_FIDO2_MAX_CREDS,
+               "Cache lines: at least one, at most one per slot");
+
+static storage_oath_entry_t g_oath_lines[STORAGE_OATH_CACHE_LINES];
+static storage_fido2_entry_t g_fido2_lines[STORAGE_FIDO2_CACHE_LINES];
+static uint8_t g_oath_line_slot[STORAGE_OATH_CACHE_LINES];
+static uint8_t g_fido2_line_slot[STORAGE_FIDO2_CACHE_LINES];
+static uint8_t g_oath_line_ref[STORAGE_OATH_CACHE_LINES];
+static uint8_t g_fido2_line_ref[STORAGE_FIDO2_CACHE_LINES];
+
+// Lines of one kind. Eviction is CLOCK: a hit sets the line's reference bit,
+// the hand clears set bits as it sweeps and takes the first clear line.
+typedef struct {
+  uint8_t *slot;       // Slot held by each line, STORAGE_LINE_NONE if free
+  uint8_t *referenced; // Reference bit of each line
+  uint8_t lines;
+  uint8_t hand;
+  storage_cache_stats_t stats; // hits/misses/evictions
+} storage_line_pool_t;
+
+static storage_line_pool_t g_oath_pool = {g_oath_line_slot, g_oath_line_ref,
+                                          STORAGE_OATH_CACHE_LINES, 0, {0}};
+static storage_line_pool_t g_fido2_pool = {g_fido2_line_slot, g_fido2_line_ref,
+                                           STORAGE_FIDO2_CACHE_LINES, 0, {0}};
+
+// Decode target of OATH/FIDO2 records read from flash
+static union {
+  storage_oath_entry_t oath;
+  storage_fido2_entry_t fido2;
+} g_scratch;
+
+static inline uint32_t segment_offset(uint32_t segment) {
+  return STORAGE_OFFSET + segment * STORAGE_SEGMENT_SIZE_BYTES;
+}
+
+static inline uint32_t group_offset(uint32_t group, uint32_t copy) {
+  return STORAGE_GROUPS_OFFSET + (group * 2 + copy) * FLASH_SECTOR_SIZE;
+}
+
+static void derive_storage_key(const char *info, uint8_t *key_out) {
+  // Use RP2350 Unique Board ID to derive a device-specific key
+  pico_unique_board_id_t id;
+  pico_get_unique_board_id(&id);
+
+  // Derive key using HKDF-SHA256 of the board ID
+  const mbedtls_md_info_t *md_info =
+      mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  const char *salt = "OpenToken-Storage-Master-Salt-v1";
+
+  if (mbedtls_hkdf(md_info, (const unsigned char *)salt, strlen(salt), id.id, 8,
+                   (const unsigned char *)info, strlen(info), key_out,
+                   32) != 0) {
+    printf("Storage: HKDF Master Key derivation failed!\n");
+    // Fallback or panic
+  }
+}
+
+static void get_master_key(uint8_t *key_out) {
+  derive_storage_key("MasterStorageEncryptionKey", key_out);
+}
+
+static void get_mac_key(uint8_t *key_out) {
+  derive_storage_key("StorageGroupMacKey", key_out);
+}
+
+// Key contexts, set up on first use and kept for the device's lifetime so a
+// seal/open/MAC does not redo HKDF and the key expansion. Both are zeroized
+// by drop_key_contexts() on device reset.
+static mbedtls_gcm_context g_gcm;  // AES-256-GCM, master key
+static mbedtls_md_context_t g_hmac; // HMAC-SHA256, group MAC key
+static bool g_gcm_ready = false;
+static bool g_hmac_ready = false;
+
+// Cycle accounting for OPENTOKEN_CYCLE_BENCH builds: one-off cost of HKDF +
+// key setup per context, and how many operations each context served
+static uint32_t g_gcm_setup_cycles = 0;
+static uint32_t g_hmac_setup_cycles = 0;
+static uint32_t g_gcm_uses = 0;
+static uint32_t g_hmac_uses = 0;
+
+static mbedtls_gcm_context *storage_gcm(void) {
+  g_gcm_uses++;
+  if (g_gcm_ready)
+    return &g_gcm;
+
+  uint32_t t0 = cycle_count_now();
+  uint8_t key[32];
+  get_master_key(key);
+  mbedtls_gcm_init(&g_gcm);
+  int ret = mbedtls_gcm_setkey(&g_gcm, MBEDTLS_CIPHER_ID_AES, key, 256);
+  mbedtls_platform_zeroize(key, sizeof(key));
+  if (ret != 0) {
+    mbedtls_gcm_free(&g_gcm);
+    return NULL;
+  }
+  g_gcm_ready = true;
+  g_gcm_setup_cycles = cycle_count_now() - t0;
+  return &g_gcm;
+}
+
+// HMAC context ready for a new message
+static mbedtls_md_context_t *storage_hmac(void) {
+  g_hmac_uses++;
+  if (g_hmac_ready)
+    return mbedtls_md_hmac_reset(&g_hmac) == 0 ? &g_hmac : NULL;
+
+  uint32_t t0 = cycle_count_now();
+  uint8_t key[32];
+  get_mac_key(key);
+  mbedtls_md_init(&g_hmac);
+  int ret =
+      mbedtls_md_setup(&g_hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  if (ret == 0)
+    ret = mbedtls_md_hmac_starts(&g_hmac, key, sizeof(key));
+  mbedtls_platform_zeroize(key, sizeof(key));
+  if (ret != 0) {
+    mbedtls_md_free(&g_hmac);
+    return NULL;
+  }
+  g_hmac_ready = true;
+  g_hmac_setup_cycles = cycle_count_now() - t0;
+  return &g_hmac;
+}
+
+// Cycles spent in [t0, now) and the key setups avoided since the use counts
+// were sampled
+static void bench_report(const char *what, uint32_t t0, uint32_t gcm_uses0,
+                         uint32_t hmac_uses0) {
+#ifdef OPENTOKEN_CYCLE_BENCH
+  uint32_t cycles = cycle_count_now() - t0;
+  uint32_t gcm = g_gcm_uses - gcm_uses0;
+  uint32_t hmac = g_hmac_uses - hmac_uses0;
+  printf("Bench: %s %lu cycles, %lu GCM + %lu HMAC ops on cached keys "
+         "(~%lu cycles of key setup avoided)\n",
+         what, (unsigned long)cycles, (unsigned long)gcm, (unsigned long)hmac,
+         (unsigned long)(gcm * g_gcm_setup_cycles +
+                         hmac * g_hmac_setup_cycles));
+#else
+  (void)what;
+  (void)t0;
+  (void)gcm_uses0;
+  (void)hmac_uses0;
 #endif
+}
+
+static void drop_key_contexts(void) {
+  // Both free functions zeroize the key schedule / HMAC pads
+  if (g_gcm_ready)
+    mbedtls_gcm_free(&g_gcm);
+  if (g_hmac_ready)
+    mbedtls_md_free(&g_hmac);
+  g_gcm_ready = false;
+  g_hmac_ready = false;
+}
+
+static inline bool slot_valid(uint8_t type, uint8_t slot) {
+  for (size_t t = 0; t < STORAGE_TABLE_COUNT; t++) {
+    if (k_tables[t].type == type)
+      return slot < k_tables[t].count;
+  }
+  return false;
+}
+
+// Metadata / line pool of an OATH/FIDO2 slot; NULL for the system section
+static storage_slot_meta_t *slot_meta(uint8_t type, uint8_t slot) {
+  switch (type) {
+  case STORAGE_REC_OATH:
+    return &g_oath_meta[slot];
+  case STORAGE_REC_FIDO2:
+    return &g_fido2_meta[slot];
+  default:
+    return NULL;
+  }
+}
+
+static uint16_t *seal_pos(uint8_t type, uint8_t slot) {
+  if (type == STORAGE_REC_OATH)
+    return &g_oath_seal_pos[slot];
+  return &g_fido2_seal_pos[slot];
+}
+
+static storage_line_pool_t *line_pool(uint8_t type) {
+  return (type == STORAGE_REC_OATH) ? &g_oath_pool : &g_fido2_pool;
+}
+
+static void *line_entry(uint8_t type, uint8_t line) {
+  if (type == STORAGE_REC_OATH)
+    return &g_oath_lines[line];
+  return &g_fido2_lines[line];
+}
+
+static inline size_t entry_struct_size(uint8_t type) {
+  return (type == STORAGE_REC_OATH) ? sizeof(storage_oath_entry_t)
+                                    : sizeof(storage_fido2_entry_t);
+}
+
+static inline bool meta_active(uint8_t type, uint8_t slot) {
+  const storage_slot_meta_t *meta = slot_meta(type, slot);
+  return meta && (meta->flags & STORAGE_META_ACTIVE);
+}
+
+// Decrypted entry of an OATH/FIDO2 slot if it is cached, else NULL
+static void *cached_entry(uint8_t type, uint8_t slot) {
+  const storage_slot_meta_t *meta = slot_meta(type, slot);
+  if (!meta || meta->line == STORAGE_LINE_NONE)
+    return NULL;
+  return line_entry(type, meta->line);
+}
+
+// Longest record body a slot of `type` can have
+static size_t max_entry_len(uint8_t type) {
+  switch (type) {
+  case STORAGE_REC_SYSTEM:
+    return sizeof(storage_system_t);
+  case STORAGE_REC_OATH:
+    return STORAGE_OATH_PACKED_MAX;
+  case STORAGE_REC_FIDO2:
+    return STORAGE_FIDO2_PACKED_MAX;
+  default:
+    return sizeof(storage_hsm_key_t);
+  }
+}
+
+static inline uint8_t clamp_len(uint8_t len, size_t max) {
+  return len > max ? (uint8_t)max : len;
+}
+
+static size_t oath_packed_size(const storage_oath_entry_t *e) {
+  return 11 + clamp_len(e->name_len, sizeof(e->name)) +
+         clamp_len(e->key_len, sizeof(e->key));
+}
+
+static size_t fido2_packed_size(const storage_fido2_entry_t *e) {
+  return 73 + clamp_len(e->user_id_len, sizeof(e->user_id)) +
+         clamp_len(e->cred_id_len, sizeof(e->cred_id));
+}
+
+static uint8_t *put(uint8_t *p, const void *src, size_t len) {
+  memcpy(p, src, len);
+  return p + len;
+}
+
+static const uint8_t *get(const uint8_t *p, void *dst, size_t len) {
+  memcpy(dst, p, len);
+  return p + len;
+}
+
+// Serialize the current value of (type, slot) into out (at least
+// max_entry_len(type) bytes): the cached system entry / HSM key, or the
+// decrypted OATH/FIDO2 `entry` (NULL if the slot is not active, which
+// encodes to nothing). Returns the length.
+static size_t encode_entry(uint8_t type, uint8_t slot, const void *entry,
+                           uint8_t *out) {
+  uint8_t *p = out;
+  switch (type) {
+  case STORAGE_REC_SYSTEM:
+    return put(p, &g_cache.system, sizeof(storage_system_t)) - out;
+  case STORAGE_REC_HSM_KEY:
+    return put(p, &g_cache.hsm_keys[slot], sizeof(storage_hsm_key_t)) - out;
+  case STORAGE_REC_OATH: {
+    const storage_oath_entry_t *e = entry;
+    if (!e)
+      return 0;
+    uint8_t name_len = clamp_len(e->name_len, sizeof(e->name));
+    uint8_t key_len = clamp_len(e->key_len, sizeof(e->key));
+    *p++ = name_len;
+    p = put(p, e->name, name_len);
+    *p++ = key_len;
+    p = put(p, e->key, key_len);
+    *p++ = e->prop;
+    *p++ = e->type;
+    *p++ = e->digits;
+    p = put(p, &e->counter, sizeof(e->counter));
+    p = put(p, &e->counter_handle, sizeof(e->counter_handle));
+    return p - out;
+  }
+  case STORAGE_REC_FIDO2: {
+    const storage_fido2_entry_t *e = entry;
+    if (!e)
+      return 0;
+    uint8_t user_id_len = clamp_len(e->user_id_len, sizeof(e->user_id));
+    uint8_t cred_id_len = clamp_len(e->cred_id_len, sizeof(e->cred_id));
+    p = put(p, e->rp_id_hash, sizeof(e->rp_id_hash));
+    *p++ = user_id_len;
+    p = put(p, e->user_id, user_id_len);
+    *p++ = cred_id_len;
+    p = put(p, e->cred_id, cred_id_len);
+    p = put(p, e->priv_key, sizeof(e->priv_key));
+    p = put(p, &e->sign_count, sizeof(e->sign_count));
+    *p++ = e->flags;
+    p = put(p, &e->counter_handle, sizeof(e->counter_handle));
+    return p - out;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Inverse of encode_entry(): system entries and HSM keys go to the cache,
+// OATH/FIDO2 entries to g_scratch (zeroed if the record is a deletion).
+// Fails without touching either if the lengths inside do not add up.
+static bool decode_entry(uint8_t type, uint8_t slot, const uint8_t *in,
+                         size_t len) {
+  const uint8_t *p = in;
+  switch (type) {
+  case STORAGE_REC_SYSTEM:
+    if (len != sizeof(storage_system_t))
+      return false;
+    memcpy(&g_cache.system, in, len);
+    return true;
+  case STORAGE_REC_HSM_KEY:
+    if (len != sizeof(storage_hsm_key_t))
+      return false;
+    memcpy(&g_cache.hsm_keys[slot], in, len);
+    return true;
+  case STORAGE_REC_OATH: {
+    storage_oath_entry_t e = {0};
+    if (len > 0) {
+      if (len < 11 || (size_t)in[0] > sizeof(e.name) ||
+          (size_t)in[0] + 2 > len || (size_t)in[1 + in[0]] > sizeof(e.key) ||
+          len != 11 + (size_t)in[0] + in[1 + in[0]])
+        return false;
+      e.name_len = *p++;
+      p = get(p, e.name, e.name_len);
+      e.key_len = *p++;
+      p = get(p, e.key, e.key_len);
+      e.prop = *p++;
+      e.type = *p++;
+      e.digits = *p++;
+      p = get(p, &e.counter, sizeof(e.counter));
+      get(p, &e.counter_handle, sizeof(e.counter_handle));
+      e.active = 1;
+    }
+    g_scratch.oath = e;
+    mbedtls_platform_zeroize(&e, sizeof(e));
+    return true;
+  }
+  case STORAGE_REC_FIDO2: {
+    storage_fido2_entry_t e = {0};
+    const size_t user_at = sizeof(e.rp_id_hash);
+    if (len > 0) {
+      if (len < 73 || in[user_at] > sizeof(e.user_id) ||
+          user_at + 1 + in[user_at] + 1 > len ||
+          in[user_at + 1 + in[user_at]] > sizeof(e.cred_id) ||
+          len != 73 + (size_t)in[user_at] + in[user_at + 1 + in[user_at]])
+        return false;
+      p = get(p, e.rp_id_hash, sizeof(e.rp_id_hash));
+      e.user_id_len = *p++;
+      p = get(p, e.user_id, e.user_id_len);
+      e.cred_id_len = *p++;
+      p = get(p, e.cred_id, e.cred_id_len);
+      p = get(p, e.priv_key, sizeof(e.priv_key));
+      p = get(p, &e.sign_count, sizeof(e.sign_count));
+      e.flags = *p++;
+      get(p, &e.counter_handle, sizeof(e.counter_handle));
+      e.active = 1;
+    }
+    g_scratch.fido2 = e;
+    mbedtls_platform_zeroize(&e, sizeof(e));
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// Size of the record sealing the current value of (type, slot)
+static size_t record_size(uint8_t type, uint8_t slot) {
+  switch (type) {
+  case STORAGE_REC_SYSTEM:
+    return STORAGE_RECORD_SIZE(storage_system_t);
+  case STORAGE_REC_OATH:
+  case STORAGE_REC_FIDO2:
+    return sizeof(storage_record_header_t) +
+           (meta_active(type, slot) ? slot_meta(type, slot)->size : 0);
+  default:
+    return STORAGE_RECORD_SIZE(storage_hsm_key_t);
+  }
+}
+
+// Bytes the current value of an OATH/FIDO2 slot takes in its group, 0 if the
+// entry is not active (inactive entries are left out of groups)
+static size_t stored_size(uint8_t type, uint8_t slot) {
+  return meta_active(type, slot) ? record_size(type, slot) : 0;
+}
+
+// Slot directory (STORAGE_GROUP_NONE = not placed) and the record bytes
+// placed in each group
+static uint8_t g_oath_group[STORAGE_OATH_MAX_ACCOUNTS];
+static uint8_t g_fido2_group[STORAGE_FIDO2_MAX_CREDS];
+static uint16_t g_group_bytes[STORAGE_GROUP_COUNT];
+
+static uint8_t *slot_group(uint8_t type, uint8_t slot) {
+  switch (type) {
+  case STORAGE_REC_OATH:
+    return &g_oath_group[slot];
+  case STORAGE_REC_FIDO2:
+    return &g_fido2_group[slot];
+  default:
+    return NULL; // Fixed in group 0
+  }
+}
+
+static uint32_t group_of(uint8_t type, uint8_t slot) {
+  uint8_t *group = slot_group(type, slot);
+  return group ? *group : 0;
+}
+
+// Groups decrypted together on first use
+typedef enum {
+  STORAGE_SECTION_SYSTEM, // System entry and HSM keys, loaded at boot
+  STORAGE_SECTION_OATH,
+  STORAGE_SECTION_FIDO2,
+  STORAGE_SECTION_COUNT
+} storage_section_t;
+
+static const char *const k_section_names[STORAGE_SECTION_COUNT] = {
+    "system", "OATH", "FIDO2"};
+
+static uint32_t g_groups_loaded = 0;   // Groups whose entries are in the cache
+static uint32_t g_sections_logged = 0; // Sections with records in the log
+
+static uint32_t section_groups(storage_section_t section) {
+  switch (section) {
+  case STORAGE_SECTION_OATH:
+    return ((1u << STORAGE_OATH_GROUPS) - 1) << 1;
+  case STORAGE_SECTION_FIDO2:
+    return ((1u << STORAGE_FIDO2_GROUPS) - 1) << (1 + STORAGE_OATH_GROUPS);
+  default:
+    return 1u;
+  }
+}
+
+static storage_section_t section_of(uint8_t type) {
+  switch (type) {
+  case STORAGE_REC_OATH:
+    return STORAGE_SECTION_OATH;
+  case STORAGE_REC_FIDO2:
+    return STORAGE_SECTION_FIDO2;
+  default:
+    return STORAGE_SECTION_SYSTEM;
+  }
+}
+
+// Group of the pool for `type` with the most free bytes that still holds
+// `size`, other than `skip`. STORAGE_GROUP_NONE if every group is full.
+static uint8_t roomiest_group(uint8_t type, uint32_t skip, size_t size) {
+  uint32_t pool = section_groups(section_of(type));
+  uint8_t best = STORAGE_GROUP_NONE;
+  size_t best_free = 0;
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++) {
+    if (!((pool >> g) & 1) || g == skip)
+      continue;
+    size_t free_bytes = STORAGE_GROUP_PAYLOAD_SIZE - g_group_bytes[g];
+    if (size <= free_bytes &&
+        (best == STORAGE_GROUP_NONE || free_bytes > best_free)) {
+      best = (uint8_t)g;
+      best_free = free_bytes;
+    }
+  }
+  return best;
+}
+
+// Group for an OATH/FIDO2 entry whose stored size goes from old_size to
+// new_size: its current group while it still fits, else the roomiest other
+// group of its pool. STORAGE_GROUP_NONE if deleted or nothing has room.
+static uint8_t choose_group(uint8_t type, uint8_t slot, size_t old_size,
+                            size_t new_size) {
+  uint8_t from = *slot_group(type, slot);
+  if (new_size == 0)
+    return STORAGE_GROUP_NONE;
+  if (from != STORAGE_GROUP_NONE &&
+      g_group_bytes[from] - old_size + new_size <= STORAGE_GROUP_PAYLOAD_SIZE)
+    return from;
+  return roomiest_group(type, from, new_size);
+}
+
+// Record an entry's new group and size in the directory. The groups it
+// leaves and joins are resealed by the next checkpoint.
+static void place_entry(uint8_t type, uint8_t slot, size_t old_size,
+                        size_t new_size, uint8_t to) {
+  uint8_t *dir = slot_group(type, slot);
+  if (*dir != STORAGE_GROUP_NONE) {
+    g_group_bytes[*dir] -= old_size;
+    touch_group(*dir);
+  }
+  if (to != STORAGE_GROUP_NONE) {
+    g_group_bytes[to] += new_size;
+    touch_group(to);
+  }
+  *dir = to;
+}
+
+// A replayed log record changed an entry in place: account for its new size
+// in the group holding it. settle_section() handles overflows and entries
+// the log created.
+static void resize_entry(uint8_t type, uint8_t slot, size_t old_size) {
+  uint8_t *dir = slot_group(type, slot);
+  if (!dir) {
+    touch_group(0); // System entry / HSM key
+    return;
+  }
+  if (*dir == STORAGE_GROUP_NONE)
+    return;
+  size_t new_size = stored_size(type, slot);
+  g_group_bytes[*dir] = (uint16_t)(g_group_bytes[*dir] - old_size + new_size);
+  touch_group(*dir);
+  if (new_size == 0)
+    *dir = STORAGE_GROUP_NONE;
+}
+
+// Counter handle and value fields of a decrypted OATH/FIDO2 entry
+static uint16_t *handle_field(uint8_t type, void *entry) {
+  if (type == STORAGE_REC_OATH)
+    return &((storage_oath_entry_t *)entry)->counter_handle;
+  return &((storage_fido2_entry_t *)entry)->counter_handle;
+}
+
+static uint32_t *counter_field(uint8_t type, void *entry) {
+  if (type == STORAGE_REC_OATH)
+    return &((storage_oath_entry_t *)entry)->counter;
+  return &((storage_fido2_entry_t *)entry)->sign_count;
+}
+
+static uint16_t live_counter_handle(uint8_t type, uint8_t slot) {
+  return meta_active(type, slot) ? slot_meta(type, slot)->counter_handle
+                                 : STORAGE_COUNTER_NONE;
+}
+
+// Bring the counter handle and value of a decrypted copy of (type, slot) up
+// to date. Records sealed afterwards carry the value as a fallback should
+// the counter area be lost.
+static void refresh_counter(uint8_t type, uint8_t slot, void *entry) {
+  uint16_t handle = live_counter_handle(type, slot);
+  if (handle == STORAGE_COUNTER_NONE)
+    return;
+  *handle_field(type, entry) = handle;
+  storage_counter_read(handle, counter_field(type, entry));
+}
+
+// Pick the counter handle for an entry being saved with counter `value`.
+// The old handle is kept while the value only moves forward; a value that
+// went backwards (account re-provisioned) gets a fresh handle.
+static bool bind_counter(uint16_t old_handle, uint32_t value,
+                         uint16_t *handle_out) {
+  if (old_handle != STORAGE_COUNTER_NONE &&
+      storage_counter_advance(old_handle, value)) {
+    *handle_out = old_handle;
+    return true;
+  }
+
+  storage_counter_handle_t fresh;
+  if (!storage_counter_alloc(value, &fresh))
+    return false;
+  if (g_txn_open)
+    g_txn_allocated[fresh / 32] |= 1u << (fresh % 32);
+  release_counter(old_handle);
+  *handle_out = fresh;
+  return true;
+}
+
+static bool increment_counter(uint8_t type, uint8_t slot, uint32_t *value_out) {
+  uint16_t handle = live_counter_handle(type, slot);
+  uint32_t value;
+  if (handle == STORAGE_COUNTER_NONE)
+    return false;
+  if (!storage_counter_increment(handle, &value)) {
+    ERROR_REPORT_ERROR(ERROR_STORAGE_WRITE_FAILED,
+                       "Monotonic counter increment failed");
+    return false;
+  }
+  void *line = cached_entry(type, slot);
+  if (line)
+    *counter_field(type, line) = value;
+  if (value_out)
+    *value_out = value;
+  return true;
+}
+
+static bool storage_update(uint8_t type, uint8_t slot);
+static bool peek_entry(uint8_t type, uint8_t slot);
+
+// Re-attach the counters referenced by the entries of one table once it is
+// loaded. An entry whose counter is missing (counter area lost) restarts from
+// the value sealed in its last record and is written out again with its new
+// handle. Handles of tables not loaded yet stay reserved in the counter area
+// until they are claimed.
+static void claim_counters(uint8_t type, uint8_t count) {
+  // Claim everything first so a re-allocation cannot take a referenced handle
+  for (int pass = 0; pass < 2; pass++) {
+    for (uint8_t slot = 0; slot < count; slot++) {
+      storage_slot_meta_t *meta = slot_meta(type, slot);
+      uint32_t value;
+      if (!(meta->flags & STORAGE_META_ACTIVE))
+        continue;
+      if (pass == 0) {
+        storage_counter_claim(meta->counter_handle);
+        continue;
+      }
+      if (storage_counter_read(meta->counter_handle, &value))
+        continue;
+
+      void *line = cached_entry(type, slot);
+      if (line) {
+        value = *counter_field(type, line);
+      } else if (peek_entry(type, slot)) {
+        value = *counter_field(type, &g_scratch);
+        mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+      } else {
+        continue;
+      }
+      printf("Storage: Counter %u missing, restarting at %lu.\n",
+             meta->counter_handle, (unsigned long)value);
+      if (storage_counter_alloc(value, &meta->counter_handle))
+        storage_update(type, slot);
+    }
+  }
+}
+
+// AAD = cleartext record header fields + segment generation
+static void record_aad(const storage_record_header_t *hdr, uint32_t generation,
+                       uint8_t aad_out[STORAGE_RECORD_AAD_SIZE]) {
+  memcpy(aad_out, hdr, offsetof(storage_record_header_t, nonce));
+  memcpy(aad_out + offsetof(storage_record_header_t, nonce), &generation, 4);
+}
+
+// Seal the current value of (type, slot) into dst. An OATH/FIDO2 entry that
+// is not cached is decrypted from its current record (without taking a
+// cache line) and sealed again.
+// Returns the record size in bytes, 0 on failure.
+static size_t seal_record(uint8_t type, uint8_t slot, uint32_t seq,
+                          uint16_t batch_left, uint32_t generation,
+                          uint8_t *dst) {
+  if (!slot_valid(type, slot))
+    return 0;
+
+  void *current = NULL;
+  if (meta_active(type, slot)) {
+    current = cached_entry(type, slot);
+    if (!current && peek_entry(type, slot))
+      current = &g_scratch;
+    if (!current)
+      return 0;
+    refresh_counter(type, slot, current);
+  }
+
+  uint8_t entry[STORAGE_MAX_ENTRY_SIZE];
+  size_t entry_len = encode_entry(type, slot, current, entry);
+  if (current == (void *)&g_scratch)
+    mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+
+  storage_record_header_t hdr = {.magic = STORAGE_RECORD_MAGIC,
+                                 .type = type,
+                                 .slot = slot,
+                                 .length = (uint16_t)entry_len,
+                                 .batch_left = batch_left,
+                                 .seq = seq};
+
+  // Generate Nonce (Secure Random)
+  if (!hsm_get_random(hdr.nonce, STORAGE_NONCE_SIZE))
+    return 0;
+
+  uint8_t aad[STORAGE_RECORD_AAD_SIZE];
+  record_aad(&hdr, generation, aad);
+
+  mbedtls_gcm_context *ctx = storage_gcm();
+  if (!ctx)
+    return 0;
+
+  int ret = mbedtls_gcm_crypt_and_tag(
+      ctx, MBEDTLS_GCM_ENCRYPT, entry_len, hdr.nonce, STORAGE_NONCE_SIZE, aad,
+      sizeof(aad), entry, dst + sizeof(hdr), STORAGE_TAG_SIZE, hdr.tag);
+  mbedtls_platform_zeroize(entry, sizeof(entry));
+  if (ret != 0)
+    return 0;
+  g_bytes_encrypted += entry_len;
+
+  memcpy(dst, &hdr, sizeof(hdr));
+  return sizeof(hdr) + entry_len;
+}
+
+// Structural checks only (no authentication): magic, a known slot, a length
+// within that slot type's bound and the seq bound.
+// Returns the record size in bytes, 0 if the record is not well formed.
+static size_t parse_record(const uint8_t *src, size_t avail, uint32_t min_seq,
+                           storage_record_header_t *hdr_out) {
+  if (avail < sizeof(*hdr_out))
+    return 0;
+  memcpy(hdr_out, src, sizeof(*hdr_out));
+
+  if (hdr_out->magic != STORAGE_RECORD_MAGIC ||
+      !slot_valid(hdr_out->type, hdr_out->slot) ||
+      hdr_out->length > max_entry_len(hdr_out->type) ||
+      sizeof(*hdr_out) + hdr_out->length > avail ||
+      hdr_out->seq < min_seq)
+    return 0;
+  return sizeof(*hdr_out) + hdr_out->length;
+}
+
+// Authenticate and decrypt the record at src (see decode_entry() for where
+// it goes), or only authenticate it if `apply` is false.
+// Returns the record size in bytes, 0 if the record is not valid.
+static size_t open_record(const uint8_t *src, size_t avail, uint32_t generation,
+                          uint32_t min_seq, bool apply) {
+  storage_record_header_t hdr;
+  if (parse_record(src, avail, min_seq, &hdr) == 0)
+    return 0;
+
+  size_t entry_len = hdr.length;
+  uint8_t aad[STORAGE_RECORD_AAD_SIZE];
+  record_aad(&hdr, generation, aad);
+
+  // Decrypt to a scratch buffer first so a forged record cannot clobber
+  // the cached entry.
+  uint8_t plain[STORAGE_MAX_ENTRY_SIZE];
+  mbedtls_gcm_context *ctx = storage_gcm();
+  if (!ctx)
+    return 0;
+
+  int ret = mbedtls_gcm_auth_decrypt(ctx, entry_len, hdr.nonce,
+                                     STORAGE_NONCE_SIZE, aad, sizeof(aad),
+                                     hdr.tag, STORAGE_TAG_SIZE,
+                                     src + sizeof(hdr), plain);
+  if (ret == 0 && apply && !decode_entry(hdr.type, hdr.slot, plain, entry_len))
+    ret = -1;
+  mbedtls_platform_zeroize(plain, sizeof(plain));
+  return (ret == 0) ? sizeof(hdr) + entry_len : 0;
+}
+
+// Inactive entries are left out of a group; they load as zeroes
+static bool record_is_live(uint8_t type, uint8_t slot) {
+  switch (type) {
+  case STORAGE_REC_SYSTEM:
+    return true;
+  case STORAGE_REC_OATH:
+  case STORAGE_REC_FIDO2:
+    return meta_active(type, slot);
+  case STORAGE_REC_HSM_KEY:
+    return g_cache.hsm_keys[slot].active == 1;
+  default:
+    return false;
+  }
+}
+
+static inline uint32_t oath_name_key(const storage_oath_entry_t *entry) {
+  uint8_t len = entry->name_len;
+  if (len > sizeof(entry->name))
+    len = sizeof(entry->name);
+  return storage_index_name_key(entry->name, len);
+}
+
+// Decrypt the current record of an active OATH/FIDO2 slot into g_scratch
+// (caller zeroizes it). The record must authenticate for this very slot.
+static bool peek_entry(uint8_t type, uint8_t slot) {
+  const storage_slot_meta_t *meta = slot_meta(type, slot);
+  if (!meta || !(meta->flags & STORAGE_META_ACTIVE))
+    return false;
+
+  uint32_t offset, end, generation;
+  if (meta->flags & STORAGE_META_LOGGED) {
+    offset = meta->log_offset;
+    end = segment_offset(g_active_segment) + STORAGE_SEGMENT_SIZE_BYTES;
+    generation = g_generation;
+  } else {
+    if (meta->home >= STORAGE_GROUP_COUNT ||
+        g_groups[meta->home].generation == 0)
+      return false;
+    const storage_group_state_t *state = &g_groups[meta->home];
+    offset = group_offset(meta->home, state->copy) + FLASH_PAGE_SIZE;
+    end = offset + STORAGE_GROUP_PAYLOAD_SIZE;
+    offset += meta->group_pos;
+    generation = state->generation;
+  }
+  if (offset >= end || end - offset < sizeof(storage_record_header_t))
+    return false;
+
+  // Check the slot before decoding: decode_entry() writes system and HSM
+  // records straight into the cache
+  const uint8_t *src = storage_flash_ptr(offset);
+  storage_record_header_t hdr;
+  memcpy(&hdr, src, sizeof(hdr));
+  if (hdr.type != type || hdr.slot != slot || hdr.length != meta->size ||
+      open_record(src, end - offset, generation, 0, true) == 0)
+    return false;
+  return true;
+}
+
+// Release a line, wiping the entry it held
+static void drop_line(uint8_t type, uint8_t line) {
+  storage_line_pool_t *pool = line_pool(type);
+  if (pool->slot[line] != STORAGE_LINE_NONE)
+    slot_meta(type, pool->slot[line])->line = STORAGE_LINE_NONE;
+  mbedtls_platform_zeroize(line_entry(type, line), entry_struct_size(type));
+  pool->slot[line] = STORAGE_LINE_NONE;
+  pool->referenced[line] = 0;
+}
+
+static int free_line(uint8_t type) {
+  const storage_line_pool_t *pool = line_pool(type);
+  for (uint8_t l = 0; l < pool->lines; l++) {
+    if (pool->slot[l] == STORAGE_LINE_NONE)
+      return l;
+  }
+  return -1;
+}
+
+// A line to put an entry in: a free one, else the CLOCK victim. Lines of
+// entries with unflushed changes are never taken; if every line holds one,
+// the pending changes are flushed first. Returns -1 if that fails.
+static int take_line(uint8_t type) {
+  storage_line_pool_t *pool = line_pool(type);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int line = free_line(type);
+    if (line >= 0)
+      return line;
+
+    // Two turns of the hand: the first may only clear reference bits
+    for (uint32_t step = 0; step < 2u * pool->lines; step++) {
+      uint8_t l = pool->hand;
+      pool->hand = (uint8_t)((l + 1) % pool->lines);
+      if (is_pending(type, pool->slot[l]))
+        continue;
+      if (pool->referenced[l]) {
+        pool->referenced[l] = 0;
+        continue;
+      }
+      drop_line(type, l);
+      pool->stats.evictions++;
+      return l;
+    }
+    if (attempt == 0 && !storage_flush())
+      break;
+  }
+  return -1;
+}
+
+static void install_line(uint8_t type, uint8_t slot, uint8_t line,
+                         const void *entry) {
+  storage_line_pool_t *pool = line_pool(type);
+  memcpy(line_entry(type, line), entry, entry_struct_size(type));
+  pool->slot[line] = slot;
+  pool->referenced[line] = 1;
+  slot_meta(type, slot)->line = line;
+}
+
+// Decrypted entry of an active OATH/FIDO2 slot, decrypting it from flash
+// into a line on a miss. NULL if the slot is empty or the record does not
+// authenticate.
+static void *fetch_entry(uint8_t type, uint8_t slot) {
+  storage_slot_meta_t *meta = slot_meta(type, slot);
+  storage_line_pool_t *pool = line_pool(type);
+  if (!(meta->flags & STORAGE_META_ACTIVE))
+    return NULL;
+  if (meta->line != STORAGE_LINE_NONE) {
+    pool->referenced[meta->line] = 1;
+    pool->stats.hits++;
+    return line_entry(type, meta->line);
+  }
+
+  int line = take_line(type);
+  if (line < 0)
+    return NULL;
+  if (!peek_entry(type, slot)) {
+    mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+    ERROR_REPORT_ERROR(ERROR_STORAGE_CORRUPTION,
+                       "Storage entry failed authentication");
+    return NULL;
+  }
+  install_line(type, slot, (uint8_t)line, &g_scratch);
+  mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+  pool->stats.misses++;
+  return line_entry(type, (uint8_t)line);
+}
+
+// Slot is now empty: drop its line and metadata
+static void forget_entry(uint8_t type, uint8_t slot) {
+  storage_slot_meta_t *meta = slot_meta(type, slot);
+  if (meta->line != STORAGE_LINE_NONE)
+    drop_line(type, meta->line);
+  memset(meta, 0, sizeof(*meta));
+  meta->line = STORAGE_LINE_NONE;
+}
+
+// A record of (type, slot) with a `len`-byte body was decrypted into
+// g_scratch while loading its section. Take over its metadata, and its value
+// if the slot is cached or a line is still free (loading never evicts). The
+// caller records where the record is.
+static void absorb_entry(uint8_t type, uint8_t slot, size_t len) {
+  storage_slot_meta_t *meta = slot_meta(type, slot);
+  if (len == 0) {
+    forget_entry(type, slot);
+    return;
+  }
+
+  meta->flags = STORAGE_META_ACTIVE;
+  meta->size = (uint16_t)len;
+  meta->counter_handle = *handle_field(type, &g_scratch);
+  if (type == STORAGE_REC_OATH)
+    meta->id.name_key = oath_name_key(&g_scratch.oath);
+  else
+    memcpy(meta->id.rp_prefix, g_scratch.fido2.rp_id_hash,
+           STORAGE_RP_PREFIX_SIZE);
+
+  int line = (meta->line != STORAGE_LINE_NONE) ? meta->line : free_line(type);
+  if (line >= 0)
+    install_line(type, slot, (uint8_t)line, &g_scratch);
+  mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+}
+
+static uint8_t table_count(uint8_t type) {
+  for (size_t t = 0; t < STORAGE_TABLE_COUNT; t++) {
+    if (k_tables[t].type == type)
+      return k_tables[t].count;
+  }
+  return 0;
+}
+
+// Forget every OATH/FIDO2 entry of one kind: metadata and cache lines
+static void clear_entries(uint8_t type) {
+  storage_line_pool_t *pool = line_pool(type);
+  for (uint8_t l = 0; l < pool->lines; l++)
+    drop_line(type, l);
+  pool->hand = 0;
+  for (uint8_t slot = 0; slot < table_count(type); slot++)
+    forget_entry(type, slot);
+}
+
+static void reset_cache(void) {
+  memset(&g_cache, 0, sizeof(storage_cache_t));
+  g_cache.magic = STORAGE_MAGIC;
+  g_cache.version = STORAGE_VERSION;
+  clear_entries(STORAGE_REC_OATH);
+  clear_entries(STORAGE_REC_FIDO2);
+  memset(g_oath_group, STORAGE_GROUP_NONE, sizeof(g_oath_group));
+  memset(g_fido2_group, STORAGE_GROUP_NONE, sizeof(g_fido2_group));
+  memset(g_group_bytes, 0, sizeof(g_group_bytes));
+}
+
+// Drop whatever a failed load left of an OATH/FIDO2 section
+static void clear_section(storage_section_t section) {
+  if (section == STORAGE_SECTION_OATH) {
+    clear_entries(STORAGE_REC_OATH);
+    memset(g_oath_group, STORAGE_GROUP_NONE, sizeof(g_oath_group));
+  }
+  if (section == STORAGE_SECTION_FIDO2) {
+    clear_entries(STORAGE_REC_FIDO2);
+    memset(g_fido2_group, STORAGE_GROUP_NONE, sizeof(g_fido2_group));
+  }
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++) {
+    if ((section_groups(section) >> g) & 1)
+      g_group_bytes[g] = 0;
+  }
+}
+
+static inline void oath_mark_free(uint8_t slot, bool free) {
+  if (free)
+    g_oath_free[slot / 32] |= 1u << (slot % 32);
+  else
+    g_oath_free[slot / 32] &= ~(1u << (slot % 32));
+}
+
+// Rebuild the RAM lookup structures of a section from the slot metadata
+// (section load, format, reset)
+static void rebuild_indexes(storage_section_t section) {
+  if (section == STORAGE_SECTION_FIDO2) {
+    storage_index_init(&g_fido2_index, g_fido2_buckets,
+                       STORAGE_FIDO2_INDEX_BUCKETS);
+    for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
+      if (g_fido2_meta[i].flags & STORAGE_META_ACTIVE)
+        storage_index_insert(
+            &g_fido2_index,
+            storage_index_digest_key(g_fido2_meta[i].id.rp_prefix), i);
+    }
+  }
+
+  if (section == STORAGE_SECTION_OATH) {
+    storage_index_init(&g_oath_index, g_oath_buckets,
+                       STORAGE_OATH_INDEX_BUCKETS);
+    for (uint8_t i = 0; i < STORAGE_OATH_MAX_ACCOUNTS; i++) {
+      bool active = g_oath_meta[i].flags & STORAGE_META_ACTIVE;
+      oath_mark_free(i, !active);
+      if (active)
+        storage_index_insert(&g_oath_index, g_oath_meta[i].id.name_key, i);
+    }
+  }
+}
+
+// HMAC over a group header (up to its mac field) and its payload
+static bool group_mac(const storage_group_header_t *hdr, const uint8_t *payload,
+                      uint8_t mac_out[STORAGE_MAC_SIZE]) {
+  mbedtls_md_context_t *ctx = storage_hmac();
+  if (!ctx)
+    return false;
+
+  int ret = mbedtls_md_hmac_update(ctx, (const uint8_t *)hdr,
+                                   offsetof(storage_group_header_t, mac));
+  if (ret == 0 && hdr->payload_size > 0)
+    ret = mbedtls_md_hmac_update(ctx, payload, hdr->payload_size);
+  if (ret == 0)
+    ret = mbedtls_md_hmac_finish(ctx, mac_out);
+  return ret == 0;
+}
+
+// Manifest chain: c = HMAC(header fields), then c = HMAC(c || group MAC) for
+// every group in order. Groups that were never written contribute zeroes.
+static bool manifest_chain(const storage_segment_header_t *hdr,
+                           const storage_group_state_t *groups,
+                           uint8_t chain_out[STORAGE_MAC_SIZE]) {
+  uint8_t link[2 * STORAGE_MAC_SIZE];
+  mbedtls_md_context_t *ctx = storage_hmac();
+  if (!ctx)
+    return false;
+
+  int ret = mbedtls_md_hmac_update(ctx, (const uint8_t *)hdr,
+                                   offsetof(storage_segment_header_t, chain));
+  // The import field follows the chain and is only chained while set, so
+  // headers written before it existed still verify
+  if (ret == 0 && hdr->import_version != STORAGE_MIGRATE_NONE)
+    ret = mbedtls_md_hmac_update(
+        ctx, (const uint8_t *)hdr + offsetof(storage_segment_header_t,
+                                             import_version),
+        sizeof(uint32_t));
+  if (ret == 0)
+    ret = mbedtls_md_hmac_finish(ctx, link);
+  for (uint32_t g = 0; ret == 0 && g < STORAGE_GROUP_COUNT; g++) {
+    memcpy(link + STORAGE_MAC_SIZE, groups[g].mac, STORAGE_MAC_SIZE);
+    ctx = storage_hmac();
+    ret = ctx ? mbedtls_md_hmac_update(ctx, link, sizeof(link)) : -1;
+    if (ret == 0)
+      ret = mbedtls_md_hmac_finish(ctx, link);
+  }
+  memcpy(chain_out, link, STORAGE_MAC_SIZE);
+  return ret == 0;
+}
+
+// Find the copy of `group` holding `generation` from its header alone. The
+// header MAC is what the manifest chain covers; the payload is only checked
+// against it when the group is opened.
+static bool find_group(uint32_t group, uint32_t generation,
+                       storage_group_state_t *state) {
+  memset(state, 0, sizeof(*state));
+  if (generation == 0)
+    return true; // Never written: all slots empty
+
+  for (uint8_t copy = 0; copy < 2; copy++) {
+    storage_group_header_t hdr;
+    memcpy(&hdr, storage_flash_ptr(group_offset(group, copy)), sizeof(hdr));
+    if (hdr.magic != STORAGE_GROUP_MAGIC || hdr.version != STORAGE_VERSION ||
+        hdr.group != group || hdr.generation != generation ||
+        hdr.payload_size > STORAGE_GROUP_PAYLOAD_SIZE)
+      continue;
+
+    state->generation = generation;
+    state->copy = copy;
+    memcpy(state->mac, hdr.mac, STORAGE_MAC_SIZE);
+    return true;
+  }
+  return false;
+}
+
+// Authenticate the group copy found by find_group() and decrypt its records
+// into the cache (OATH/FIDO2: their metadata, and the entries while free
+// lines last), filing each OATH/FIDO2 slot under this group
+static bool open_group(uint32_t group, const storage_group_state_t *state) {
+  g_group_bytes[group] = 0;
+  if (state->generation == 0)
+    return true;
+
+  uint32_t offset = group_offset(group, state->copy);
+  storage_group_header_t hdr;
+  memcpy(&hdr, storage_flash_ptr(offset), sizeof(hdr));
+
+  const uint8_t *payload = storage_flash_ptr(offset + FLASH_PAGE_SIZE);
+  uint8_t mac[STORAGE_MAC_SIZE];
+  if (!group_mac(&hdr, payload, mac) ||
+      memcmp(mac, state->mac, STORAGE_MAC_SIZE) != 0)
+    return false;
+
+  size_t pos = 0;
+  for (uint16_t records = 0; records < hdr.records; records++) {
+    storage_record_header_t rec;
+    size_t len = open_record(payload + pos, hdr.payload_size - pos,
+                             hdr.generation, 0, true);
+    if (len == 0)
+      return false;
+    memcpy(&rec, payload + pos, sizeof(rec));
+    uint8_t *dir = slot_group(rec.type, rec.slot);
+    if (dir) {
+      absorb_entry(rec.type, rec.slot, rec.length);
+      slot_meta(rec.type, rec.slot)->home = (uint8_t)group;
+      slot_meta(rec.type, rec.slot)->group_pos = (uint16_t)pos;
+      *dir = (uint8_t)group;
+    }
+    g_group_bytes[group] += (uint16_t)len;
+    pos += len;
+  }
+  return true;
+}
+
+// Offset of the next record at or after `offset`: a page tail too short for a
+// record header, or left erased at the end of a batch, is padding
+static uint32_t skip_padding(uint32_t offset, uint32_t tail) {
+  uint32_t in_page = offset % FLASH_PAGE_SIZE;
+  if (offset < tail && in_page != 0 &&
+      (FLASH_PAGE_SIZE - in_page < sizeof(storage_record_header_t) ||
+       storage_flash_is_erased(offset, sizeof(uint16_t))))
+    return STORAGE_PAGE_ALIGN(offset);
+  return offset;
+}
+
+// Before the first record of a batch is applied, follow the headers of the
+// rest of it (from `offset`, just past `first`) to the record that closes
+// it. Records reaching into the last programmed page, where a torn append
+// ends, are authenticated as well.
+static bool batch_complete(uint32_t offset, uint32_t tail, uint32_t end,
+                           uint32_t generation,
+                           const storage_record_header_t *first) {
+  storage_record_header_t hdr = *first;
+  while (hdr.batch_left > 0) {
+    uint16_t left = hdr.batch_left;
+    uint32_t seq = hdr.seq;
+    offset = skip_padding(offset, tail);
+    if (offset >= tail)
+      return false;
+    const uint8_t *src = storage_flash_ptr(offset);
+    size_t len = parse_record(src, end - offset, seq + 1, &hdr);
+    if (len == 0 || hdr.batch_left != left - 1)
+      return false;
+    if (offset + len > tail - FLASH_PAGE_SIZE &&
+        open_record(src, end - offset, generation, seq + 1, false) == 0)
+      return false;
+    offset += len;
+  }
+  return true;
+}
+
+// Walk the log records of a segment. Records of the sections in
+// `open_sections` are authenticated and applied to the cache. The others are
+// only parsed, except those reaching into the last programmed page: a torn
+// append can only be there, so the end of the log is always authenticated at
+// boot. Records of a section that is not loaded yet are applied when it
+// loads.
+// Returns the offset where the log ends; *damaged_out is set if the walk
+// stopped at a bad record rather than at erased flash.
+static uint32_t walk_log(uint32_t segment,
+                         const storage_segment_header_t *seg_hdr,
+                         uint32_t open_sections, uint32_t *last_seq_out,
+                         uint32_t *sections_out, bool *damaged_out) {
+  uint32_t base = segment_offset(segment);
+  uint32_t offset = base + FLASH_PAGE_SIZE;
+  uint32_t end = base + STORAGE_SEGMENT_SIZE_BYTES;
+  uint32_t last_seq = seg_hdr->base_seq;
+
+  uint32_t tail = offset;
+  while (tail < end && !storage_flash_is_erased(tail, FLASH_PAGE_SIZE))
+    tail += FLASH_PAGE_SIZE;
+
+  *damaged_out = false;
+  *sections_out = 0;
+  reset_log_accounting(); // Every walk covers the whole log
+  uint16_t batch_left = 0;
+  while ((offset = skip_padding(offset, tail)) < tail) {
+    const uint8_t *src = storage_flash_ptr(offset);
+    storage_record_header_t hdr;
+    size_t len = parse_record(src, end - offset, last_seq + 1, &hdr);
+    if (len > 0 && batch_left == 0 &&
+        !batch_complete(offset + len, tail, end, seg_hdr->generation, &hdr))
+      len = 0; // Torn batch: none of it is applied
+    storage_section_t section =
+        (len > 0) ? section_of(hdr.type) : STORAGE_SECTION_SYSTEM;
+    bool apply = (open_sections >> section) & 1;
+    size_t old_size = 0;
+    if (len > 0 && apply && slot_group(hdr.type, hdr.slot))
+      old_size = stored_size(hdr.type, hdr.slot);
+    if (len > 0 && (apply || offset + len > tail - FLASH_PAGE_SIZE))
+      len = open_record(src, end - offset, seg_hdr->generation, last_seq + 1,
+                        apply);
+    if (len == 0) {
+      *damaged_out = true;
+      break;
+    }
+
+    if (apply && slot_meta(hdr.type, hdr.slot)) {
+      absorb_entry(hdr.type, hdr.slot, hdr.length);
+      if (hdr.length > 0) {
+        slot_meta(hdr.type, hdr.slot)->flags |= STORAGE_META_LOGGED;
+        slot_meta(hdr.type, hdr.slot)->log_offset = offset;
+      }
+    }
+    if (apply)
+      resize_entry(hdr.type, hdr.slot, old_size);
+    note_log_record(hdr.type, hdr.slot, len);
+    batch_left = hdr.batch_left;
+    last_seq = hdr.seq;
+    *sections_out |= 1u << section;
+    offset += len;
+  }
+
+  *last_seq_out = last_seq;
+  return offset;
+}
+
+// Rebuild the cache from a segment header and the log records that follow
+// it. Every group header must match the manifest chain; only the system
+// section is decrypted here, the rest is left to load_section(). Fails if
+// the chain or group 0 does not authenticate; a damaged log tail is only
+// truncated.
+static bool replay_segment(uint32_t segment,
+                           const storage_segment_header_t *seg_hdr) {
+  reset_cache();
+  g_log_damaged = false;
+  g_groups_dirty = 0;
+  g_groups_staged = 0;
+  g_groups_loaded = 0;
+
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++) {
+    if (!find_group(g, seg_hdr->group_generation[g], &g_groups[g])) {
+      printf("Storage: Group %lu missing.\n", (unsigned long)g);
+      return false;
+    }
+  }
+
+  uint8_t chain[STORAGE_MAC_SIZE];
+  if (!manifest_chain(seg_hdr, g_groups, chain) ||
+      memcmp(chain, seg_hdr->chain, STORAGE_MAC_SIZE) != 0) {
+    printf("Storage: Checkpoint manifest chain mismatch.\n");
+    return false;
+  }
+
+  uint32_t system = section_groups(STORAGE_SECTION_SYSTEM);
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++) {
+    if (((system >> g) & 1) && !open_group(g, &g_groups[g])) {
+      printf("Storage: Group %lu failed authentication.\n", (unsigned long)g);
+      return false;
+    }
+  }
+  g_groups_loaded = system;
+
+  bool damaged;
+  uint32_t offset =
+      walk_log(segment, seg_hdr, 1u << STORAGE_SECTION_SYSTEM, &g_seq,
+               &g_sections_logged, &damaged);
+  if (damaged) {
+    // Torn append (power loss) or corruption. Everything before it is
+    // intact; stop here and checkpoint on the next write.
+    printf("Storage: Damaged log record at 0x%08lx, truncating log.\n",
+           (unsigned long)offset);
+    g_log_damaged = true;
+    offset = segment_offset(segment) + STORAGE_SEGMENT_SIZE_BYTES;
+  }
+  g_write_offset = STORAGE_PAGE_ALIGN(offset);
+  return true;
+}
+
+// Give every active OATH/FIDO2 entry of a section a group with room: entries
+// the log created have none yet, and a group the log grew past its payload
+// gives entries up to the others. Fails if some entry fits nowhere; the
+// checkpoint is refused then and the log keeps the entry.
+static bool settle_section(storage_section_t section) {
+  bool ok = true;
+  for (size_t t = 0; t < STORAGE_TABLE_COUNT; t++) {
+    uint8_t type = k_tables[t].type;
+    if (section == STORAGE_SECTION_SYSTEM || section_of(type) != section)
+      continue;
+    for (uint8_t slot = 0; slot < k_tables[t].count; slot++) {
+      size_t size = stored_size(type, slot);
+      uint8_t from = *slot_group(type, slot);
+      if (size == 0 || (from != STORAGE_GROUP_NONE &&
+                        g_group_bytes[from] <= STORAGE_GROUP_PAYLOAD_SIZE))
+        continue;
+      uint8_t to = roomiest_group(type, from, size);
+      if (to == STORAGE_GROUP_NONE) {
+        ok = false;
+        continue;
+      }
+      place_entry(type, slot, size, size, to);
+    }
+  }
+  return ok;
+}
+
+// Decrypt a section on first use: authenticate and open its groups, apply
+// its records from the active log, then re-attach counters and rebuild its
+// index. A section that fails to authenticate stays unloaded and its calls
+// fail; its flash copy is left untouched.
+static bool load_section(storage_section_t section) {
+  uint32_t groups = section_groups(section) & ~g_groups_loaded;
+  if (groups == 0)
+    return true;
+  if (!g_initialized)
+    return false;
+
+  uint32_t bench_t0 = cycle_count_now();
+  uint32_t bench_gcm = g_gcm_uses, bench_hmac = g_hmac_uses;
+
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++) {
+    if (((groups >> g) & 1) && !open_group(g, &g_groups[g])) {
+      clear_section(section);
+      ERROR_REPORT_ERROR(ERROR_STORAGE_CORRUPTION,
+                         "Storage group failed authentication");
+      return false;
+    }
+  }
+
+  if (g_sections_logged & (1u << section)) {
+    storage_segment_header_t seg_hdr;
+    uint32_t last_seq, seen;
+    bool damaged;
+    memcpy(&seg_hdr, storage_flash_ptr(segment_offset(g_active_segment)),
+           sizeof(seg_hdr));
+    walk_log(g_active_segment, &seg_hdr, 1u << section, &last_seq, &seen,
+             &damaged);
+    if (damaged && !g_log_damaged) {
+      ERROR_REPORT_ERROR(ERROR_STORAGE_CORRUPTION,
+                         "Damaged log record in a lazily loaded section");
+      g_log_damaged = true; // Next write checkpoints past it
+    }
+    if (!settle_section(section))
+      ERROR_REPORT_ERROR(ERROR_STORAGE_FULL, "Replayed entries do not fit");
+  }
+
+  g_groups_loaded |= groups;
+  if (section == STORAGE_SECTION_OATH)
+    claim_counters(STORAGE_REC_OATH, STORAGE_OATH_MAX_ACCOUNTS);
+  if (section == STORAGE_SECTION_FIDO2)
+    claim_counters(STORAGE_REC_FIDO2, STORAGE_FIDO2_MAX_CREDS);
+  if (g_groups_loaded == STORAGE_GROUPS_ALL)
+    storage_counter_release_unclaimed();
+  rebuild_indexes(section);
+
+  bench_report("section load", bench_t0, bench_gcm, bench_hmac);
+  printf("Storage: Decrypted %s section on first use.\n",
+         k_section_names[section]);
+  return true;
+}
+
+// Load the sections with log records since the checkpoint (before a
+// checkpoint reseals their groups)
+static bool load_logged_sections(void) {
+  for (int s = 0; s < STORAGE_SECTION_COUNT; s++) {
+    if (((g_sections_logged >> s) & 1) && !load_section((storage_section_t)s))
+      return false;
+  }
+  return true;
+}
+
+static void await_import(void);
+
+static inline bool section_ready(storage_section_t section) {
+  await_import();
+  uint32_t groups = section_groups(section);
+  return (g_groups_loaded & groups) == groups || load_section(section);
+}
+
+// Fill the segment table from the segment header pages. Only a header
+// written for this ring position and flash layout counts as a manifest.
+static void scan_segments(void) {
+  for (uint32_t seg = 0; seg < STORAGE_SEGMENT_COUNT; seg++) {
+    storage_segment_header_t hdr;
+    memcpy(&hdr, storage_flash_ptr(segment_offset(seg)), sizeof(hdr));
+    g_segments[seg].generation = 0;
+    if (hdr.magic == STORAGE_SEGMENT_MAGIC && hdr.version == STORAGE_VERSION &&
+        hdr.segment == seg && hdr.segment_count == STORAGE_SEGMENT_COUNT &&
+        hdr.group_count == STORAGE_GROUP_COUNT) {
+      g_segments[seg].state = STORAGE_SEG_MANIFEST;
+      g_segments[seg].generation = hdr.generation;
+    } else if (storage_flash_is_erased(segment_offset(seg), FLASH_PAGE_SIZE)) {
+      g_segments[seg].state = STORAGE_SEG_ERASED;
+    } else {
+      g_segments[seg].state = STORAGE_SEG_FOREIGN;
+    }
+  }
+}
+
+// Carry the erase counts of the previous boots over from the wear slices of
+// the manifests found by scan_segments()
+static void restore_erase_counts(void) {
+  for (uint32_t first = 0; first < STORAGE_AREA_SECTORS;
+       first += STORAGE_WEAR_SLICE) {
+    uint32_t best[STORAGE_WEAR_SLICE] = {0};
+    for (uint32_t seg = 0; seg < STORAGE_SEGMENT_COUNT; seg++) {
+      const uint8_t *page = storage_flash_ptr(segment_offset(seg));
+      uint16_t wear_first;
+      memcpy(&wear_first,
+             page + offsetof(storage_segment_header_t, wear_first),
+             sizeof(wear_first));
+      if (g_segments[seg].state != STORAGE_SEG_MANIFEST || wear_first != first)
+        continue;
+      for (uint32_t i = 0; i < STORAGE_WEAR_SLICE; i++) {
+        uint32_t count;
+        memcpy(&count,
+               page + offsetof(storage_segment_header_t, wear) +
+                   i * sizeof(uint32_t),
+               sizeof(count));
+        if (count > best[i])
+          best[i] = count;
+      }
+    }
+    for (uint32_t i = 0; i < STORAGE_WEAR_SLICE; i++)
+      storage_flash_add_erase_count(first + i, best[i]);
+  }
+}
+
+// Segment holding the newest manifest not yet rejected, or -1
+static int newest_segment(void) {
+  int best = -1;
+  for (uint32_t seg = 0; seg < STORAGE_SEGMENT_COUNT; seg++) {
+    if (g_segments[seg].state == STORAGE_SEG_MANIFEST &&
+        (best < 0 || g_segments[seg].generation > g_segments[best].generation))
+      best = (int)seg;
+  }
+  return best;
+}
+
+// The ring is written in order, so the next segment holds the oldest data
+static inline uint32_t next_segment(void) {
+  return (g_active_segment + 1) % STORAGE_SEGMENT_COUNT;
+}
+
+// Erase sectors [first, last) of a segment. Sectors that already read as
+// erased are not erased again.
+static void erase_segment_sectors(uint32_t segment, uint32_t first,
+                                  uint32_t last) {
+  uint32_t base = segment_offset(segment);
+  for (uint32_t s = first; s < last; s++) {
+    uint32_t offset = base + s * FLASH_SECTOR_SIZE;
+    if (!storage_flash_is_erased(offset, FLASH_SECTOR_SIZE))
+      storage_flash_erase(offset, FLASH_SECTOR_SIZE);
+  }
+  if (first == 0 && last > 0) {
+    g_segments[segment].state = STORAGE_SEG_ERASED;
+    g_segments[segment].generation = 0;
+  }
+}
+
+// Make sure the first `sectors` sectors of the next segment are erased
+static void prepare_next_segment(uint32_t sectors) {
+  if (g_prepared_sectors >= sectors)
+    return;
+  erase_segment_sectors(next_segment(), g_prepared_sectors, sectors);
+  g_prepared_sectors = sectors;
+}
+
+static inline uint32_t now_ms(void) {
+  return to_ms_since_boot(get_absolute_time());
+}
+
+static inline uint32_t now_us(void) {
+  return (uint32_t)to_us_since_boot(get_absolute_time());
+}
+
+static void write_begin(storage_write_mark_t *mark) {
+  mark->t0_us = now_us();
+  mark->encrypted = g_bytes_encrypted;
+  mark->programmed = storage_flash_bytes_programmed();
+}
+
+// Duration of a flush/checkpoint, and what it sealed and programmed unless
+// a nested call recorded that already
+static void write_end(const storage_write_mark_t *mark,
+                      storage_histogram_id_t duration, bool bytes) {
+  storage_histogram_add(&g_hist[duration], now_us() - mark->t0_us);
+  if (!bytes)
+    return;
+  storage_histogram_add(&g_hist[STORAGE_HIST_ENCRYPTED_BYTES],
+                        (uint32_t)(g_bytes_encrypted - mark->encrypted));
+  storage_histogram_add(&g_hist[STORAGE_HIST_PROGRAMMED_BYTES],
+                        (uint32_t)(storage_flash_bytes_programmed() -
+                                   mark->programmed));
+}
+
+static void clear_pending(void) {
+  memset(g_pending, 0, sizeof(g_pending));
+  g_pending_any = false;
+}
+
+// Stage sealed bytes into g_page_buf, programming each page once it is full
+static void batch_emit(uint32_t *offset, uint32_t *fill, const uint8_t *data,
+                       size_t len) {
+  while (len > 0) {
+    size_t chunk = FLASH_PAGE_SIZE - *fill;
+    if (chunk > len)
+      chunk = len;
+    memcpy(g_page_buf + *fill, data, chunk);
+    *fill += chunk;
+    data += chunk;
+    len -= chunk;
+
+    if (*fill == FLASH_PAGE_SIZE) {
+      storage_flash_program(*offset, g_page_buf, FLASH_PAGE_SIZE);
+      memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+      *offset += FLASH_PAGE_SIZE;
+      *fill = 0;
+    }
+  }
+}
+
+// Append every pending entry to the active segment as one batch of packed
+// records. Returns false if the log has no room (caller checkpoints instead).
+static bool append_pending(void) {
+  static const uint8_t counts[] = {[STORAGE_REC_SYSTEM] = 1,
+                                   [STORAGE_REC_OATH] = STORAGE_OATH_MAX_ACCOUNTS,
+                                   [STORAGE_REC_FIDO2] = STORAGE_FIDO2_MAX_CREDS,
+                                   [STORAGE_REC_HSM_KEY] = STORAGE_HSM_MAX_KEYS};
+  uint32_t end = segment_offset(g_active_segment) + STORAGE_SEGMENT_SIZE_BYTES;
+  if (g_log_damaged)
+    return false;
+
+  // Worst case: every record also wastes a page tail shorter than a header
+  size_t needed = 0;
+  uint16_t records = 0;
+  for (uint8_t type = STORAGE_REC_SYSTEM; type <= STORAGE_REC_HSM_KEY; type++) {
+    for (uint8_t slot = 0; slot < counts[type]; slot++) {
+      if (is_pending(type, slot)) {
+        needed += sizeof(storage_record_header_t) + record_size(type, slot);
+        records++;
+      }
+    }
+  }
+  if (g_write_offset + STORAGE_PAGE_ALIGN(needed) > end)
+    return false;
+
+  uint8_t record[STORAGE_RECORD_MAX_SIZE];
+  uint32_t offset = g_write_offset;
+  uint32_t fill = 0;
+  uint32_t seq = g_seq;
+  bool ok = true;
+
+  memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+  for (uint8_t type = STORAGE_REC_SYSTEM; ok && type <= STORAGE_REC_HSM_KEY;
+       type++) {
+    for (uint8_t slot = 0; ok && slot < counts[type]; slot++) {
+      if (!is_pending(type, slot))
+        continue;
+
+      size_t len = seal_record(type, slot, seq + 1, --records, g_generation,
+                               record);
+      if (len == 0) {
+        ERROR_REPORT_ERROR(ERROR_CRYPTO_FAILURE,
+                           "Storage record encryption failed");
+        ok = false;
+        break;
+      }
+
+      // A record never starts in a page tail that cannot hold its header
+      if (FLASH_PAGE_SIZE - fill < sizeof(storage_record_header_t)) {
+        storage_flash_program(offset, g_page_buf, FLASH_PAGE_SIZE);
+        memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+        offset += FLASH_PAGE_SIZE;
+        fill = 0;
+      }
+      storage_slot_meta_t *meta = slot_meta(type, slot);
+      if (meta && (meta->flags & STORAGE_META_ACTIVE)) {
+        meta->flags |= STORAGE_META_LOGGED;
+        meta->log_offset = offset + fill;
+      }
+      batch_emit(&offset, &fill, record, len);
+      note_log_record(type, slot, len);
+      seq++;
+    }
+  }
+  if (fill > 0) {
+    storage_flash_program(offset, g_page_buf, FLASH_PAGE_SIZE);
+    offset += FLASH_PAGE_SIZE;
+  }
+
+  // A batch cut short is never applied at boot, and records appended after
+  // it would not be either: the next write checkpoints instead
+  g_write_offset = offset;
+  g_seq = seq;
+  if (!ok)
+    g_log_damaged = true;
+  return ok;
+}
+
+// Mark a changed entry for the next flush
+static bool storage_update(uint8_t type, uint8_t slot) {
+  if (!g_pending_any) {
+    g_pending_since_ms = now_ms();
+    g_pending_any = true;
+  }
+  g_pending[type][slot / 32] |= 1u << (slot % 32);
+  uint32_t group = group_of(type, slot);
+  if (group != STORAGE_GROUP_NONE)
+    touch_group(group);
+  g_compaction_stalled = false; // The change may have made room
+
+  if (g_writeback_window_ms == 0 && !g_txn_open)
+    return storage_flush();
+  return true;
+}
+
+// Sink of storage_migrate_step(): save an entry of the older image into the
+// same slot. Nothing else writes entries until the import is done, so a
+// slot that is already taken was imported before a power loss.
+static bool import_entry(storage_migrate_entry_t kind, uint8_t slot,
+                         const void *entry) {
+  switch (kind) {
+  case STORAGE_MIGRATE_ENTRY_SYSTEM:
+    return memcmp(&g_cache.system, entry, sizeof(storage_system_t)) == 0 ||
+           storage_save_pin_data(entry);
+  case STORAGE_MIGRATE_ENTRY_OATH:
+    return section_ready(STORAGE_SECTION_OATH) &&
+           (meta_active(STORAGE_REC_OATH, slot) ||
+            storage_save_oath_account(slot, entry));
+  case STORAGE_MIGRATE_ENTRY_FIDO2:
+    return section_ready(STORAGE_SECTION_FIDO2) &&
+           (meta_active(STORAGE_REC_FIDO2, slot) ||
+            storage_save_fido2_cred(slot, entry));
+  case STORAGE_MIGRATE_ENTRY_HSM_KEY:
+    return g_cache.hsm_keys[slot].active == 1 ||
+           storage_save_hsm_key(slot, entry);
+  }
+  return false;
+}
+
+// Look for an image written by older firmware. A fresh store takes it over;
+// one already in use only resumes the import its manifest names. An image
+// found next to a store that never imported it is left alone.
+static void probe_import(bool fresh) {
+  uint32_t version;
+  storage_migrate_probe_t found = storage_migrate_probe(&version);
+  if (found == STORAGE_MIGRATE_PRESENT &&
+      (fresh || g_import_version == version)) {
+    g_import_version = version;
+    printf("Storage: Importing version %lu image.\n", (unsigned long)version);
+    return;
+  }
+  if (found == STORAGE_MIGRATE_PRESENT)
+    printf("Storage: Version %lu image left in place (store in use).\n",
+           (unsigned long)version);
+  else if (found == STORAGE_MIGRATE_LEFTOVER)
+    g_erase_version = version; // Erase was cut short
+  g_import_version = STORAGE_MIGRATE_NONE;
+}
+
+// Import up to `budget` more bytes of the older image. Once every entry is
+// flushed the image's first sector is erased, which ends the import; the
+// rest is erased from storage_task(). An image that does not authenticate is
+// left in place and the next manifest stops naming it, unless the manifest
+// on flash already names it: then the import was under way, and the image
+// is what a power cut left of that first erase, so it is erased as well.
+static void import_slice(uint32_t budget) {
+  if (!g_import_open) {
+    uint8_t key[32];
+    get_master_key(key);
+    g_import_open = storage_migrate_begin(g_import_version, key);
+    mbedtls_platform_zeroize(key, sizeof(key));
+    if (!g_import_open) {
+      ERROR_REPORT_ERROR(ERROR_CRYPTO_FAILURE, "Storage import setup failed");
+      g_import_stalled = true;
+      return;
+    }
+  }
+
+  g_import_running = true;
+  storage_migrate_status_t status = storage_migrate_step(import_entry, budget);
+  g_import_running = false;
+  if (status == STORAGE_MIGRATE_MORE)
+    return;
+  storage_migrate_end();
+  g_import_open = false;
+
+  if (status == STORAGE_MIGRATE_REJECTED) {
+    if (g_manifest_import == g_import_version)
+      g_erase_version = g_import_version;
+    g_import_version = STORAGE_MIGRATE_NONE; // Gone from the next manifest
+    return;
+  }
+  if (status != STORAGE_MIGRATE_DONE || !storage_flush()) {
+    ERROR_REPORT_ERROR(ERROR_STORAGE_WRITE_FAILED,
+                       "Storage import could not be completed");
+    g_import_stalled = true;
+    return;
+  }
+  storage_migrate_erase_step(g_import_version);
+  printf("Storage: Version %lu image imported.\n",
+         (unsigned long)g_import_version);
+  g_erase_version = g_import_version;
+  g_import_version = STORAGE_MIGRATE_NONE;
+}
+
+static inline bool import_pending(void) {
+  return g_import_version != STORAGE_MIGRATE_NONE && !g_import_stalled;
+}
+
+// Finish the import before entries are read or changed. Not inside a
+// transaction: storage_txn_begin() already did.
+static void await_import(void) {
+  if (import_pending() && !g_import_running && !g_txn_open)
+    import_slice(UINT32_MAX);
+}
+
+// ----------------------------------------------------------------------------
+// Core Storage API
+// ----------------------------------------------------------------------------
+
+void storage_init(void) {
+  if (g_initialized)
+    return;
+
+  printf("Storage: Initializing Encrypted Storage...\n");
+
+  storage_counter_init();
+
+  uint32_t bench_t0 = cycle_count_now();
+  uint32_t bench_gcm = g_gcm_uses, bench_hmac = g_hmac_uses;
+
+  // Pick the valid segment with the highest generation, falling back to
+  // older manifests if it does not authenticate
+  scan_segments();
+  restore_erase_counts();
+  int best;
+  while ((best = newest_segment()) >= 0) {
+    storage_segment_header_t best_hdr;
+    memcpy(&best_hdr, storage_flash_ptr(segment_offset((uint32_t)best)),
+           sizeof(best_hdr));
+    if (replay_segment((uint32_t)best, &best_hdr)) {
+      g_active_segment = (uint32_t)best;
+      g_generation = best_hdr.generation;
+      g_manifest_import = best_hdr.import_version;
+      g_import_version = best_hdr.import_version;
+      probe_import(false);
+      printf("Storage: Loaded segment %d (generation %lu, seq %lu).\n", best,
+             (unsigned long)g_generation, (unsigned long)g_seq);
+      g_initialized = true;
+      bench_report("boot", bench_t0, bench_gcm, bench_hmac);
+      return;
+    }
+    printf("Storage: Segment %d failed authentication, trying older.\n", best);
+    g_segments[best].state = STORAGE_SEG_FOREIGN;
+  }
+
+  printf("Storage: No valid segment (First boot or key mismatch). "
+         "Formatting...\n");
+
+  // Format / Reset
+  reset_cache();
+
+  // Defaults
+  g_cache.system.retries_remaining = 3;
+  // PIN hashes would be set by user later
+
+  memset(g_groups, 0, sizeof(g_groups));
+  g_groups_loaded = STORAGE_GROUPS_ALL;
+  g_groups_dirty = STORAGE_GROUPS_ALL;
+  g_groups_staged = 0;
+  g_dirty = true;
+  g_initialized = true;
+  storage_counter_free_all(); // Nothing references the old counters
+  rebuild_indexes(STORAGE_SECTION_OATH);
+  rebuild_indexes(STORAGE_SECTION_FIDO2);
+  probe_import(true); // Named by the first manifest
+  storage_commit();
+}
 
-// Storage is at the very end of flash
-#define STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - STORAGE_SIZE_BYTES)
-#define STORAGE_NONCE_SIZE 12
-#define STORAGE_TAG_SIZE 16
+// Forget everything held in RAM, as a reset does: pending changes are lost
+// and the next storage_init() starts again from what is on flash. Settings
+// (write-back window, maintenance policy) go back to their defaults too.
+void storage_deinit(void) {
+  storage_migrate_end();
+  drop_key_contexts();
+  hsm_drop_key_contexts();
+  reset_cache();
+  storage_reset_cache_stats();
+  memset(g_oath_free, 0, sizeof(g_oath_free)); // Indexes: rebuilt on load
+  mbedtls_platform_zeroize(&g_scratch, sizeof(g_scratch));
+  mbedtls_platform_zeroize(g_page_buf, sizeof(g_page_buf));
 
-// Layout of the raw flash data
-// [NONCE (12)] [TAG (16)] [ENCRYPTED_DATA (Remainder)]
-#define STORAGE_HEADER_SIZE (STORAGE_NONCE_SIZE + STORAGE_TAG_SIZE)
-#define STORAGE_PAYLOAD_SIZE (STORAGE_SIZE_BYTES - STORAGE_HEADER_SIZE)
+  g_dirty = false;
+  g_initialized = false;
+  g_active_segment = 0;
+  g_generation = 0;
+  g_write_offset = 0;
+  g_seq = 0;
+  g_log_damaged = false;
+  memset(g_segments, 0, sizeof(g_segments));
+  g_prepared_sectors = 0;
+  memset(g_groups, 0, sizeof(g_groups));
+  memset(g_staged, 0, sizeof(g_staged));
+  g_groups_dirty = 0;
+  g_groups_prepared = 0;
+  g_groups_staged = 0;
+  g_groups_loaded = 0;
+  g_sections_logged = 0;
+  clear_pending();
+  g_pending_since_ms = 0;
+  g_writeback_window_ms = STORAGE_WRITEBACK_WINDOW_MS;
+  reset_log_accounting();
 
-// The Decrypted Cache Structure
-typedef struct __attribute__((packed)) {
-  uint32_t magic;
-  uint32_t version;
-  storage_system_t system;
-  storage_oath_entry_t oath_entries[STORAGE_OATH_MAX_ACCOUNTS];
-  storage_fido2_entry_t fido2_entries[STORAGE_FIDO2_MAX_CREDS];
-  storage_hsm_key_t hsm_keys[STORAGE_HSM_MAX_KEYS];
-  // Helper to fill the rest with zeros or future usage
-  uint8_t _padding[STORAGE_PAYLOAD_SIZE - 8 - sizeof(storage_system_t) -
-                   (sizeof(storage_oath_entry_t) * STORAGE_OATH_MAX_ACCOUNTS) -
-                   (sizeof(storage_fido2_entry_t) * STORAGE_FIDO2_MAX_CREDS) -
-                   (sizeof(storage_hsm_key_t) * STORAGE_HSM_MAX_KEYS)];
-} storage_cache_t;
+  g_txn_open = false;
+  memset(g_txn_allocated, 0, sizeof(g_txn_allocated));
+  memset(g_txn_released, 0, sizeof(g_txn_released));
+  g_import_version = STORAGE_MIGRATE_NONE;
+  g_manifest_import = STORAGE_MIGRATE_NONE;
+  g_erase_version = STORAGE_MIGRATE_NONE;
+  g_import_open = false;
+  g_import_running = false;
+  g_import_stalled = false;
 
-// Compile-time check to ensure cache fits in payload
-_Static_assert(sizeof(storage_cache_t) <= STORAGE_PAYLOAD_SIZE,
-               "Storage cache exceeds allocated payload size!");
+  g_maintenance_policy = NULL;
+  g_compaction_stalled = false;
+  g_compaction_slices = 0;
+  g_compaction_checkpoints = 0;
+  g_forced_checkpoints = 0;
+  memset(g_hist, 0, sizeof(g_hist));
+  g_bytes_encrypted = 0;
+}
 
-// Global RAM Cache (Decrypted)
-static storage_cache_t g_cache;
-static bool g_dirty = false;
-static bool g_initialized = false;
+// Erase the spare sector of a group unless it already reads as erased
+static void prepare_group_spare(uint32_t group) {
+  uint32_t spare = group_offset(group, g_groups[group].copy ^ 1);
+  if (g_groups[group].generation == 0)
+    spare = group_offset(group, 0);
+  if (!storage_flash_is_erased(spare, FLASH_SECTOR_SIZE))
+    storage_flash_erase(spare, FLASH_SECTOR_SIZE);
+  g_groups_prepared |= 1u << group;
+}
 
-static void get_master_key(uint8_t *key_out) {
-  // Use RP2350 Unique Board ID to derive a device-specific key
-  pico_unique_board_id_t id;
-  pico_get_unique_board_id(&id);
+// Reseal every live entry of a group into its spare sector. `state` is the
+// group's checkpointed state on entry and its new state on success.
+// Streaming: the header fields are known up front, so each record is sealed,
+// fed to the group MAC and staged into the page buffer, and every page is
+// programmed as soon as it fills. The header page (with the MAC) goes last.
+static bool seal_group(uint32_t group, storage_group_state_t *state) {
+  storage_group_header_t hdr = {.magic = STORAGE_GROUP_MAGIC,
+                                .version = STORAGE_VERSION,
+                                .group = (uint16_t)group,
+                                .records = 0,
+                                .generation = state->generation + 1,
+                                .payload_size = 0};
 
-  // Derive key using HKDF-SHA256 of the board ID
-  const mbedtls_md_info_t *md_info =
-      mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-  const char *salt = "OpenToken-Storage-Master-Salt-v1";
-  const char *info = "MasterStorageEncryptionKey";
+  for (size_t t = 0; t < STORAGE_TABLE_COUNT; t++) {
+    for (uint8_t slot = 0; slot < k_tables[t].count; slot++) {
+      if (group_of(k_tables[t].type, slot) != group ||
+          !record_is_live(k_tables[t].type, slot))
+        continue;
+      hdr.payload_size += record_size(k_tables[t].type, slot);
+      hdr.records++;
+    }
+  }
+  if (hdr.payload_size > STORAGE_GROUP_PAYLOAD_SIZE)
+    return false; // Placement bug; keep the old copy and the log
 
-  if (mbedtls_hkdf(md_info, (const unsigned char *)salt, strlen(salt), id.id, 8,
-                   (const unsigned char *)info, strlen(info), key_out,
-                   32) != 0) {
-    printf("Storage: HKDF Master Key derivation failed!\n");
-    // Fallback or panic
+  if (!(g_groups_prepared & (1u << group)))
+    prepare_group_spare(group);
+
+  mbedtls_md_context_t *mac = storage_hmac();
+  if (!mac || mbedtls_md_hmac_update(mac, (const uint8_t *)&hdr,
+                                     offsetof(storage_group_header_t, mac)))
+    return false;
+
+  uint8_t copy = (state->generation == 0) ? 0 : state->copy ^ 1;
+  uint32_t offset = group_offset(group, copy);
+  uint32_t page = offset + FLASH_PAGE_SIZE;
+  uint32_t fill = 0;
+  uint32_t written = 0;
+  uint8_t record[STORAGE_RECORD_MAX_SIZE];
+
+  memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+  for (size_t t = 0; t < STORAGE_TABLE_COUNT; t++) {
+    for (uint8_t slot = 0; slot < k_tables[t].count; slot++) {
+      if (group_of(k_tables[t].type, slot) != group ||
+          !record_is_live(k_tables[t].type, slot))
+        continue;
+
+      size_t len = seal_record(k_tables[t].type, slot, g_seq, 0,
+                               hdr.generation, record);
+      if (len == 0 || written + len > hdr.payload_size ||
+          mbedtls_md_hmac_update(mac, record, len) != 0)
+        return false;
+      if (slot_meta(k_tables[t].type, slot))
+        *seal_pos(k_tables[t].type, slot) = (uint16_t)written;
+      batch_emit(&page, &fill, record, len);
+      written += len;
+    }
   }
-}
+  if (fill > 0)
+    storage_flash_program(page, g_page_buf, FLASH_PAGE_SIZE);
+  if (written != hdr.payload_size ||
+      mbedtls_md_hmac_finish(mac, hdr.mac) != 0)
+    return false;
 
-static bool decrypt_storage(const uint8_t *src, storage_cache_t *dst) {
-  mbedtls_gcm_context ctx;
-  mbedtls_gcm_init(&ctx);
+  memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+  memcpy(g_page_buf, &hdr, sizeof(hdr));
+  storage_flash_program(offset, g_page_buf, FLASH_PAGE_SIZE);
 
-  uint8_t key[32];
-  get_master_key(key);
+  state->generation = hdr.generation;
+  state->copy = copy;
+  memcpy(state->mac, hdr.mac, STORAGE_MAC_SIZE);
+  return true;
+}
 
-  int ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
-  if (ret != 0) {
-    mbedtls_gcm_free(&ctx);
+// Reseal a changed group into its spare sector ahead of the checkpoint. The
+// copy stays unreferenced until the next segment header names it, so a crash
+// before then loses nothing; a later change to the group discards it.
+static bool stage_group(uint32_t group) {
+  storage_group_state_t state = g_groups[group];
+  bool ok = seal_group(group, &state);
+  g_groups_prepared &= ~(1u << group); // Spare written, even if only partly
+  if (!ok)
     return false;
+  g_staged[group] = state;
+  g_groups_staged |= 1u << group;
+  return true;
+}
+
+// The groups in `resealed` now hold new copies: point their entries at the
+// records seal_group() wrote. Nothing is left in the log after a checkpoint.
+static void rehome_entries(uint32_t resealed) {
+  for (uint8_t type = STORAGE_REC_OATH; type <= STORAGE_REC_FIDO2; type++) {
+    for (uint8_t slot = 0; slot < table_count(type); slot++) {
+      storage_slot_meta_t *meta = slot_meta(type, slot);
+      uint32_t group = group_of(type, slot);
+      if (!(meta->flags & STORAGE_META_ACTIVE))
+        continue;
+      if (group != STORAGE_GROUP_NONE && ((resealed >> group) & 1)) {
+        meta->home = (uint8_t)group;
+        meta->group_pos = *seal_pos(type, slot);
+      }
+      meta->flags &= ~STORAGE_META_LOGGED;
+    }
+  }
+}
+
+// Checkpoint: reseal the groups changed since the last checkpoint, then start
+// the next log segment with a manifest naming the current group copies
+void storage_commit(void) {
+  if (!g_dirty || g_txn_open)
+    return;
+
+  uint32_t bench_t0 = cycle_count_now();
+  uint32_t bench_gcm = g_gcm_uses, bench_hmac = g_hmac_uses;
+  storage_write_mark_t mark;
+  write_begin(&mark);
+
+  printf("Storage: Encrypting and Committing changed groups...\n");
+
+  // Groups are resealed from the cache, so changed sections must be loaded
+  // and every active entry must have a group
+  if (!load_logged_sections())
+    return;
+  for (int s = STORAGE_SECTION_OATH; s < STORAGE_SECTION_COUNT; s++) {
+    if (!settle_section((storage_section_t)s)) {
+      ERROR_REPORT_ERROR(ERROR_STORAGE_FULL, "Storage groups out of room");
+      return;
+    }
+  }
+
+  // Work on a copy: the active manifest keeps naming the old group sectors
+  // until the new segment header is on flash. Groups compaction resealed
+  // already are only named.
+  storage_group_state_t groups[STORAGE_GROUP_COUNT];
+  memcpy(groups, g_groups, sizeof(groups));
+  uint32_t resealed = 0;
+  bool ok = true;
+
+  for (uint32_t g = 0; ok && g < STORAGE_GROUP_COUNT; g++) {
+    if (!(g_groups_dirty & (1u << g)))
+      continue;
+    if (!(g_groups_staged & (1u << g)))
+      ok = stage_group(g);
+    groups[g] = g_staged[g];
+    resealed++;
   }
 
-  const uint8_t *nonce = src;
-  const uint8_t *tag = src + STORAGE_NONCE_SIZE;
-  const uint8_t *ciphertext = src + STORAGE_HEADER_SIZE;
+  uint32_t target = next_segment();
+  uint32_t target_offset = segment_offset(target);
+  storage_segment_header_t hdr = {.magic = STORAGE_SEGMENT_MAGIC,
+                                  .version = STORAGE_VERSION,
+                                  .generation = g_generation + 1,
+                                  .base_seq = g_seq,
+                                  .segment = (uint16_t)target,
+                                  .segment_count = STORAGE_SEGMENT_COUNT,
+                                  .group_count = STORAGE_GROUP_COUNT,
+                                  .import_version = g_import_version,
+                                  .wear_first = 0xFFFF};
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++)
+    hdr.group_generation[g] = groups[g].generation;
 
-  // Authenticated Decryption
-  ret = mbedtls_gcm_auth_decrypt(
-      &ctx, STORAGE_PAYLOAD_SIZE, nonce, STORAGE_NONCE_SIZE, NULL, 0, // No AAD
-      tag, STORAGE_TAG_SIZE, ciphertext, (uint8_t *)dst);
+  if (!ok || !manifest_chain(&hdr, groups, hdr.chain)) {
+    ERROR_REPORT_ERROR(ERROR_CRYPTO_FAILURE, "Storage encryption failed");
+    return;
+  }
+
+  // Header page of the next segment is the commit point. Usually the main
+  // loop has pre-erased that segment already.
+  prepare_next_segment(STORAGE_SEGMENT_SECTORS);
+  hdr.wear_first =
+      (uint16_t)(hdr.generation % STORAGE_WEAR_SLICES * STORAGE_WEAR_SLICE);
+  for (uint32_t i = 0; i < STORAGE_WEAR_SLICE; i++)
+    hdr.wear[i] = storage_flash_erase_count(hdr.wear_first + i);
+  memset(g_page_buf, 0xFF, sizeof(g_page_buf));
+  memcpy(g_page_buf, &hdr, sizeof(hdr));
+  storage_flash_program(target_offset, g_page_buf, FLASH_PAGE_SIZE);
 
-  mbedtls_platform_zeroize(key, 32);
-  mbedtls_gcm_free(&ctx);
-  return (ret == 0);
+  g_segments[target].state = STORAGE_SEG_MANIFEST;
+  g_segments[target].generation = hdr.generation;
+  g_manifest_import = hdr.import_version;
+  memcpy(g_groups, groups, sizeof(groups));
+  rehome_entries(g_groups_dirty);
+  g_groups_dirty = 0;
+  g_groups_staged = 0;
+  g_sections_logged = 0;
+  reset_log_accounting();
+  g_active_segment = target;
+  g_prepared_sectors = 0; // Next in the ring: the oldest segment
+  g_generation = hdr.generation;
+  g_write_offset = target_offset + FLASH_PAGE_SIZE;
+  g_log_damaged = false;
+  g_compaction_stalled = false;
+  g_dirty = false;
+  clear_pending(); // The groups carry every pending change
+  bench_report("commit", bench_t0, bench_gcm, bench_hmac);
+  write_end(&mark, STORAGE_HIST_CHECKPOINT_US, true);
+  printf("Storage: Commit Complete (segment %lu, generation %lu, %lu of %u "
+         "groups resealed).\n",
+         (unsigned long)target, (unsigned long)g_generation,
+         (unsigned long)resealed, (unsigned)STORAGE_GROUP_COUNT);
 }
 
-static bool encrypt_storage(const storage_cache_t *src, uint8_t *dst) {
-  mbedtls_gcm_context ctx;
-  mbedtls_gcm_init(&ctx);
+bool storage_flush(void) {
+  if (g_txn_open)
+    return false; // Only storage_txn_commit() writes a transaction's changes
+  if (!g_pending_any)
+    return true;
 
-  uint8_t key[32];
-  get_master_key(key);
+  uint32_t bench_t0 = cycle_count_now();
+  uint32_t bench_gcm = g_gcm_uses, bench_hmac = g_hmac_uses;
+  storage_write_mark_t mark;
+  write_begin(&mark);
+  if (append_pending()) {
+    clear_pending();
+    bench_report("flush", bench_t0, bench_gcm, bench_hmac);
+    write_end(&mark, STORAGE_HIST_FLUSH_US, true);
+    return true;
+  }
 
-  int ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
-  if (ret != 0) {
-    mbedtls_gcm_free(&ctx);
+  // Log full or damaged: checkpoint into the next segment instead
+  g_dirty = true;
+  storage_commit();
+  write_end(&mark, STORAGE_HIST_FLUSH_US, false);
+  if (g_dirty) {
+    g_pending_since_ms = now_ms(); // Retry after another window
     return false;
   }
+  g_forced_checkpoints++;
+  return true;
+}
 
-  uint8_t *nonce = dst;
-  uint8_t *tag = dst + STORAGE_NONCE_SIZE;
-  uint8_t *ciphertext = dst + STORAGE_HEADER_SIZE;
+// Bytes of the active log segment in use
+static inline uint32_t log_used(void) {
+  return g_write_offset - segment_offset(g_active_segment) - FLASH_PAGE_SIZE;
+}
 
-  // Generate Nonce (Secure Random)
-  if (!hsm_get_random(nonce, STORAGE_NONCE_SIZE)) {
-    mbedtls_platform_zeroize(key, 32);
-    mbedtls_gcm_free(&ctx);
+static inline bool compaction_due(void) {
+  // A manifest naming an import that is over would let a later image of
+  // that version (a downgrade and upgrade again) resume it
+  if (g_manifest_import != g_import_version)
+    return true;
+  return log_used() > 0 &&
+         log_used() * 100u >= (STORAGE_SEGMENT_SIZE_BYTES - FLASH_PAGE_SIZE) *
+                                   STORAGE_COMPACT_THRESHOLD_PCT;
+}
+
+// One slice of background compaction: decrypt a section that has log
+// records, erase one spare sector, reseal one changed group, or, once every
+// changed group is resealed, program the next segment header. Returns false
+// if there was nothing to do.
+static bool compact_step(void) {
+  if (g_compaction_stalled || !compaction_due())
     return false;
+
+  g_compaction_slices++;
+  for (int s = 0; s < STORAGE_SECTION_COUNT; s++) {
+    if (((g_sections_logged >> s) & 1) && !section_ready((storage_section_t)s)) {
+      g_compaction_stalled = true;
+      return true;
+    }
+  }
+  for (int s = STORAGE_SECTION_OATH; s < STORAGE_SECTION_COUNT; s++) {
+    if (!settle_section((storage_section_t)s)) {
+      g_compaction_stalled = true; // Storage full; the log keeps the entries
+      return true;
+    }
   }
 
-  ret = mbedtls_gcm_crypt_and_tag(
-      &ctx, MBEDTLS_GCM_ENCRYPT, STORAGE_PAYLOAD_SIZE, nonce,
-      STORAGE_NONCE_SIZE, NULL, 0, (const uint8_t *)src, ciphertext,
-      STORAGE_TAG_SIZE, tag);
+  uint32_t todo = g_groups_dirty & ~g_groups_staged;
+  for (uint32_t g = 0; todo && g < STORAGE_GROUP_COUNT; g++) {
+    if (!(todo & (1u << g)))
+      continue;
+    if (!(g_groups_prepared & (1u << g)))
+      prepare_group_spare(g);
+    else if (!stage_group(g))
+      g_compaction_stalled = true;
+    return true;
+  }
 
-  mbedtls_platform_zeroize(key, 32);
-  mbedtls_gcm_free(&ctx);
-  return (ret == 0);
+  g_dirty = true;
+  storage_commit(); // Only the header page is left to program
+  if (g_dirty)
+    g_compaction_stalled = true;
+  else
+    g_compaction_checkpoints++;
+  return true;
 }
 
-// ----------------------------------------------------------------------------
-// Core Storage API
-// ----------------------------------------------------------------------------
-
-void storage_init(void) {
-  if (g_initialized)
+void storage_task(void) {
+  if (!g_initialized || g_txn_open)
     return;
 
-  printf("Storage: Initializing Encrypted Storage...\n");
+  if (g_pending_any && now_ms() - g_pending_since_ms >= g_writeback_window_ms) {
+    storage_flush();
+    return;
+  }
 
-  const uint8_t *flash_ptr = (const uint8_t *)(XIP_BASE + STORAGE_OFFSET);
+  if (g_maintenance_policy && !g_maintenance_policy())
+    return;
 
-  // Attempt to decrypt
-  if (decrypt_storage(flash_ptr, &g_cache)) {
-    // Decryption success, check Magic
-    if (g_cache.magic == STORAGE_MAGIC) {
-      printf("Storage: Loaded and Decrypted Successfully.\n");
-      g_initialized = true;
+  // Idle: one slice of an import, else one sector of work per call: erase
+  // what is left of an imported image, pre-erase the next counter sector and
+  // the next log segment, compact once the log is filling up, else pre-erase
+  // the spare sectors of the changed groups.
+  if (import_pending()) {
+    import_slice(STORAGE_IMPORT_SLICE_BYTES);
+    return;
+  }
+  if (g_erase_version != STORAGE_MIGRATE_NONE) {
+    if (storage_migrate_erase_step(g_erase_version))
+      g_erase_version = STORAGE_MIGRATE_NONE;
+    return;
+  }
+  if (storage_counter_prepare())
+    return;
+  if (g_prepared_sectors < STORAGE_SEGMENT_SECTORS) {
+    prepare_next_segment(g_prepared_sectors + 1);
+    return;
+  }
+  if (compact_step())
+    return;
+  uint32_t unprepared = g_groups_dirty & ~g_groups_prepared & ~g_groups_staged;
+  for (uint32_t g = 0; unprepared && g < STORAGE_GROUP_COUNT; g++) {
+    if (unprepared & (1u << g)) {
+      prepare_group_spare(g);
       return;
-    } else {
-      printf("Storage: Valid crypto but invalid magic (First boot?). "
-             "Formatting...\n");
     }
-  } else {
-    printf("Storage: Decryption failed (Integrity or Key mismatch). "
-           "Formatting...\n");
   }
+}
 
-  // Format / Reset
-  memset(&g_cache, 0, sizeof(storage_cache_t));
-  g_cache.magic = STORAGE_MAGIC;
-  g_cache.version = STORAGE_VERSION;
+void storage_set_writeback_window(uint32_t window_ms) {
+  g_writeback_window_ms = window_ms;
+  if (window_ms == 0)
+    storage_flush();
+}
 
-  // Defaults
-  g_cache.system.retries_remaining = 3;
-  // PIN hashes would be set by user later
+bool storage_txn_begin(void) {
+  if (!g_initialized || g_txn_open)
+    return false;
+  // Earlier changes, an import included, are not part of the transaction;
+  // an abort falls back to what is on flash
+  await_import();
+  if (!storage_flush())
+    return false;
+  memset(g_txn_allocated, 0, sizeof(g_txn_allocated));
+  memset(g_txn_released, 0, sizeof(g_txn_released));
+  g_txn_open = true;
+  return true;
+}
 
-  g_dirty = true;
-  g_initialized = true;
-  storage_commit();
+bool storage_txn_commit(void) {
+  if (!g_txn_open)
+    return false;
+  g_txn_open = false;
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+    if ((g_txn_released[h / 32] >> (h % 32)) & 1)
+      storage_counter_free(h);
+  }
+  return storage_flush(); // One batch: replayed entirely or not at all
 }
 
-void storage_commit(void) {
-  if (!g_dirty)
-    return;
+// Drop a section's decrypted state and load it again from flash
+static void reload_section(storage_section_t section) {
+  uint32_t groups = section_groups(section);
+  if (section == STORAGE_SECTION_SYSTEM) {
+    mbedtls_platform_zeroize(&g_cache.system, sizeof(g_cache.system));
+    mbedtls_platform_zeroize(g_cache.hsm_keys, sizeof(g_cache.hsm_keys));
+    hsm_drop_key_contexts();
+  }
+  clear_section(section);
+  g_groups_loaded &= ~groups;
+  g_groups_dirty &= ~groups; // Replaying the log marks them again
+  g_groups_staged &= ~groups;
+  load_section(section);
+}
 
-  // Buffer for the Encrypted Blob (needs 32KB RAM)
-  // We allocate on heap to avoid stack overflow, assuming ample heap on RP2350
-  uint8_t *chk_buffer = malloc(STORAGE_SIZE_BYTES);
-  if (!chk_buffer) {
-    ERROR_REPORT_ERROR(ERROR_OUT_OF_MEMORY,
-                       "Failed to allocate buffer for storage commit");
+// Every change since storage_txn_begin() is still only pending in RAM, and
+// flash holds the state from before it: reload the sections it touched.
+// Counter values it advanced stay advanced.
+void storage_txn_abort(void) {
+  if (!g_txn_open)
     return;
+  g_txn_open = false;
+
+  uint32_t touched = 0;
+  for (uint8_t type = STORAGE_REC_SYSTEM; type <= STORAGE_REC_HSM_KEY; type++) {
+    for (uint32_t w = 0; w < STORAGE_SLOT_WORDS; w++) {
+      if (g_pending[type][w])
+        touched |= 1u << section_of(type);
+    }
+  }
+  clear_pending();
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+    if ((g_txn_allocated[h / 32] >> (h % 32)) & 1)
+      storage_counter_free(h);
   }
+  for (int s = 0; s < STORAGE_SECTION_COUNT; s++) {
+    if ((touched >> s) & 1)
+      reload_section((storage_section_t)s);
+  }
+}
 
-  printf("Storage: Encrypting and Committing...\n");
+void storage_set_maintenance_policy(storage_maintenance_policy_t may_run) {
+  g_maintenance_policy = may_run;
+}
 
-  if (!encrypt_storage(&g_cache, chk_buffer)) {
-    free(chk_buffer);
-    ERROR_REPORT_ERROR(ERROR_CRYPTO_FAILURE, "Storage encryption failed");
+void storage_get_compaction_stats(storage_compaction_stats_t *out) {
+  if (!out)
     return;
-  }
+  memset(out, 0, sizeof(*out));
+  if (!g_initialized)
+    return;
+  out->log_used = log_used();
+  out->log_free = STORAGE_SEGMENT_SIZE_BYTES - FLASH_PAGE_SIZE - out->log_used;
+  out->log_superseded = g_log_superseded;
+  out->groups_dirty = (uint8_t)__builtin_popcount(g_groups_dirty);
+  out->groups_staged = (uint8_t)__builtin_popcount(g_groups_staged);
+  out->slices = g_compaction_slices;
+  out->checkpoints = g_compaction_checkpoints;
+  out->forced = g_forced_checkpoints;
+}
+
+void storage_histogram_add(storage_histogram_t *hist, uint32_t value) {
+  uint32_t bucket = value ? 32u - (uint32_t)__builtin_clz(value) : 0;
+  if (bucket >= STORAGE_HIST_BUCKETS)
+    bucket = STORAGE_HIST_BUCKETS - 1;
+  hist->buckets[bucket]++;
+  hist->count++;
+  hist->sum += value;
+  if (value > hist->max)
+    hist->max = value;
+}
 
-  // Write to Flash
-  uint32_t ints = save_and_disable_interrupts();
-  flash_range_erase(STORAGE_OFFSET, STORAGE_SIZE_BYTES);
-  flash_range_program(STORAGE_OFFSET, chk_buffer, STORAGE_SIZE_BYTES);
-  restore_interrupts(ints);
+const storage_histogram_t *storage_get_histogram(storage_histogram_id_t id) {
+  if (id == STORAGE_HIST_IRQ_OFF_US)
+    return storage_flash_irq_off_us();
+  return id < STORAGE_HIST_COUNT ? &g_hist[id] : NULL;
+}
 
-  free(chk_buffer);
-  g_dirty = false;
-  printf("Storage: Commit Complete.\n");
+void storage_get_telemetry(storage_telemetry_t *out) {
+  if (!out)
+    return;
+  memset(out, 0, sizeof(*out));
+  out->bytes_encrypted = g_bytes_encrypted;
+  out->bytes_programmed = storage_flash_bytes_programmed();
+  out->sectors = STORAGE_AREA_SECTORS;
+  for (uint32_t sector = 0; sector < STORAGE_AREA_SECTORS; sector++) {
+    uint32_t erases = storage_flash_erase_count(sector);
+    out->total_erases += erases;
+    if (erases > out->worst_erases) {
+      out->worst_erases = erases;
+      out->worst_sector = (uint16_t)sector;
+    }
+  }
+}
+
+uint32_t storage_get_erase_count(uint32_t sector) {
+  return storage_flash_erase_count(sector);
 }
 
 bool storage_reset_device(void) {
-  memset(&g_cache, 0, sizeof(storage_cache_t));
-  g_cache.magic = STORAGE_MAGIC;
-  g_cache.version = STORAGE_VERSION;
+  storage_migrate_end();
+  g_import_open = false;
+  g_import_version = STORAGE_MIGRATE_NONE; // Not named by the new manifest
+  drop_key_contexts();
+  hsm_drop_key_contexts();
+  storage_counter_free_all();
+  reset_cache();
+  g_groups_loaded = STORAGE_GROUPS_ALL;
+  rebuild_indexes(STORAGE_SECTION_OATH);
+  rebuild_indexes(STORAGE_SECTION_FIDO2);
   g_cache.system.retries_remaining = 3;
+  g_groups_dirty = STORAGE_GROUPS_ALL;
+  g_groups_staged = 0;
   g_dirty = true;
   storage_commit();
+  if (g_dirty)
+    return false;
+
+  // Older segments and the spare group sectors still hold the wiped
+  // secrets; erase them too
+  for (uint32_t seg = 0; seg < STORAGE_SEGMENT_COUNT; seg++) {
+    if (seg != g_active_segment)
+      erase_segment_sectors(seg, 0, STORAGE_SEGMENT_SECTORS);
+  }
+  g_prepared_sectors = STORAGE_SEGMENT_SECTORS;
+  for (uint32_t g = 0; g < STORAGE_GROUP_COUNT; g++)
+    prepare_group_spare(g);
+
+  // So does an image left by older firmware, imported or not
+  uint32_t version;
+  if (storage_migrate_probe(&version) != STORAGE_MIGRATE_ABSENT) {
+    while (!storage_migrate_erase_step(version))
+      ;
+  }
+  g_erase_version = STORAGE_MIGRATE_NONE;
+
+  // The erased manifests held the wear table and the erases above are not
+  // in it yet: write every slice again (header pages only, the segments are
+  // erased)
+  for (uint32_t i = 0; i < STORAGE_WEAR_SLICES; i++) {
+    g_dirty = true;
+    storage_commit();
+  }
   return true;
 }
 
@@ -236,100 +2747,346 @@ bool storage_reset_device(void) {
 
 // OATH
 bool storage_load_oath_account(uint8_t index, storage_oath_entry_t *out_entry) {
-  if (index >= STORAGE_OATH_MAX_ACCOUNTS)
+  if (index >= STORAGE_OATH_MAX_ACCOUNTS ||
+      !section_ready(STORAGE_SECTION_OATH))
     return false;
-  if (g_cache.oath_entries[index].active != 1)
+  storage_oath_entry_t *e = fetch_entry(STORAGE_REC_OATH, index);
+  if (!e)
     return false;
-  memcpy(out_entry, &g_cache.oath_entries[index], sizeof(storage_oath_entry_t));
+  refresh_counter(STORAGE_REC_OATH, index, e);
+  memcpy(out_entry, e, sizeof(storage_oath_entry_t));
   return true;
 }
 
 bool storage_save_oath_account(uint8_t index,
                                const storage_oath_entry_t *entry) {
-  if (index >= STORAGE_OATH_MAX_ACCOUNTS)
+  if (index >= STORAGE_OATH_MAX_ACCOUNTS ||
+      !section_ready(STORAGE_SECTION_OATH))
     return false;
-  memcpy(&g_cache.oath_entries[index], entry, sizeof(storage_oath_entry_t));
-  g_cache.oath_entries[index].active = 1;
-  g_dirty = true;
-  storage_commit();
-  return true;
+  // The new value replaces the old one, which is not decrypted
+  storage_slot_meta_t *meta = &g_oath_meta[index];
+  int line = (meta->line != STORAGE_LINE_NONE) ? meta->line
+                                               : take_line(STORAGE_REC_OATH);
+  if (line < 0)
+    return false;
+  size_t old_size = stored_size(STORAGE_REC_OATH, index);
+  size_t new_size = sizeof(storage_record_header_t) + oath_packed_size(entry);
+  uint8_t group = choose_group(STORAGE_REC_OATH, index, old_size, new_size);
+  if (group == STORAGE_GROUP_NONE) {
+    ERROR_REPORT_ERROR(ERROR_STORAGE_FULL, "No room left for OATH accounts");
+    return false;
+  }
+  uint16_t handle;
+  if (!bind_counter(live_counter_handle(STORAGE_REC_OATH, index),
+                    entry->counter, &handle))
+    return false;
+  place_entry(STORAGE_REC_OATH, index, old_size, new_size, group);
+  if (meta->flags & STORAGE_META_ACTIVE)
+    storage_index_remove(&g_oath_index, meta->id.name_key, index);
+  install_line(STORAGE_REC_OATH, index, (uint8_t)line, entry);
+  g_oath_lines[line].active = 1;
+  g_oath_lines[line].counter_handle = handle;
+  meta->flags |= STORAGE_META_ACTIVE;
+  meta->size = (uint16_t)oath_packed_size(entry);
+  meta->counter_handle = handle;
+  meta->id.name_key = oath_name_key(entry);
+  storage_index_insert(&g_oath_index, meta->id.name_key, index);
+  oath_mark_free(index, false);
+  return storage_update(STORAGE_REC_OATH, index);
 }
 
 bool storage_delete_oath_account(uint8_t index) {
-  if (index >= STORAGE_OATH_MAX_ACCOUNTS)
+  if (index >= STORAGE_OATH_MAX_ACCOUNTS ||
+      !section_ready(STORAGE_SECTION_OATH))
     return false;
-  memset(&g_cache.oath_entries[index], 0, sizeof(storage_oath_entry_t));
-  g_dirty = true;
-  storage_commit();
-  return true;
+  if (!meta_active(STORAGE_REC_OATH, index))
+    return true; // Nothing stored, nothing to write
+  release_counter(live_counter_handle(STORAGE_REC_OATH, index));
+  place_entry(STORAGE_REC_OATH, index, stored_size(STORAGE_REC_OATH, index), 0,
+              STORAGE_GROUP_NONE);
+  storage_index_remove(&g_oath_index, g_oath_meta[index].id.name_key, index);
+  oath_mark_free(index, true);
+  forget_entry(STORAGE_REC_OATH, index);
+  return storage_update(STORAGE_REC_OATH, index);
+}
+
+bool storage_increment_oath_counter(uint8_t index, uint32_t *value_out) {
+  if (index >= STORAGE_OATH_MAX_ACCOUNTS ||
+      !section_ready(STORAGE_SECTION_OATH))
+    return false;
+  return increment_counter(STORAGE_REC_OATH, index, value_out);
+}
+
+// Index candidates share the name hash; only they are decrypted to compare
+// the name itself
+int storage_find_oath_account(const uint8_t *name, uint8_t name_len) {
+  if (name_len > FIELD_SIZE(storage_oath_entry_t, name) ||
+      !section_ready(STORAGE_SECTION_OATH))
+    return -1;
+  uint16_t candidates[STORAGE_OATH_MAX_ACCOUNTS];
+  uint32_t n = storage_index_find(&g_oath_index,
+                                  storage_index_name_key(name, name_len),
+                                  candidates, STORAGE_OATH_MAX_ACCOUNTS);
+  if (n > STORAGE_OATH_MAX_ACCOUNTS)
+    n = STORAGE_OATH_MAX_ACCOUNTS;
+
+  for (uint32_t c = 0; c < n; c++) {
+    if (candidates[c] >= STORAGE_OATH_MAX_ACCOUNTS)
+      continue;
+    const storage_oath_entry_t *e =
+        fetch_entry(STORAGE_REC_OATH, (uint8_t)candidates[c]);
+    if (e && e->name_len == name_len && memcmp(e->name, name, name_len) == 0)
+      return candidates[c];
+  }
+  return -1;
+}
+
+int storage_find_free_oath_slot(void) {
+  if (!section_ready(STORAGE_SECTION_OATH))
+    return -1;
+  for (uint32_t w = 0; w < sizeof(g_oath_free) / sizeof(g_oath_free[0]); w++) {
+    if (g_oath_free[w] == 0)
+      continue;
+    uint32_t slot = w * 32 + (uint32_t)__builtin_ctz(g_oath_free[w]);
+    return slot < STORAGE_OATH_MAX_ACCOUNTS ? (int)slot : -1;
+  }
+  return -1;
 }
 
 // FIDO2
 bool storage_load_fido2_cred(uint8_t index, storage_fido2_entry_t *out_entry) {
-  if (index >= STORAGE_FIDO2_MAX_CREDS)
+  if (index >= STORAGE_FIDO2_MAX_CREDS ||
+      !section_ready(STORAGE_SECTION_FIDO2))
     return false;
-  if (g_cache.fido2_entries[index].active != 1)
+  storage_fido2_entry_t *e = fetch_entry(STORAGE_REC_FIDO2, index);
+  if (!e)
     return false;
-  memcpy(out_entry, &g_cache.fido2_entries[index],
-         sizeof(storage_fido2_entry_t));
+  refresh_counter(STORAGE_REC_FIDO2, index, e);
+  memcpy(out_entry, e, sizeof(storage_fido2_entry_t));
   return true;
 }
 
 bool storage_save_fido2_cred(uint8_t index,
                              const storage_fido2_entry_t *entry) {
-  if (index >= STORAGE_FIDO2_MAX_CREDS)
+  if (index >= STORAGE_FIDO2_MAX_CREDS ||
+      !section_ready(STORAGE_SECTION_FIDO2))
     return false;
-  memcpy(&g_cache.fido2_entries[index], entry, sizeof(storage_fido2_entry_t));
-  g_cache.fido2_entries[index].active = 1;
-  g_dirty = true;
-  storage_commit();
-  return true;
+  // The new value replaces the old one, which is not decrypted
+  storage_slot_meta_t *meta = &g_fido2_meta[index];
+  int line = (meta->line != STORAGE_LINE_NONE) ? meta->line
+                                               : take_line(STORAGE_REC_FIDO2);
+  if (line < 0)
+    return false;
+  size_t old_size = stored_size(STORAGE_REC_FIDO2, index);
+  size_t new_size = sizeof(storage_record_header_t) + fido2_packed_size(entry);
+  uint8_t group = choose_group(STORAGE_REC_FIDO2, index, old_size, new_size);
+  if (group == STORAGE_GROUP_NONE) {
+    ERROR_REPORT_ERROR(ERROR_STORAGE_FULL,
+                       "No room left for FIDO2 credentials");
+    return false;
+  }
+  uint16_t handle;
+  if (!bind_counter(live_counter_handle(STORAGE_REC_FIDO2, index),
+                    entry->sign_count, &handle))
+    return false;
+  place_entry(STORAGE_REC_FIDO2, index, old_size, new_size, group);
+  if (meta->flags & STORAGE_META_ACTIVE)
+    storage_index_remove(&g_fido2_index,
+                         storage_index_digest_key(meta->id.rp_prefix), index);
+  install_line(STORAGE_REC_FIDO2, index, (uint8_t)line, entry);
+  g_fido2_lines[line].active = 1;
+  g_fido2_lines[line].counter_handle = handle;
+  meta->flags |= STORAGE_META_ACTIVE;
+  meta->size = (uint16_t)fido2_packed_size(entry);
+  meta->counter_handle = handle;
+  memcpy(meta->id.rp_prefix, entry->rp_id_hash, STORAGE_RP_PREFIX_SIZE);
+  storage_index_insert(&g_fido2_index,
+                       storage_index_digest_key(entry->rp_id_hash), index);
+  return storage_update(STORAGE_REC_FIDO2, index);
 }
 
 bool storage_delete_fido2_cred(uint8_t index) {
-  if (index >= STORAGE_FIDO2_MAX_CREDS)
+  if (index >= STORAGE_FIDO2_MAX_CREDS ||
+      !section_ready(STORAGE_SECTION_FIDO2))
     return false;
-  memset(&g_cache.fido2_entries[index], 0, sizeof(storage_fido2_entry_t));
-  g_dirty = true;
-  storage_commit();
-  return true;
+  if (!meta_active(STORAGE_REC_FIDO2, index))
+    return true; // Nothing stored, nothing to write
+  release_counter(live_counter_handle(STORAGE_REC_FIDO2, index));
+  place_entry(STORAGE_REC_FIDO2, index, stored_size(STORAGE_REC_FIDO2, index),
+              0, STORAGE_GROUP_NONE);
+  storage_index_remove(
+      &g_fido2_index,
+      storage_index_digest_key(g_fido2_meta[index].id.rp_prefix), index);
+  forget_entry(STORAGE_REC_FIDO2, index);
+  return storage_update(STORAGE_REC_FIDO2, index);
+}
+
+bool storage_increment_fido2_sign_count(uint8_t index, uint32_t *value_out) {
+  if (index >= STORAGE_FIDO2_MAX_CREDS ||
+      !section_ready(STORAGE_SECTION_FIDO2))
+    return false;
+  return increment_counter(STORAGE_REC_FIDO2, index, value_out);
+}
+
+int storage_find_free_fido2_slot(void) {
+  if (!section_ready(STORAGE_SECTION_FIDO2))
+    return -1;
+  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
+    if (!(g_fido2_meta[i].flags & STORAGE_META_ACTIVE))
+      return i;
+  }
+  return -1;
+}
+
+// Index candidates share the first bytes of the hash. The resident prefix
+// weeds out most false matches; the rest of the hash is confirmed on the
+// decrypted entry. Results come back in ascending slot order, as with a
+// linear scan.
+static uint8_t find_fido2_slots(const uint8_t *rp_id_hash, uint8_t *slots_out,
+                                uint8_t max_slots) {
+  if (!section_ready(STORAGE_SECTION_FIDO2))
+    return 0;
+  uint16_t candidates[STORAGE_FIDO2_MAX_CREDS];
+  uint32_t n = storage_index_find(&g_fido2_index,
+                                  storage_index_digest_key(rp_id_hash),
+                                  candidates, STORAGE_FIDO2_MAX_CREDS);
+  if (n > STORAGE_FIDO2_MAX_CREDS)
+    n = STORAGE_FIDO2_MAX_CREDS;
+
+  uint8_t count = 0;
+  for (uint32_t c = 0; c < n && count < max_slots; c++) {
+    uint16_t i = candidates[c];
+    if (i >= STORAGE_FIDO2_MAX_CREDS ||
+        !(g_fido2_meta[i].flags & STORAGE_META_ACTIVE) ||
+        memcmp(g_fido2_meta[i].id.rp_prefix, rp_id_hash,
+               STORAGE_RP_PREFIX_SIZE) != 0)
+      continue;
+    const storage_fido2_entry_t *e = fetch_entry(STORAGE_REC_FIDO2, (uint8_t)i);
+    if (e && memcmp(e->rp_id_hash, rp_id_hash, 32) == 0) {
+      if (slots_out)
+        slots_out[count] = (uint8_t)i;
+      count++;
+    }
+  }
+  return count;
 }
 
 bool storage_find_fido2_cred_by_rp(const uint8_t *rp_id_hash,
                                    storage_fido2_entry_t *out_entry,
                                    uint8_t *index_out) {
-  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
-    if (g_cache.fido2_entries[i].active == 1 &&
-        memcmp(g_cache.fido2_entries[i].rp_id_hash, rp_id_hash, 32) == 0) {
-      if (out_entry)
-        memcpy(out_entry, &g_cache.fido2_entries[i],
-               sizeof(storage_fido2_entry_t));
+  uint8_t i;
+  if (find_fido2_slots(rp_id_hash, &i, 1) == 0)
+    return false;
+  if (out_entry && !storage_load_fido2_cred(i, out_entry))
+    return false;
+  if (index_out)
+    *index_out = i;
+  return true;
+}
+
+uint8_t storage_find_fido2_creds_all_by_rp(const uint8_t *rp_id_hash,
+                                           uint8_t *indices_out,
+                                           uint8_t max_indices) {
+  return find_fido2_slots(rp_id_hash, indices_out, max_indices);
+}
+
+// Read-only views
+const storage_oath_entry_t *storage_view_oath_account(uint8_t index) {
+  if (index >= STORAGE_OATH_MAX_ACCOUNTS ||
+      !section_ready(STORAGE_SECTION_OATH))
+    return NULL;
+  storage_oath_entry_t *e = fetch_entry(STORAGE_REC_OATH, index);
+  if (e)
+    refresh_counter(STORAGE_REC_OATH, index, e);
+  return e;
+}
+
+const storage_fido2_entry_t *storage_view_fido2_cred(uint8_t index) {
+  if (index >= STORAGE_FIDO2_MAX_CREDS ||
+      !section_ready(STORAGE_SECTION_FIDO2))
+    return NULL;
+  storage_fido2_entry_t *e = fetch_entry(STORAGE_REC_FIDO2, index);
+  if (e)
+    refresh_counter(STORAGE_REC_FIDO2, index, e);
+  return e;
+}
+
+const storage_oath_entry_t *storage_next_oath_account(storage_iter_t *it,
+                                                      uint8_t *index_out) {
+  while (it->next < STORAGE_OATH_MAX_ACCOUNTS) {
+    uint8_t i = (uint8_t)it->next++;
+    const storage_oath_entry_t *e = storage_view_oath_account(i);
+    if (e) {
       if (index_out)
         *index_out = i;
-      return true;
+      return e;
     }
   }
-  return false;
+  return NULL;
 }
 
-uint8_t storage_find_fido2_creds_all_by_rp(const uint8_t *rp_id_hash,
-                                           uint8_t *indices_out,
-                                           uint8_t max_indices) {
+const storage_fido2_entry_t *storage_next_fido2_cred(storage_iter_t *it,
+                                                     uint8_t *index_out) {
+  while (it->next < STORAGE_FIDO2_MAX_CREDS) {
+    uint8_t i = (uint8_t)it->next++;
+    const storage_fido2_entry_t *e = storage_view_fido2_cred(i);
+    if (e) {
+      if (index_out)
+        *index_out = i;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+uint8_t storage_count_oath_accounts(void) {
+  if (!section_ready(STORAGE_SECTION_OATH))
+    return 0;
+  uint8_t free_slots = 0;
+  for (uint32_t w = 0; w < sizeof(g_oath_free) / sizeof(g_oath_free[0]); w++)
+    free_slots += (uint8_t)__builtin_popcount(g_oath_free[w]);
+  return STORAGE_OATH_MAX_ACCOUNTS - free_slots;
+}
+
+uint8_t storage_count_fido2_creds(void) {
+  if (!section_ready(STORAGE_SECTION_FIDO2))
+    return 0;
   uint8_t count = 0;
-  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS && count < max_indices; i++) {
-    if (g_cache.fido2_entries[i].active == 1 &&
-        memcmp(g_cache.fido2_entries[i].rp_id_hash, rp_id_hash, 32) == 0) {
-      if (indices_out) {
-        indices_out[count] = i;
-      }
+  for (uint8_t i = 0; i < STORAGE_FIDO2_MAX_CREDS; i++) {
+    if (g_fido2_meta[i].flags & STORAGE_META_ACTIVE)
       count++;
-    }
   }
   return count;
 }
 
+// Entry cache statistics
+static void pool_stats(uint8_t type, storage_cache_stats_t *out) {
+  const storage_line_pool_t *pool = line_pool(type);
+  *out = pool->stats;
+  out->lines = pool->lines;
+  out->resident = 0;
+  for (uint8_t l = 0; l < pool->lines; l++) {
+    if (pool->slot[l] != STORAGE_LINE_NONE)
+      out->resident++;
+  }
+}
+
+void storage_get_cache_stats(storage_cache_stats_t *oath_out,
+                             storage_cache_stats_t *fido2_out) {
+  if (oath_out)
+    pool_stats(STORAGE_REC_OATH, oath_out);
+  if (fido2_out)
+    pool_stats(STORAGE_REC_FIDO2, fido2_out);
+}
+
+void storage_reset_cache_stats(void) {
+  memset(&g_oath_pool.stats, 0, sizeof(g_oath_pool.stats));
+  memset(&g_fido2_pool.stats, 0, sizeof(g_fido2_pool.stats));
+}
+
 // HSM
 bool storage_load_hsm_key(uint8_t slot, storage_hsm_key_t *out_key) {
+  await_import();
   if (slot >= STORAGE_HSM_MAX_KEYS)
     return false;
   if (g_cache.hsm_keys[slot].active != 1)
@@ -339,33 +3096,33 @@ bool storage_load_hsm_key(uint8_t slot, storage_hsm_key_t *out_key) {
 }
 
 bool storage_save_hsm_key(uint8_t slot, const storage_hsm_key_t *key) {
+  await_import();
   if (slot >= STORAGE_HSM_MAX_KEYS)
     return false;
   memcpy(&g_cache.hsm_keys[slot], key, sizeof(storage_hsm_key_t));
   g_cache.hsm_keys[slot].active = 1;
-  g_dirty = true;
-  storage_commit();
-  return true;
+  return storage_update(STORAGE_REC_HSM_KEY, slot);
 }
 
 bool storage_delete_hsm_key(uint8_t slot) {
+  await_import();
   if (slot >= STORAGE_HSM_MAX_KEYS)
     return false;
+  if (g_cache.hsm_keys[slot].active != 1)
+    return true; // Nothing stored, nothing to write
   memset(&g_cache.hsm_keys[slot], 0, sizeof(storage_hsm_key_t));
-  g_dirty = true;
-  storage_commit();
-  return true;
+  return storage_update(STORAGE_REC_HSM_KEY, slot);
 }
 
 // System
 bool storage_load_pin_data(storage_system_t *out_data) {
+  await_import();
   memcpy(out_data, &g_cache.system, sizeof(storage_system_t));
   return true;
 }
 
 bool storage_save_pin_data(const storage_system_t *data) {
+  await_import();
   memcpy(&g_cache.system, data, sizeof(storage_system_t));
-  g_dirty = true;
-  storage_commit();
-  return true;
+  return storage_update(STORAGE_REC_SYSTEM, 0);
 }
@@ -0,0 +1,336 @@
+/*
+ * OpenToken Secure Storage - Wear-leveled monotonic counters
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "storage_counter.h"
+#include "error_handling.h"
+#include "storage_flash.h"
+#include <stdio.h>
+#include <string.h>
+
+// Layout of one counter sector
+// [HEADER (1 page)] [BASES (u32 per handle)] [BITMAPS (fixed bytes per handle)]
+// value = base + number of cleared bits in the handle's bitmap.
+// An increment programs a single byte (1->0) so it never needs an erase.
+// When a bitmap runs out the live values are carried into the next sector as
+// new bases; the header is programmed last so the old sector stays valid
+// until the new one is complete. Sectors are used round-robin, and the next
+// one is erased ahead of time (storage_counter_prepare()) so a rotation
+// inside a command only programs.
+#define COUNTER_SECTOR_MAGIC 0x434E5454 // "CNTT", 256 handle layout
+#define COUNTER_BASE_OFFSET FLASH_PAGE_SIZE
+#define COUNTER_BASE_UNSET 0xFFFFFFFF
+#define COUNTER_BITMAP_OFFSET                                                  \
+  (COUNTER_BASE_OFFSET +                                                       \
+   STORAGE_PAGE_ALIGN(STORAGE_COUNTER_MAX_HANDLES * sizeof(uint32_t)))
+#define COUNTER_BITMAP_BYTES                                                   \
+  ((FLASH_SECTOR_SIZE - COUNTER_BITMAP_OFFSET) / STORAGE_COUNTER_MAX_HANDLES)
+#define COUNTER_BITS (COUNTER_BITMAP_BYTES * 8)
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t generation_inv; // ~generation, rejects a torn header program
+} counter_sector_header_t;
+
+_Static_assert(STORAGE_COUNTER_SECTORS >= 2,
+               "Counter area needs at least two sectors to rotate");
+_Static_assert(COUNTER_BITMAP_BYTES >= 8,
+               "Counter sector too small for the handle count");
+
+typedef struct {
+  uint32_t base;
+  uint16_t used; // Cleared bits in the active sector
+  bool allocated;
+  bool unclaimed; // Holds a value at boot, owner not loaded yet
+} counter_state_t;
+
+static counter_state_t g_counters[STORAGE_COUNTER_MAX_HANDLES];
+static uint32_t g_counter_sector = 0;
+static uint32_t g_counter_generation = 0;
+static bool g_next_erased = false; // Sector after the active one is blank
+static uint8_t g_counter_page[FLASH_PAGE_SIZE];
+
+static inline uint32_t sector_offset(uint32_t sector) {
+  return STORAGE_COUNTER_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+static inline uint32_t next_sector(void) {
+  return (g_counter_sector + 1) % STORAGE_COUNTER_SECTORS;
+}
+
+static inline uint32_t base_offset(uint32_t sector,
+                                   storage_counter_handle_t handle) {
+  return sector_offset(sector) + COUNTER_BASE_OFFSET +
+         handle * sizeof(uint32_t);
+}
+
+static inline uint32_t bitmap_offset(uint32_t sector,
+                                     storage_counter_handle_t handle) {
+  return sector_offset(sector) + COUNTER_BITMAP_OFFSET +
+         handle * COUNTER_BITMAP_BYTES;
+}
+
+static uint16_t count_cleared_bits(const uint8_t *bitmap) {
+  uint16_t cleared = 0;
+  for (uint32_t i = 0; i < COUNTER_BITMAP_BYTES; i++) {
+    for (uint8_t b = (uint8_t)~bitmap[i]; b; b &= (uint8_t)(b - 1))
+      cleared++;
+  }
+  return cleared;
+}
+
+static void load_sector(uint32_t sector) {
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+    memcpy(&g_counters[h].base, storage_flash_ptr(base_offset(sector, h)),
+           sizeof(uint32_t));
+    g_counters[h].used =
+        count_cleared_bits(storage_flash_ptr(bitmap_offset(sector, h)));
+    g_counters[h].allocated = false;
+    g_counters[h].unclaimed = g_counters[h].base != COUNTER_BASE_UNSET;
+  }
+}
+
+// Clear bitmap bits [from, to) of a handle in the active sector.
+// Bytes outside that range are programmed as 0xFF, which leaves them as is.
+static void program_bitmap(storage_counter_handle_t handle, uint16_t from,
+                           uint16_t to) {
+  uint32_t start = bitmap_offset(g_counter_sector, handle);
+  uint32_t page = COUNTER_BASE_UNSET;
+
+  for (uint32_t i = from / 8; i <= (uint32_t)(to - 1) / 8; i++) {
+    uint32_t offset = start + i;
+    uint32_t page_offset = offset & ~(FLASH_PAGE_SIZE - 1);
+    if (page_offset != page) {
+      if (page != COUNTER_BASE_UNSET)
+        storage_flash_program(page, g_counter_page, FLASH_PAGE_SIZE);
+      memset(g_counter_page, 0xFF, sizeof(g_counter_page));
+      page = page_offset;
+    }
+    uint32_t cleared = (to - i * 8 >= 8) ? 8 : to - i * 8;
+    g_counter_page[offset - page_offset] = (uint8_t)(0xFF << cleared);
+  }
+  if (page != COUNTER_BASE_UNSET)
+    storage_flash_program(page, g_counter_page, FLASH_PAGE_SIZE);
+}
+
+static void program_base(storage_counter_handle_t handle, uint32_t value) {
+  uint32_t offset = base_offset(g_counter_sector, handle);
+  uint32_t page_offset = offset & ~(FLASH_PAGE_SIZE - 1);
+
+  memset(g_counter_page, 0xFF, sizeof(g_counter_page));
+  memcpy(g_counter_page + (offset - page_offset), &value, sizeof(value));
+  storage_flash_program(page_offset, g_counter_page, FLASH_PAGE_SIZE);
+}
+
+static inline bool counter_live(storage_counter_handle_t handle) {
+  return g_counters[handle].allocated || g_counters[handle].unclaimed;
+}
+
+// Carry every allocated or not yet claimed counter into the next sector as a
+// fresh base. Freed handles are left unset there, which makes them
+// allocatable again.
+static void counter_rotate(void) {
+  uint32_t target = next_sector();
+  uint32_t generation = g_counter_generation + 1;
+  uint32_t offset = sector_offset(target);
+
+  if (!g_next_erased)
+    storage_flash_erase(offset, FLASH_SECTOR_SIZE);
+
+  const uint32_t per_page = FLASH_PAGE_SIZE / sizeof(uint32_t);
+  for (uint32_t first = 0; first < STORAGE_COUNTER_MAX_HANDLES;
+       first += per_page) {
+    memset(g_counter_page, 0xFF, sizeof(g_counter_page));
+    for (uint32_t h = first;
+         h < first + per_page && h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+      if (!counter_live((storage_counter_handle_t)h))
+        continue;
+      uint32_t value = g_counters[h].base + g_counters[h].used;
+      memcpy(g_counter_page + (h - first) * sizeof(uint32_t), &value,
+             sizeof(value));
+    }
+    storage_flash_program(base_offset(target, (storage_counter_handle_t)first),
+                          g_counter_page, FLASH_PAGE_SIZE);
+  }
+
+  // Header last: commit point of the rotation
+  counter_sector_header_t hdr = {.magic = COUNTER_SECTOR_MAGIC,
+                                 .generation = generation,
+                                 .generation_inv = ~generation};
+  memset(g_counter_page, 0xFF, sizeof(g_counter_page));
+  memcpy(g_counter_page, &hdr, sizeof(hdr));
+  storage_flash_program(offset, g_counter_page, FLASH_PAGE_SIZE);
+
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+    if (counter_live(h))
+      g_counters[h].base += g_counters[h].used;
+    else
+      g_counters[h].base = COUNTER_BASE_UNSET;
+    g_counters[h].used = 0;
+  }
+  g_counter_sector = target;
+  g_counter_generation = generation;
+  g_next_erased = false;
+  printf("Storage: Counter area rotated to sector %lu (generation %lu).\n",
+         (unsigned long)target, (unsigned long)generation);
+}
+
+static inline bool handle_valid(storage_counter_handle_t handle) {
+  return handle < STORAGE_COUNTER_MAX_HANDLES &&
+         g_counters[handle].allocated;
+}
+
+// ----------------------------------------------------------------------------
+// Counter API
+// ----------------------------------------------------------------------------
+
+void storage_counter_init(void) {
+  int best = -1;
+  uint32_t best_generation = 0;
+  g_next_erased = false;
+
+  for (uint32_t sector = 0; sector < STORAGE_COUNTER_SECTORS; sector++) {
+    counter_sector_header_t hdr;
+    memcpy(&hdr, storage_flash_ptr(sector_offset(sector)), sizeof(hdr));
+    if (hdr.magic != COUNTER_SECTOR_MAGIC ||
+        hdr.generation_inv != ~hdr.generation)
+      continue;
+    if (best < 0 || hdr.generation > best_generation) {
+      best = (int)sector;
+      best_generation = hdr.generation;
+    }
+  }
+
+  if (best < 0) {
+    printf("Storage: No counter sector found, formatting counter area.\n");
+    memset(g_counters, 0, sizeof(g_counters));
+    g_counter_sector = STORAGE_COUNTER_SECTORS - 1;
+    g_counter_generation = 0;
+    counter_rotate();
+    return;
+  }
+
+  g_counter_sector = (uint32_t)best;
+  g_counter_generation = best_generation;
+  load_sector(g_counter_sector);
+}
+
+bool storage_counter_prepare(void) {
+  if (g_next_erased)
+    return false;
+  // The next sector holds an older generation than the active one, so
+  // erasing it early loses nothing
+  uint32_t offset = sector_offset(next_sector());
+  bool erase = !storage_flash_is_erased(offset, FLASH_SECTOR_SIZE);
+  if (erase)
+    storage_flash_erase(offset, FLASH_SECTOR_SIZE);
+  g_next_erased = true;
+  return erase;
+}
+
+bool storage_counter_alloc(uint32_t initial_value,
+                           storage_counter_handle_t *handle_out) {
+  if (initial_value == COUNTER_BASE_UNSET)
+    return false;
+
+  for (int pass = 0; pass < 2; pass++) {
+    bool any_free = false;
+    for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES;
+         h++) {
+      if (counter_live(h))
+        continue;
+      any_free = true;
+      // Slots of freed handles keep their old base until the next rotation
+      if (g_counters[h].base != COUNTER_BASE_UNSET || g_counters[h].used != 0)
+        continue;
+
+      program_base(h, initial_value);
+      g_counters[h].base = initial_value;
+      g_counters[h].allocated = true;
+      *handle_out = h;
+      return true;
+    }
+    if (!any_free)
+      break;
+    counter_rotate();
+  }
+
+  ERROR_REPORT_ERROR(ERROR_STORAGE_FULL, "No free monotonic counter handles");
+  return false;
+}
+
+bool storage_counter_claim(storage_counter_handle_t handle) {
+  // Only values found at boot: a handle allocated since then belongs to
+  // another entry even if a stale reference still names it
+  if (handle >= STORAGE_COUNTER_MAX_HANDLES || !g_counters[handle].unclaimed)
+    return false;
+  g_counters[handle].allocated = true;
+  g_counters[handle].unclaimed = false;
+  return true;
+}
+
+void storage_counter_release_unclaimed(void) {
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++)
+    g_counters[h].unclaimed = false;
+}
+
+void storage_counter_free(storage_counter_handle_t handle) {
+  if (handle < STORAGE_COUNTER_MAX_HANDLES) {
+    g_counters[handle].allocated = false;
+    g_counters[handle].unclaimed = false;
+  }
+}
+
+void storage_counter_free_all(void) {
+  for (storage_counter_handle_t h = 0; h < STORAGE_COUNTER_MAX_HANDLES; h++) {
+    g_counters[h].allocated = false;
+    g_counters[h].unclaimed = false;
+  }
+}
+
+bool storage_counter_read(storage_counter_handle_t handle,
+                          uint32_t *value_out) {
+  if (!handle_valid(handle))
+    return false;
+  *value_out = g_counters[handle].base + g_counters[handle].used;
+  return true;
+}
+
+bool storage_counter_advance(storage_counter_handle_t handle,
+                             uint32_t new_value) {
+  if (!handle_valid(handle) || new_value == COUNTER_BASE_UNSET)
+    return false;
+
+  counter_state_t *c = &g_counters[handle];
+  uint32_t current = c->base + c->used;
+  if (new_value < current)
+    return false;
+  if (new_value == current)
+    return true;
+
+  uint32_t delta = new_value - current;
+  if (delta > (uint32_t)(COUNTER_BITS - c->used)) {
+    // Out of bits in this sector: carry the new value over as its base
+    c->base = new_value;
+    c->used = 0;
+    counter_rotate();
+    return true;
+  }
+
+  program_bitmap(handle, c->used, (uint16_t)(c->used + delta));
+  c->used += (uint16_t)delta;
+  return true;
+}
+
+bool storage_counter_increment(storage_counter_handle_t handle,
+                               uint32_t *value_out) {
+  uint32_t value;
+  if (!storage_counter_read(handle, &value) ||
+      !storage_counter_advance(handle, value + 1))
+    return false;
+  if (value_out)
+    *value_out = value + 1;
+  return true;
+}
@@ -0,0 +1,72 @@
+/*
+ * OpenToken Secure Storage - Flash access
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "storage_flash.h"
+
+// Pico SDK Headers
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+static uint32_t g_erase_counts[STORAGE_AREA_SECTORS];
+static uint64_t g_bytes_programmed = 0;
+static storage_histogram_t g_irq_off_us;
+
+const uint8_t *storage_flash_ptr(uint32_t offset) {
+  return (const uint8_t *)(XIP_BASE + offset);
+}
+
+// Interrupts are only held off for one sector erase or one page program at a
+// time, so USB gets serviced between the steps of a long operation.
+void storage_flash_erase(uint32_t offset, uint32_t len) {
+  for (uint32_t done = 0; done < len; done += FLASH_SECTOR_SIZE) {
+    uint32_t at = offset + done;
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t t0 = time_us_32();
+    flash_range_erase(at, FLASH_SECTOR_SIZE);
+    uint32_t off_us = time_us_32() - t0;
+    restore_interrupts(ints);
+    storage_histogram_add(&g_irq_off_us, off_us);
+    if (at >= STORAGE_AREA_OFFSET)
+      g_erase_counts[(at - STORAGE_AREA_OFFSET) / FLASH_SECTOR_SIZE]++;
+  }
+}
+
+void storage_flash_program(uint32_t offset, const uint8_t *data,
+                           uint32_t len) {
+  for (uint32_t done = 0; done < len; done += FLASH_PAGE_SIZE) {
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t t0 = time_us_32();
+    flash_range_program(offset + done, data + done, FLASH_PAGE_SIZE);
+    uint32_t off_us = time_us_32() - t0;
+    restore_interrupts(ints);
+    storage_histogram_add(&g_irq_off_us, off_us);
+  }
+  g_bytes_programmed += len;
+}
+
+bool storage_flash_is_erased(uint32_t offset, uint32_t len) {
+  const uint8_t *p = storage_flash_ptr(offset);
+  for (uint32_t i = 0; i < len; i++) {
+    if (p[i] != 0xFF)
+      return false;
+  }
+  return true;
+}
+
+uint32_t storage_flash_erase_count(uint32_t sector) {
+  return sector < STORAGE_AREA_SECTORS ? g_erase_counts[sector] : 0;
+}
+
+void storage_flash_add_erase_count(uint32_t sector, uint32_t erases) {
+  if (sector < STORAGE_AREA_SECTORS)
+    g_erase_counts[sector] += erases;
+}
+
+uint64_t storage_flash_bytes_programmed(void) { return g_bytes_programmed; }
+
+const storage_histogram_t *storage_flash_irq_off_us(void) {
+  return &g_irq_off_us;
+}
@@ -0,0 +1,127 @@
+/*
+ * OpenToken Secure Storage - RAM hash index over stored digests
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "storage_index.h"
+#include <string.h>
+
+// Digests are SHA-256 outputs, so their leading bytes are already uniform and
+// serve as the hash directly.
+uint32_t storage_index_digest_key(const uint8_t *digest) {
+  uint32_t key;
+  memcpy(&key, digest, sizeof(key));
+  return key;
+}
+
+// FNV-1a, finished with a multiply so the low bits used for the home bucket
+// depend on every byte
+uint32_t storage_index_name_key(const uint8_t *name, uint32_t len) {
+  uint32_t h = 0x811C9DC5;
+  for (uint32_t i = 0; i < len; i++) {
+    h ^= name[i];
+    h *= 0x01000193;
+  }
+  h ^= h >> 16;
+  return h * 0x7FEB352D;
+}
+
+static inline uint32_t home_of(const storage_index_t *index, uint32_t key) {
+  return key & index->mask;
+}
+
+void storage_index_init(storage_index_t *index,
+                        storage_index_bucket_t *buckets,
+                        uint32_t bucket_count) {
+  index->buckets = buckets;
+  index->mask = bucket_count - 1;
+  storage_index_clear(index);
+}
+
+void storage_index_clear(storage_index_t *index) {
+  for (uint32_t i = 0; i <= index->mask; i++) {
+    index->buckets[i].key = 0;
+    index->buckets[i].slot = STORAGE_INDEX_EMPTY;
+  }
+  index->count = 0;
+}
+
+bool storage_index_insert(storage_index_t *index, uint32_t key, uint16_t slot) {
+  // Keep one bucket empty so every probe run terminates
+  if (slot == STORAGE_INDEX_EMPTY || index->count >= index->mask)
+    return false;
+
+  uint32_t i = home_of(index, key);
+  while (index->buckets[i].slot != STORAGE_INDEX_EMPTY) {
+    if (index->buckets[i].slot == slot && index->buckets[i].key == key)
+      return true; // Already filed
+    i = (i + 1) & index->mask;
+  }
+  index->buckets[i].key = key;
+  index->buckets[i].slot = slot;
+  index->count++;
+  return true;
+}
+
+void storage_index_remove(storage_index_t *index, uint32_t key, uint16_t slot) {
+  uint32_t i = home_of(index, key);
+  while (index->buckets[i].slot != STORAGE_INDEX_EMPTY) {
+    if (index->buckets[i].slot == slot && index->buckets[i].key == key)
+      break;
+    i = (i + 1) & index->mask;
+  }
+  if (index->buckets[i].slot == STORAGE_INDEX_EMPTY)
+    return;
+
+  // Backward shift: pull later members of the run into the hole unless their
+  // home lies cyclically in (hole, j]
+  uint32_t hole = i;
+  uint32_t j = i;
+  for (;;) {
+    j = (j + 1) & index->mask;
+    if (index->buckets[j].slot == STORAGE_INDEX_EMPTY)
+      break;
+    uint32_t home = home_of(index, index->buckets[j].key);
+    bool stays = (hole <= j) ? (hole < home && home <= j)
+                             : (hole < home || home <= j);
+    if (stays)
+      continue;
+    index->buckets[hole] = index->buckets[j];
+    hole = j;
+  }
+  index->buckets[hole].key = 0;
+  index->buckets[hole].slot = STORAGE_INDEX_EMPTY;
+  index->count--;
+}
+
+uint32_t storage_index_find(const storage_index_t *index, uint32_t key,
+                            uint16_t *slots_out, uint32_t max_slots) {
+  uint32_t found = 0;
+  uint32_t kept = 0;
+
+  for (uint32_t i = home_of(index, key);
+       index->buckets[i].slot != STORAGE_INDEX_EMPTY;
+       i = (i + 1) & index->mask) {
+    if (index->buckets[i].key != key)
+      continue;
+    found++;
+
+    // Keep the lowest max_slots slots, sorted (runs are short)
+    uint16_t slot = index->buckets[i].slot;
+    if (!slots_out || max_slots == 0)
+      continue;
+    if (kept == max_slots) {
+      if (slot > slots_out[kept - 1])
+        continue;
+      kept--;
+    }
+    uint32_t pos = kept;
+    while (pos > 0 && slots_out[pos - 1] > slot) {
+      slots_out[pos] = slots_out[pos - 1];
+      pos--;
+    }
+    slots_out[pos] = slot;
+    kept++;
+  }
+  return found;
+}
@@ -0,0 +1,356 @@
+/*
+ * OpenToken Secure Storage - Import of older storage layouts
+ * Copyright (c) 2025 OpenToken Project
+ */
+
+#include "storage_migrate.h"
+#include "error_handling.h"
+#include "storage.h"
+#include "storage_flash.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mbedtls/gcm.h"
+#include "mbedtls/platform_util.h"
+
+// ----------------------------------------------------------------------------
+// Version 2: single encrypted image
+// ----------------------------------------------------------------------------
+
+// The whole store as one AES-256-GCM blob (master key, no AAD) in the last
+// 32KB of flash:
+// [NONCE (12)] [TAG (16)] [ENCRYPTED_DATA (Remainder)]
+// The plaintext is the packed v2 cache: magic, version, system entry, 50
+// OATH accounts, 50 FIDO2 credentials, 4 HSM keys, zero padding. The entry
+// structs inside it were not packed; the system entry and HSM keys still
+// have that layout, the OATH and FIDO2 entries have since gained
+// counter_handle and are described here as they were.
+#define V2_VERSION 2
+#define V2_NONCE_SIZE 12
+#define V2_TAG_SIZE 16
+#define V2_HEADER_SIZE (V2_NONCE_SIZE + V2_TAG_SIZE)
+#define V2_PAYLOAD_SIZE (STORAGE_LEGACY_SIZE_BYTES - V2_HEADER_SIZE)
+#define V2_OATH_ACCOUNTS 50
+#define V2_FIDO2_CREDS 50
+#define V2_HSM_KEYS 4
+#define V2_CHUNK_SIZE 256 // Bytes decrypted at a time (multiple of 16)
+
+typedef struct {
+  uint8_t name[64];
+  uint8_t name_len;
+  uint8_t key[64];
+  uint8_t key_len;
+  uint8_t prop;
+  uint8_t type;
+  uint8_t digits;
+  uint8_t active;
+  uint32_t counter;
+} v2_oath_entry_t;
+
+typedef struct {
+  uint8_t rp_id_hash[32];
+  uint8_t user_id[64];
+  uint8_t user_id_len;
+  uint8_t cred_id[64];
+  uint8_t cred_id_len;
+  uint8_t priv_key[32];
+  uint32_t sign_count;
+  uint8_t active;
+  uint8_t flags;
+} v2_fido2_entry_t;
+
+_Static_assert(sizeof(v2_oath_entry_t) == 140, "v2 OATH entry layout");
+_Static_assert(sizeof(v2_fido2_entry_t) == 204, "v2 FIDO2 entry layout");
+_Static_assert(sizeof(storage_system_t) == 88, "v2 system entry layout");
+_Static_assert(sizeof(storage_hsm_key_t) == 214, "v2 HSM key layout");
+
+// Plaintext items in stream order; the padding after them is not read
+#define V2_ITEM_HEADER 0xFF // magic + version
+static const struct {
+  uint8_t kind; // storage_migrate_entry_t or V2_ITEM_HEADER
+  uint8_t count;
+  uint16_t size;
+} k_v2_items[] = {
+    {V2_ITEM_HEADER, 1, 2 * sizeof(uint32_t)},
+    {STORAGE_MIGRATE_ENTRY_SYSTEM, 1, sizeof(storage_system_t)},
+    {STORAGE_MIGRATE_ENTRY_OATH, V2_OATH_ACCOUNTS, sizeof(v2_oath_entry_t)},
+    {STORAGE_MIGRATE_ENTRY_FIDO2, V2_FIDO2_CREDS, sizeof(v2_fido2_entry_t)},
+    {STORAGE_MIGRATE_ENTRY_HSM_KEY, V2_HSM_KEYS, sizeof(storage_hsm_key_t)},
+};
+#define V2_ITEM_COUNT (sizeof(k_v2_items) / sizeof(k_v2_items[0]))
+
+_Static_assert(V2_OATH_ACCOUNTS <= STORAGE_OATH_MAX_ACCOUNTS &&
+                   V2_FIDO2_CREDS <= STORAGE_FIDO2_MAX_CREDS &&
+                   V2_HSM_KEYS <= STORAGE_HSM_MAX_KEYS,
+               "v2 slots must exist in the current layout");
+
+// Stream state. Pass 0 only authenticates; pass 1 decrypts again and
+// assembles one item at a time for the sink.
+static struct {
+  mbedtls_gcm_context gcm;
+  uint8_t pass;
+  uint32_t pos;   // Payload bytes of this pass done
+  uint8_t item;   // k_v2_items position
+  uint8_t index;  // Element of that item
+  uint16_t fill;  // Bytes of the element assembled so far
+  union {
+    uint8_t raw[1];
+    uint32_t header[2];
+    storage_system_t system;
+    v2_oath_entry_t oath;
+    v2_fido2_entry_t fido2;
+    storage_hsm_key_t hsm_key;
+  } entry;
+} g_v2;
+
+static storage_migrate_probe_t v2_probe(void) {
+  if (!storage_flash_is_erased(STORAGE_LEGACY_OFFSET, FLASH_SECTOR_SIZE))
+    return STORAGE_MIGRATE_PRESENT;
+  if (!storage_flash_is_erased(STORAGE_LEGACY_OFFSET + FLASH_SECTOR_SIZE,
+                               STORAGE_LEGACY_SIZE_BYTES - FLASH_SECTOR_SIZE))
+    return STORAGE_MIGRATE_LEFTOVER;
+  return STORAGE_MIGRATE_ABSENT;
+}
+
+static bool v2_begin(const uint8_t key[32]) {
+  memset(&g_v2, 0, sizeof(g_v2));
+  mbedtls_gcm_init(&g_v2.gcm);
+  if (mbedtls_gcm_setkey(&g_v2.gcm, MBEDTLS_CIPHER_ID_AES, key, 256) != 0) {
+    mbedtls_gcm_free(&g_v2.gcm);
+    return false;
+  }
+  return true;
+}
+
+static void v2_end(void) {
+  mbedtls_gcm_free(&g_v2.gcm);
+  mbedtls_platform_zeroize(&g_v2, sizeof(g_v2));
+}
+
+// Hand the element just assembled to the sink in the current layout.
+// Inactive entries are skipped.
+static storage_migrate_status_t v2_convert(uint8_t kind, uint8_t slot,
+                                           storage_migrate_sink_t sink) {
+  bool ok = true;
+  switch (kind) {
+  case V2_ITEM_HEADER:
+    if (g_v2.entry.header[0] != STORAGE_MAGIC ||
+        g_v2.entry.header[1] != V2_VERSION) {
+      ERROR_REPORT_ERROR(ERROR_STORAGE_CORRUPTION,
+                         "Legacy storage image has an unknown layout");
+      return STORAGE_MIGRATE_REJECTED;
+    }
+    break;
+  case STORAGE_MIGRATE_ENTRY_SYSTEM:
+  case STORAGE_MIGRATE_ENTRY_HSM_KEY:
+    if (kind == STORAGE_MIGRATE_ENTRY_SYSTEM || g_v2.entry.hsm_key.active == 1)
+      ok = sink((storage_migrate_entry_t)kind, slot, &g_v2.entry);
+    break;
+  case STORAGE_MIGRATE_ENTRY_OATH: {
+    const v2_oath_entry_t *old = &g_v2.entry.oath;
+    if (old->active != 1)
+      break;
+    storage_oath_entry_t e;
+    memset(&e, 0, sizeof(e));
+    memcpy(e.name, old->name, sizeof(e.name));
+    e.name_len = old->name_len;
+    memcpy(e.key, old->key, sizeof(e.key));
+    e.key_len = old->key_len;
+    e.prop = old->prop;
+    e.type = old->type;
+    e.digits = old->digits;
+    e.active = 1;
+    e.counter = old->counter;
+    ok = sink(STORAGE_MIGRATE_ENTRY_OATH, slot, &e);
+    mbedtls_platform_zeroize(&e, sizeof(e));
+    break;
+  }
+  case STORAGE_MIGRATE_ENTRY_FIDO2: {
+    const v2_fido2_entry_t *old = &g_v2.entry.fido2;
+    if (old->active != 1)
+      break;
+    storage_fido2_entry_t e;
+    memset(&e, 0, sizeof(e));
+    memcpy(e.rp_id_hash, old->rp_id_hash, sizeof(e.rp_id_hash));
+    memcpy(e.user_id, old->user_id, sizeof(e.user_id));
+    e.user_id_len = old->user_id_len;
+    memcpy(e.cred_id, old->cred_id, sizeof(e.cred_id));
+    e.cred_id_len = old->cred_id_len;
+    memcpy(e.priv_key, old->priv_key, sizeof(e.priv_key));
+    e.sign_count = old->sign_count;
+    e.active = 1;
+    e.flags = old->flags;
+    ok = sink(STORAGE_MIGRATE_ENTRY_FIDO2, slot, &e);
+    mbedtls_platform_zeroize(&e, sizeof(e));
+    break;
+  }
+  }
+  return ok ? STORAGE_MIGRATE_MORE : STORAGE_MIGRATE_STOPPED;
+}
+
+// Feed decrypted payload bytes into the item being assembled
+static storage_migrate_status_t v2_absorb(const uint8_t *data, size_t len,
+                                          storage_migrate_sink_t sink) {
+  while (len > 0 && g_v2.item < V2_ITEM_COUNT) {
+    size_t size = k_v2_items[g_v2.item].size;
+    size_t n = size - g_v2.fill;
+    if (n > len)
+      n = len;
+    memcpy(g_v2.entry.raw + g_v2.fill, data, n);
+    g_v2.fill = (uint16_t)(g_v2.fill + n);
+    data += n;
+    len -= n;
+    if (g_v2.fill < size)
+      break;
+
+    storage_migrate_status_t status =
+        v2_convert(k_v2_items[g_v2.item].kind, g_v2.index, sink);
+    mbedtls_platform_zeroize(&g_v2.entry, sizeof(g_v2.entry));
+    if (status != STORAGE_MIGRATE_MORE)
+      return status;
+    g_v2.fill = 0;
+    if (++g_v2.index == k_v2_items[g_v2.item].count) {
+      g_v2.index = 0;
+      g_v2.item++;
+    }
+  }
+  return STORAGE_MIGRATE_MORE;
+}
+
+// Constant time, the tag is secret until it matches
+static bool tag_matches(const uint8_t *a, const uint8_t *b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < V2_TAG_SIZE; i++)
+    diff |= a[i] ^ b[i];
+  return diff == 0;
+}
+
+static storage_migrate_status_t v2_step(storage_migrate_sink_t sink,
+                                        uint32_t budget) {
+  const uint8_t *image = storage_flash_ptr(STORAGE_LEGACY_OFFSET);
+  uint8_t chunk[V2_CHUNK_SIZE];
+  storage_migrate_status_t status = STORAGE_MIGRATE_MORE;
+
+  while (status == STORAGE_MIGRATE_MORE && budget > 0) {
+    if (g_v2.pos == 0 && mbedtls_gcm_starts(&g_v2.gcm, MBEDTLS_GCM_DECRYPT,
+                                            image, V2_NONCE_SIZE) != 0)
+      return STORAGE_MIGRATE_REJECTED;
+
+    if (g_v2.pos == V2_PAYLOAD_SIZE) {
+      uint8_t tag[V2_TAG_SIZE];
+      size_t out_len;
+      if (mbedtls_gcm_finish(&g_v2.gcm, NULL, 0, &out_len, tag,
+                             sizeof(tag)) != 0 ||
+          !tag_matches(tag, image + V2_NONCE_SIZE)) {
+        ERROR_REPORT_ERROR(ERROR_STORAGE_CORRUPTION,
+                           "Legacy storage image failed authentication");
+        return STORAGE_MIGRATE_REJECTED;
+      }
+      if (++g_v2.pass == 2)
+        return STORAGE_MIGRATE_DONE;
+      g_v2.pos = 0;
+      continue;
+    }
+
+    size_t n = V2_PAYLOAD_SIZE - g_v2.pos;
+    if (n > sizeof(chunk))
+      n = sizeof(chunk);
+    if (n > budget)
+      n = budget;
+    size_t out_len;
+    if (mbedtls_gcm_update(&g_v2.gcm, image + V2_HEADER_SIZE + g_v2.pos, n,
+                           chunk, sizeof(chunk), &out_len) != 0 ||
+        out_len != n) {
+      status = STORAGE_MIGRATE_REJECTED;
+    } else if (g_v2.pass == 1) {
+      status = v2_absorb(chunk, n, sink);
+    }
+    mbedtls_platform_zeroize(chunk, sizeof(chunk));
+    g_v2.pos += (uint32_t)n;
+    budget -= (uint32_t)n;
+  }
+  return status;
+}
+
+// Sector 0 (nonce and tag) goes first: from then on the image is gone
+static bool v2_erase_step(void) {
+  for (uint32_t off = 0; off < STORAGE_LEGACY_SIZE_BYTES;
+       off += FLASH_SECTOR_SIZE) {
+    if (!storage_flash_is_erased(STORAGE_LEGACY_OFFSET + off,
+                                 FLASH_SECTOR_SIZE)) {
+      storage_flash_erase(STORAGE_LEGACY_OFFSET + off, FLASH_SECTOR_SIZE);
+      return false;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Migration table
+// ----------------------------------------------------------------------------
+
+typedef struct {
+  uint32_t version; // STORAGE_VERSION that wrote the layout
+  storage_migrate_probe_t (*probe)(void);
+  bool (*begin)(const uint8_t key[32]);
+  storage_migrate_status_t (*step)(storage_migrate_sink_t sink,
+                                   uint32_t budget);
+  void (*end)(void);
+  bool (*erase_step)(void);
+} storage_migration_t;
+
+// Newest layout first
+static const storage_migration_t k_migrations[] = {
+    {V2_VERSION, v2_probe, v2_begin, v2_step, v2_end, v2_erase_step},
+};
+#define MIGRATION_COUNT (sizeof(k_migrations) / sizeof(k_migrations[0]))
+
+static const storage_migration_t *g_active = NULL;
+
+static const storage_migration_t *find_migration(uint32_t version) {
+  for (size_t i = 0; i < MIGRATION_COUNT; i++) {
+    if (k_migrations[i].version == version)
+      return &k_migrations[i];
+  }
+  return NULL;
+}
+
+storage_migrate_probe_t storage_migrate_probe(uint32_t *version_out) {
+  for (size_t i = 0; i < MIGRATION_COUNT; i++) {
+    storage_migrate_probe_t found = k_migrations[i].probe();
+    if (found != STORAGE_MIGRATE_ABSENT) {
+      *version_out = k_migrations[i].version;
+      return found;
+    }
+  }
+  *version_out = STORAGE_MIGRATE_NONE;
+  return STORAGE_MIGRATE_ABSENT;
+}
+
+bool storage_migrate_begin(uint32_t version, const uint8_t key[32]) {
+  const storage_migration_t *m = find_migration(version);
+  storage_migrate_end();
+  if (!m || !m->begin(key))
+    return false;
+  g_active = m;
+  return true;
+}
+
+storage_migrate_status_t storage_migrate_step(storage_migrate_sink_t sink,
+                                              uint32_t budget) {
+  if (!g_active)
+    return STORAGE_MIGRATE_REJECTED;
+  return g_active->step(sink, budget);
+}
+
+void storage_migrate_end(void) {
+  if (g_active)
+    g_active->end();
+  g_active = NULL;
+}
+
+bool storage_migrate_erase_step(uint32_t version) {
+  const storage_migration_t *m = find_migration(version);
+  return !m || m->erase_step();
+}